@@ -0,0 +1,89 @@
+#ifndef hpp_LatencyHistogram_hpp
+#define hpp_LatencyHistogram_hpp
+
+// We need types like uint32 here
+#include <Types.hpp>
+// We need memset
+#include <string.h>
+
+namespace Network
+{
+    namespace Client
+    {
+        /** A latency histogram, in the spirit of HDR histograms.
+            Values below 16 are counted exactly. Above, each power of two is split in 16 linear sub-buckets, so a value is
+            known within 6.25% of its magnitude, from 1 microsecond to 71 minutes, with a fixed size (about 1.9kB) and a
+            constant time recording */
+        struct LatencyHistogram
+        {
+            enum
+            {
+                SubBucketBits   = 4,
+                SubBuckets      = 1 << SubBucketBits,
+                BucketsCount    = (32 - SubBucketBits + 1) * SubBuckets,
+            };
+            /** The number of values in each bucket */
+            uint32 counts[BucketsCount];
+            /** The number of recorded values */
+            uint32 count;
+            /** The minimum and maximum recorded values */
+            uint32 minValue, maxValue;
+            /** The sum of the recorded values */
+            uint64 sum;
+
+            /** Record a value */
+            void record(const uint32 value)
+            {
+                counts[bucketOf(value)]++;
+                if (!count || value < minValue) minValue = value;
+                if (value > maxValue) maxValue = value;
+                sum += value;
+                count++;
+            }
+            /** Get the value at the given percentile (between 0 and 100), that's the highest value in the matching bucket.
+                @return 0 if no value was recorded */
+            uint32 valueAtPercentile(const double percentile) const
+            {
+                if (!count) return 0;
+                uint64 rank = (uint64)(percentile / 100.0 * count + 0.5);
+                if (rank < 1) rank = 1;
+                uint64 seen = 0;
+                for (uint32 i = 0; i < BucketsCount; i++)
+                {
+                    seen += counts[i];
+                    if (seen >= rank) return highestValueOf(i) < maxValue ? highestValueOf(i) : maxValue;
+                }
+                return maxValue;
+            }
+            /** Get the mean of the recorded values */
+            uint32 mean() const { return count ? (uint32)(sum / count) : 0; }
+            /** Forget all the recorded values */
+            void reset()
+            {
+                memset(counts, 0, sizeof(counts));
+                count = 0; minValue = 0; maxValue = 0; sum = 0;
+            }
+
+            /** Get the bucket's index for a value */
+            static uint32 bucketOf(const uint32 value)
+            {
+                if (value < SubBuckets) return value;
+                uint32 msb = 0;
+                for (uint32 v = value; v > 1; v >>= 1) msb++;
+                // The bucket is given by the most significant bit, the sub-bucket by the following bits
+                return (msb - SubBucketBits + 1) * SubBuckets + ((value >> (msb - SubBucketBits)) - SubBuckets);
+            }
+            /** Get the highest value counted in a bucket */
+            static uint32 highestValueOf(const uint32 bucket)
+            {
+                if (bucket < SubBuckets) return bucket;
+                const uint32 shift = bucket / SubBuckets - 1, sub = bucket % SubBuckets;
+                return (uint32)((((uint64)SubBuckets + sub + 1) << shift) - 1);
+            }
+
+            LatencyHistogram() { reset(); }
+        };
+    }
+}
+
+#endif
@@ -6,6 +6,10 @@
 
 // We need protocol declaration for this client
 #include <Protocol/MQTT/MQTT.hpp>
+#if MQTTLatencyProbe == 1
+  // We need the latency histogram for the probe's results
+  #include <Network/Clients/LatencyHistogram.hpp>
+#endif
 
 
 
@@ -16,6 +20,32 @@ namespace Network
     namespace Client
     {
 #ifndef HasMsgRecvCB
+  #if MQTTZeroCopyPublish == 1
+        /** A reference on a payload buffer owned by the application.
+            This is used to publish without copying the payload. The client (or the packet storage) keeps this reference until
+            the payload isn't required anymore and then calls the release callback exactly once.
+            If you need reference counting for your buffers, increment your counter before publishing and decrement it in the callback. */
+        struct PayloadRef
+        {
+            /** The release callback's signature */
+            typedef void (*ReleaseCallback)(const uint8 * data, const uint32 size, void * context);
+
+            /** The payload data */
+            const uint8 *   data;
+            /** The payload size in bytes */
+            uint32          size;
+            /** The callback to call when the payload isn't required anymore, can be null */
+            ReleaseCallback releaseCB;
+            /** An opaque context given back to the release callback */
+            void *          context;
+
+            /** Release the payload. This is only done once */
+            void release() { if (releaseCB) releaseCB(data, size, context); releaseCB = 0; }
+
+            PayloadRef(const uint8 * data = 0, const uint32 size = 0, ReleaseCallback releaseCB = 0, void * context = 0)
+                : data(data), size(size), releaseCB(releaseCB), context(context) {}
+        };
+  #endif
   #if MQTTQoSSupportLevel == 1
         /** Packet storage callback interface you must overload if you intend to reconnect upon network failure.
             In MQTTv5, since communication happens on a reliable transport (TCP), a QoS PUBLISH packet can be retransmitted
@@ -61,6 +91,24 @@ namespace Network
                 @param sizeTail     The size of the packet buffer tail in bytes (or zero if no data required in tail)
                 @return true if the packet was found and the arguments modified, false otherwise, in which case the publishing will abort */
             virtual bool loadPacketBuffer(const uint16 packetID, const uint8 *& bufferHead, uint32 & sizeHead, const uint8 *& bufferTail, uint32 & sizeTail) { return false; }
+    #if MQTTZeroCopyPublish == 1
+            /** Save the packet header and a reference on its payload, instead of the complete packet buffer.
+                The header is loaded back with loadPacketBuffer and the payload with loadPacketPayload.
+                The storage owns the payload reference and must release it in releasePacketBuffer.
+                @param packetID The packet identifier
+                @param header   The packet header buffer (everything except the payload)
+                @param size     The size of the packet header in bytes
+                @param payload  The reference on the packet payload
+                @return true if the packet was stored, false otherwise, in which case the client falls back to saving the complete
+                        packet with savePacketBuffer (and releases the payload itself) */
+            virtual bool savePacketParts(const uint16 packetID, const uint8 * header, const uint32 size, const PayloadRef & payload) { return false; }
+            /** Load the payload of a packet saved with savePacketParts
+                @param packetID The packet identifier
+                @param payload  If found, the pointer will be set to the packet payload
+                @param size     The size of the packet payload in bytes
+                @return true if the packet was saved with savePacketParts, false otherwise */
+            virtual bool loadPacketPayload(const uint16 packetID, const uint8 *& payload, uint32 & size) { return false; }
+    #endif
 
             virtual ~PacketStorage() {}
         };
@@ -71,6 +119,10 @@ namespace Network
             bool savePacketBuffer(const uint16 packetID, const uint8 * buffer, const uint32 size);
             bool releasePacketBuffer(const uint16 packetID);
             bool loadPacketBuffer(const uint16 packetID, const uint8 *& bufferHead, uint32 & sizeHead, const uint8 *& bufferTail, uint32 & sizeTail);
+    #if MQTTZeroCopyPublish == 1
+            bool savePacketParts(const uint16 packetID, const uint8 * header, const uint32 size, const PayloadRef & payload);
+            bool loadPacketPayload(const uint16 packetID, const uint8 *& payload, uint32 & size);
+    #endif
 
             /** The ring buffer storage size. Must be a power of 2 */
             RingBufferStorage(const size_t bufferSize, const size_t maxPacketCount);
@@ -88,6 +140,47 @@ namespace Network
         // Other value for QoS support level don't need to store QoS packet anyway
         typedef void PacketStorage;
   #endif
+#if MQTTRecvBufferPool > 1
+        /** A handle on a received message.
+            The topic, payload and properties are views on one of the client's receive buffers.
+            By default, the views are only valid during the MessageReceived::messageReceivedWithHandle callback.
+            If you want to use the message later on (for example, in a worker thread), copy the handle and call retain()
+            before returning from the callback. The client will then use another buffer of the pool for the next packets
+            and the retained buffer will only be reused once release() is called.
+
+            Retaining and releasing can happen in any thread.
+            If all the buffers in the pool are retained, the client keeps reading control packets (acknowledges, PINGRESP...)
+            in a spare buffer, but the next PUBLISH packet is only delivered once a buffer is released.
+            @warning You must release all the retained handles before destructing the client */
+        struct MessageHandle
+        {
+            typedef Protocol::MQTT::V5::DynamicStringView           DynamicStringView;
+            typedef Protocol::MQTT::V5::DynamicBinDataView          DynamicBinDataView;
+            typedef Protocol::MQTT::V5::PropertiesView              PropertiesView;
+
+            /** The topic for this publication */
+            DynamicStringView   topic;
+            /** The payload for this publication (can be empty) */
+            DynamicBinDataView  payload;
+            /** If non zero, contains the packet identifier */
+            uint16              packetIdentifier;
+            /** If any attached to the packet, you'll find the list here */
+            PropertiesView      properties;
+
+            /** Keep the underlying receive buffer alive after the callback returns. Each call must be matched by a call to release() */
+            void retain();
+            /** Release the underlying receive buffer. When the last reference is released, the buffer goes back to the client's pool */
+            void release();
+
+            MessageHandle(const DynamicStringView & topic, const DynamicBinDataView & payload, const uint16 packetIdentifier, const PropertiesView & properties, void * slot)
+                : topic(topic), payload(payload), packetIdentifier(packetIdentifier), properties(properties), slot(slot) {}
+
+        private:
+            /** The opaque reference counter for the receive buffer */
+            void *              slot;
+        };
+#endif
+
         /** Message received callback interface you must overload. */
         struct MessageReceived
         {
@@ -99,10 +192,21 @@ namespace Network
             /** This is called upon published message reception.
                 @param topic            The topic for this publication
                 @param payload          The payload for this publication (can be empty)
-                @param packetIdentifier If non zero, contains the packet identifier. This is usually ignored
+                @param packetIdentifier If non zero, contains the packet identifier. This is usually ignored, unless MQTTManualACK is set,
+                                        in which case it's the token to give to MQTTv5::acknowledge once you're done with the message
                 @param properties       If any attached to the packet, you'll find the list here. */
             virtual void messageReceived(const DynamicStringView & topic, const DynamicBinDataView & payload,
                                          const uint16 packetIdentifier, const PropertiesView & properties) = 0;
+#if MQTTRecvBufferPool > 1
+            /** This is called upon published message reception when the receive buffers are pooled.
+                Unlike the method above, the message can be retained to avoid copying it if you need it after this method returns.
+                By default, this calls messageReceived above and doesn't retain the message.
+                @param message          A handle on the received message. @sa MessageHandle */
+            virtual void messageReceivedWithHandle(MessageHandle & message)
+            {
+                messageReceived(message.topic, message.payload, message.packetIdentifier, message.properties);
+            }
+#endif
             /** This is usually called upon creation to know what it the maximum packet size you'll support.
                 By default, MQTT allows up to 256MB control packets.
                 On embedded system, this is very unlikely to be supported.
@@ -124,12 +228,48 @@ namespace Network
                 If any method detect a disconnection or a unexpected and fatal socket error, this will be called.
                 A standard client will likely reconnect here, and will resend any pending QoS packets.
                 The default implementation doesn't do anything since this client doesn't store the credentials used for connection.
-                So it won't reconnect by itself. However, if you're reconnecting without destructing the client, the first call to the event loop will resend unACKed packets.
+                So it won't reconnect by itself, unless MQTTUseReconnect is set and a MQTTv5::ReconnectPolicy is used. However, if you're reconnecting without destructing the client, the first call to the event loop will resend unACKed packets.
                 @note This is not compliant to continue using the client as if nothing happened after this function is called.
                 @param reasonCode       The reason for the disconnection if known
                 @param properties       A pointer to a property view in case of a DISCONNECT packet with such properties, or nullptr else */
             virtual void connectionLost(const ReasonCodes reasonCode, const PropertiesView * properties) {}
 
+#if MQTTAsyncSubscribe > 0
+            /** This is called when an asynchronous subscription or unsubscription packet is acknowledged.
+                Since a request can be split in multiple packets, this can be called multiple times per request, each time for a
+                consecutive range of topics.
+                @param requestID        The request identifier given to subscribeAsync or unsubscribeAsync
+                @param unsubscribe      True if the request was an unsubscription
+                @param firstTopic       The index of the first acknowledged topic in the request's topics list
+                @param reasonCodes      The reason code for each acknowledged topic (in the same order) or null if the connection was lost
+                                        before receiving the acknowledgement
+                @param count            The number of acknowledged topics */
+            virtual void scribeCompleted(const uint32 requestID, const bool unsubscribe, const uint32 firstTopic, const uint8 * reasonCodes, const uint32 count) {}
+#endif
+
+#if MQTTPublishCompletion == 1
+            /** This is called when a QoS publication's cycle is complete (upon receiving PUBACK for QoS 1, PUBCOMP for QoS 2 or
+                a PUBREC with a failure reason code) or when the publication is given up. A publication is given up if it expired
+                before being retransmitted (with MQTTMessageExpiry) or, if the packets aren't stored for retransmission
+                (MQTTQoSSupportLevel isn't 1), when the connection is lost.
+                @param packetID         The publication's packet identifier
+                @param reasonCode       The reason code given by the broker (0x80 and above are failures). A publication given up
+                                        upon connection loss has the disconnection reason code (or UnspecifiedError) and an expired
+                                        publication has UnspecifiedError
+                @param latencyUs        The time elapsed since the publication was first sent, in microseconds (wraps after 71 minutes) */
+            virtual void publishCompleted(const uint16 packetID, const ReasonCodes reasonCode, const uint32 latencyUs) {}
+#endif
+
+#if MQTTOutboundQueue > 0
+            /** This is called when the outbound queue crosses one of its watermarks.
+                Use this to slow down (or pause) your producers when the queue is getting full and resume when it's drained.
+                This is called from the publishing thread when crossing the high watermark and from the event loop thread (or
+                upon connection loss) when crossing the low watermark.
+                @param high             True if the queued size went above the high watermark, false if it went below the low watermark
+                @param queuedBytes      The size used in the queue in bytes */
+            virtual void outboundQueueWatermark(const bool high, const uint32 queuedBytes) {}
+#endif
+
 #if MQTTUseAuth == 1
             /** An authentication packet was received.
                 This is called either during connection and in the event loop in case the server started it
@@ -194,6 +334,8 @@ namespace Network
             typedef Protocol::MQTT::V5::ReasonCodes                 ReasonCodes;
             typedef Protocol::MQTT::V5::SubscribeTopic              SubscribeTopic;
             typedef Protocol::MQTT::V5::UnsubscribeTopic            UnsubscribeTopic;
+            typedef Protocol::MQTT::V5::SubscribeTopicArray         SubscribeTopicArray;
+            typedef Protocol::MQTT::V5::UnsubscribeTopicArray       UnsubscribeTopicArray;
 
             /** The error type returned by all methods */
             struct ErrorType
@@ -214,6 +356,7 @@ namespace Network
                     TranscientPacket    = -8,   //!< A transcient packet was captured and need to be processed first
                     WaitingForResult    = -9,   //!< The available answer is not ready yet, need to call again later on
                     StorageError        = -10,  //!< Can't store the value as expected
+                    Throttled           = -11,  //!< The outbound rate limit is reached and the outbound queue is full, retry later
 
                     UnknownError        = -1,   //!< An unknown error happened (or the developer was too lazy to create a valid entry in this table...)
                 };
@@ -225,7 +368,175 @@ namespace Network
                 ErrorType(const ReasonCodes code) : errorCode(code) {}
             };
 
+#if MQTTUseReconnect == 1
+            /** The automatic reconnection policy.
+                Once set with setReconnectPolicy, the client stores the parameters given to connectTo and, upon connection loss,
+                the eventLoop tries to reconnect with them (without clean start, so the broker resumes the session).
+                The CONNECT properties are copied, but the will message and any view property must stay valid while connected.
+                The delay between attempts is growing exponentially and is randomized to avoid all clients reconnecting at the same time.
+                If the broker doesn't have the session anymore, resubscribe is called so you can subscribe to your topics again.
+                Else, the unacknowledged QoS packets are retransmitted as usual.
+
+                The statistics members are updated by the client and can be read anytime from the eventLoop thread. */
+            struct ReconnectPolicy
+            {
+                /** The base delay used to compute the delay between attempts, in milliseconds */
+                uint32  minDelayMs;
+                /** The maximum delay between attempts, in milliseconds */
+                uint32  maxDelayMs;
+                /** The session expiry interval (in seconds) sent to the broker so it keeps the session while we are disconnected */
+                uint32  sessionExpiryInterval;
+
+                /** The number of successful reconnections */
+                uint32  reconnections;
+                /** The total number of failed reconnection attempts */
+                uint32  failedAttempts;
+                /** The number of reconnections where the broker had lost the session */
+                uint32  sessionsLost;
+                /** The time it took to recover from the last connection loss (including resubscribing), in milliseconds */
+                uint32  lastRecoveryTimeMs;
+                /** The longest time it took to recover from a connection loss, in milliseconds */
+                uint32  maxRecoveryTimeMs;
+
+                /** Compute the delay before the next reconnection attempt.
+                    By default, this is a random delay between 0 and min(maxDelayMs, minDelayMs * 2^attempt) ("full jitter" exponential backoff)
+                    @param attempt      The number of failed attempts since the connection was lost
+                    @param random       A random value
+                    @return The delay in milliseconds */
+                virtual uint32 nextDelay(const uint32 attempt, const uint32 random) const
+                {
+                    uint32 cap = attempt >= 31 || (maxDelayMs >> attempt) < minDelayMs ? maxDelayMs : minDelayMs << attempt;
+                    return cap == 0xFFFFFFFF ? random : random % (cap + 1);
+                }
+                /** This is called after reconnecting to a broker that had lost the session (or if the session expired).
+                    Subscribe to your topics again here.
+                    @return An ErrorType. If not successful, the connection is closed and retried later on */
+                virtual ErrorType resubscribe(MQTTv5 & client) { return ErrorType::Success; }
+
+                ReconnectPolicy(const uint32 minDelayMs = 100, const uint32 maxDelayMs = 60000, const uint32 sessionExpiryInterval = 3600)
+                    : minDelayMs(minDelayMs), maxDelayMs(maxDelayMs), sessionExpiryInterval(sessionExpiryInterval),
+                      reconnections(0), failedAttempts(0), sessionsLost(0), lastRecoveryTimeMs(0), maxRecoveryTimeMs(0) {}
+                virtual ~ReconnectPolicy() {}
+            };
+#endif
+
+#if MQTTPriorityScheduler > 0
+            /** The priority classes for the outgoing packets, from the highest to the lowest */
+            enum class Priority
+            {
+                Control     = 0,    //!< The client's own packets (PINGREQ, acknowledgements, subscriptions...), this can't be used for publishing
+                High        = 1,    //!< Urgent publications (like alarms)
+                Normal      = 2,    //!< The default for publications
+                Bulk        = 3,    //!< Large or low priority publications (that can be split in slices of MQTTPriorityScheduler bytes)
+            };
+#endif
 
+#if MQTTSocketTuning == 1
+            /** The socket tuning profiles, @sa setTuningProfile */
+            enum class TuningProfile
+            {
+                Default     = 0,    //!< Only TCP_NODELAY is set
+                LowLatency  = 1,    //!< Kernel busy polling when reading, quick acknowledgements and a limited amount of unsent data
+                BusyPoll    = 2,    //!< Like LowLatency, and the reads spin on the socket instead of sleeping. This burns a CPU core
+            };
+#endif
+
+#if MQTTStatistics == 1
+            /** A snapshot of the client's statistics, @sa getStatistics.
+                The counters are accumulated since the client's construction (they aren't reset upon reconnection) and wrap around */
+            struct Statistics
+            {
+                /** The number of control packets sent, indexed by control packet type (@sa Protocol::MQTT::V5::ControlPacketType) */
+                uint32 packetsSent[16];
+                /** The number of control packets received, indexed by control packet type */
+                uint32 packetsReceived[16];
+                /** The number of bytes sent */
+                uint64 bytesSent;
+                /** The number of bytes received */
+                uint64 bytesReceived;
+                /** The number of calls to the transport's send method (a system call for plain sockets) */
+                uint32 sendCalls;
+                /** The number of calls to the transport's receive method (a system call for plain sockets) */
+                uint32 recvCalls;
+                /** The number of receive calls that returned less data than required (the packet is completed by the next calls) */
+                uint32 partialReads;
+                /** The number of receive calls that timed out */
+                uint32 timeouts;
+                /** The number of failed send or receive calls */
+                uint32 networkErrors;
+                /** The number of times the connection was closed or lost */
+                uint32 connectionsLost;
+                /** The number of successful reconnections (with MQTTUseReconnect) */
+                uint32 reconnections;
+                /** The number of QoS publications sent and not acknowledged yet (they are also saved in the packet storage if MQTTQoSSupportLevel is 1) */
+                uint32 inFlightSent;
+                /** The number of QoS publications received and not acknowledged yet */
+                uint32 inFlightReceived;
+                /** The number of entries in the in flight table */
+                uint32 inFlightCapacity;
+                /** The number of bytes used in the outbound queue (with MQTTOutboundQueue) */
+                uint32 outboundQueued;
+                /** The number of acknowledgements waiting to be sent (with MQTTCoalesceACK) */
+                uint32 pendingReplies;
+            };
+#endif
+
+#if MQTTLatencyProbe == 1
+            /** The latency histogram, @sa Network::Client::LatencyHistogram */
+            typedef Network::Client::LatencyHistogram LatencyHistogram;
+
+            /** The latency probe's results, @sa startLatencyProbe */
+            struct ProbeStatistics
+            {
+                /** The round trip time of the probes (from publishing to receiving them back), in microseconds */
+                LatencyHistogram latency;
+                /** The number of probes sent */
+                uint32 sent;
+                /** The number of probes received (not counting the duplicates) */
+                uint32 received;
+                /** The number of probes missing, that's the probes that weren't received while a later one was (the probes in flight aren't counted) */
+                uint32 lost;
+                /** The number of probes received after a later one (they were counted as lost before) */
+                uint32 reordered;
+                /** The number of probes received more than once */
+                uint32 duplicated;
+            };
+#endif
+
+#if MQTTOutboundQueue > 0
+            /** An outbound rate limit.
+                This is a token bucket that limits the number of messages and bytes published per second, either for all the
+                publications of the client (if topicPrefix is null) or for the topics starting with the given prefix.
+                A publication is sent immediately if all the limits it matches allow it, else it's queued in the outbound queue
+                (up to MQTTOutboundQueue bytes) and sent later on by the event loop, in order. If the queue is full, publishing fails
+                with ErrorType::Throttled.
+
+                The bucket members are updated by the client and you shouldn't modify them once the limit is added. */
+            struct RateLimit
+            {
+                /** The topic prefix this limit applies to, or null for all topics. The string isn't copied */
+                const char *    topicPrefix;
+                /** The maximum number of messages per second (0 for unlimited) */
+                uint32          messagesPerSecond;
+                /** The maximum number of bytes per second (0 for unlimited) */
+                uint32          bytesPerSecond;
+                /** The burst duration in milliseconds, this is the bucket's capacity as a duration at the given rates */
+                uint32          burstMs;
+
+                /** The available messages (in thousandth of messages) */
+                uint64          messageTokens;
+                /** The available bytes (in thousandth of bytes) */
+                uint64          byteTokens;
+                /** The last time the bucket was refilled, in milliseconds */
+                uint32          lastRefill;
+                /** The next limit in the list */
+                RateLimit *     next;
+
+                RateLimit(const char * topicPrefix = nullptr, const uint32 messagesPerSecond = 0, const uint32 bytesPerSecond = 0, const uint32 burstMs = 1000)
+                    : topicPrefix(topicPrefix), messagesPerSecond(messagesPerSecond), bytesPerSecond(bytesPerSecond), burstMs(burstMs ? burstMs : 1),
+                      messageTokens(0), byteTokens(0), lastRefill(0), next(nullptr) {}
+            };
+#endif
 
 
             struct Impl;
@@ -310,7 +621,51 @@ namespace Network
                 @note This is expected to be called before the eventLoop thread is started or in the eventLoop thread.
                 @return An ErrorType */
             ErrorType subscribe(SubscribeTopic & topics, Properties * properties = nullptr);
+            /** Subscribe to some topics stored in a contiguous list.
+                This works like the method above, but the topics are serialized with a single copy, so it's faster for large subscription sets.
 
+                @param topics               The topics to subscribe to. They are not owned by this method.
+                @param properties           If provided those properties will be sent along the subscribe packet. @sa subscribe
+
+                @note This is expected to be called before the eventLoop thread is started or in the eventLoop thread.
+                @return An ErrorType */
+            ErrorType subscribe(const SubscribeTopicArray & topics, Properties * properties = nullptr);
+
+
+#if MQTTAsyncSubscribe > 0
+            /** Subscribe to some topics without waiting for the broker's answer.
+                The topics are packed in as few SUBSCRIBE packets as the broker's maximum packet size allows and all the packets
+                are sent without waiting for the acknowledgements (up to MQTTAsyncSubscribe packets in flight, in that case, this method
+                processes the incoming packets until it can send the next one).
+                The result for each topic is reported later on through the MessageReceived::scribeCompleted callback.
+
+                @param topics               The topics to subscribe to. @sa subscribe
+                @param requestID            An identifier for this request, that's given back to the scribeCompleted callback
+                @param properties           If provided those properties will be sent along each subscribe packet. Allowed properties for subscribe packet are:
+                                            Subscription Identifier, User property
+
+                @note This is expected to be called before the eventLoop thread is started or in the eventLoop thread.
+                @return An ErrorType. If an error is returned, some topics might have been sent already and will be reported */
+            ErrorType subscribeAsync(SubscribeTopic & topics, const uint32 requestID, Properties * properties = nullptr);
+            /** Subscribe to some topics stored in a contiguous list without waiting for the broker's answer.
+                The topics are sent directly from the list's buffer. @sa subscribeAsync */
+            ErrorType subscribeAsync(const SubscribeTopicArray & topics, const uint32 requestID, Properties * properties = nullptr);
+  #if MQTTUseUnsubscribe == 1
+            /** Unsubscribe from some topics without waiting for the broker's answer.
+                This works like subscribeAsync. The results are reported through the MessageReceived::scribeCompleted callback.
+
+                @param topics               The topics to unsubscribe from. @sa unsubscribe
+                @param requestID            An identifier for this request, that's given back to the scribeCompleted callback
+                @param properties           If provided those properties will be sent along each unsubscribe packet. Allowed properties for unsubscribe packet are:
+                                            User property
+
+                @note This is expected to be called before the eventLoop thread is started or in the eventLoop thread.
+                @return An ErrorType */
+            ErrorType unsubscribeAsync(UnsubscribeTopic & topics, const uint32 requestID, Properties * properties = nullptr);
+            /** Unsubscribe from some topics stored in a contiguous list without waiting for the broker's answer. @sa unsubscribeAsync */
+            ErrorType unsubscribeAsync(const UnsubscribeTopicArray & topics, const uint32 requestID, Properties * properties = nullptr);
+  #endif
+#endif
 
 #if MQTTUseUnsubscribe == 1
             /** Unsubscribe from some topics.
@@ -323,6 +678,8 @@ namespace Network
                 @note This is expected to be called before the eventLoop thread is started or in the eventLoop thread.
                 @return A reason code or success */
             ErrorType unsubscribe(UnsubscribeTopic & topics, Properties * properties = nullptr);
+            /** Unsubscribe from some topics stored in a contiguous list. @sa unsubscribe */
+            ErrorType unsubscribe(const UnsubscribeTopicArray & topics, Properties * properties = nullptr);
 #endif
 
             /** Publish to a topic.
@@ -339,10 +696,101 @@ namespace Network
                 @note You can call this method anytime from anywhere (including from inside a messageReceived callback) and in a different thread.
                       Upon an error return, the socket isn't closed automatically (since another thread might be publishing at the same time).
                       The next call to eventLoop() in its thread will clear the socket, call the connectionLost() callback and that's where you'll be able to
-                      reconnect with connectTo()  */
+                      reconnect with connectTo()
+                @note If MQTTOutboundQueue is set, the packet is queued (and sent by the event loop) if a rate limit or the broker's receive maximum
+                      doesn't allow sending it now. If the queue is full, ErrorType::Throttled is returned and the connection is kept.
+                      A packet larger than the broker's maximum packet size is refused with ErrorType::BadParameter */
             ErrorType publish(const char * topic, const uint8 * payload, const uint32 payloadLength, const bool retain = false, const QoSDelivery QoS = QoSDelivery::AtMostOne,
                               const uint16 packetIdentifier = 0, Properties * properties = nullptr);
 
+#if MQTTPriorityScheduler > 0
+            /** Publish to a topic with the given priority class.
+                The packet waits for the packets of a higher priority class (that are being sent or waiting to be sent) before being sent.
+                This is the same as the other publish method otherwise (the packet identifier is always selected automatically).
+                @param priority             The priority class for this publication (Control is refused)
+                @param topic                The topic to publish into.
+                @param payload              The payload to send to this publication, can be null
+                @param payloadLength        The length of the payload in bytes.
+                @param retain               The retain flag for this message. It can't be set for a payload that's split.
+                @param QoS                  The quality of service delivery flag to use.
+                @param properties           If provided those properties will be sent along the publish packet(s). @sa publish
+                @param split                If true, in the Bulk class, a payload larger than MQTTPriorityScheduler is sent in many publications
+                                            of at most MQTTPriorityScheduler bytes, in order, on the same topic and with the same properties, so
+                                            the other classes' packets are sent in between. The subscribers receive the slices as separate messages,
+                                            so only use this if they can reassemble them. Else, the payload is sent in a single publication.
+                @return An ErrorType. Upon error for a split payload, the slices that were already sent aren't recalled
+                @note You can call this method anytime from anywhere, in any thread. It only makes sense when many threads are publishing */
+            ErrorType publish(const Priority priority, const char * topic, const uint8 * payload, const uint32 payloadLength, const bool retain = false,
+                              const QoSDelivery QoS = QoSDelivery::AtMostOne, Properties * properties = nullptr, const bool split = false);
+#endif
+
+#if MQTTManualACK == 1 && MQTTQoSSupportLevel != -1
+            /** Acknowledge a received message.
+                In manual acknowledgement mode, the client doesn't reply to a QoS1 or QoS2 PUBLISH packet when the messageReceived callback returns.
+                Instead, you must call this method once you've processed the message, so the PUBACK or PUBREC packet is sent to the broker.
+                Until then, the packet identifier is kept in the in-flight table and the broker will not send more unacknowledged messages than
+                what MessageReceived::maxUnACKedPackets returns.
+                @param packetIdentifier     The packet identifier given to the messageReceived callback. If zero (QoS0 message), nothing is done
+                @param reasonCode           The reason code to send to the broker. Any of Success, NoMatchingSubscribers or an error code to refuse the message
+                @return An ErrorType. BadParameter is returned if the packet identifier isn't waiting for an acknowledgement
+                @note You can call this method anytime from anywhere and in a different thread. Like publish, an error isn't closing the socket
+                      but the next call to eventLoop() will. */
+            ErrorType acknowledge(const uint16 packetIdentifier, const ReasonCodes reasonCode = ReasonCodes::Success);
+#endif
+
+#if MQTTZeroCopyPublish == 1
+            /** Publish to a topic without copying the payload.
+                This is the same as the other publish method, except that the payload is never copied: the packet header is serialized
+                and sent along the payload in a single vectored call, and for QoS packets, the packet storage only saves the header
+                and keeps the payload reference (if it supports it) until the packet is acknowledged.
+                @param topic                The topic to publish into.
+                @param payload              The payload reference. It's released (with its callback) once the client doesn't need it anymore,
+                                            this can happen in this method (if QoS is 0 or upon error) or later on, in the eventLoop thread
+                @param retain               The retain flag for this message.
+                @param QoS                  The quality of service delivery flag to use.
+                @param packetIdentifier     If using a QoS different than AtMostOne, you can force packet identifier (leave to 0 for auto selection of this identifier)
+                @param properties           If provided those properties will be sent along the publish packet. @sa publish
+                @return An ErrorType
+                @note Like the other publish method, you can call this method anytime from anywhere.
+                      If MQTTOutboundQueue is set, the payload can't be queued, so ErrorType::Throttled is returned (and the payload released)
+                      unless the packet can be sent now. */
+            ErrorType publish(const char * topic, const PayloadRef & payload, const bool retain = false, const QoSDelivery QoS = QoSDelivery::AtMostOne,
+                              const uint16 packetIdentifier = 0, Properties * properties = nullptr);
+#endif
+
+#if MQTTForwardPublish == 1
+            /** Republish a received message without rebuilding it.
+                This is meant for bridges: the message received by a client (in its MessageReceived::messageReceived callback) is
+                published again on this client. Only the fixed header, the topic and the packet identifier are serialized, the
+                received properties and the payload are sent from the receive buffer in a single vectored call.
+                The Subscription Identifier and Topic Alias properties are removed since they only make sense on the receiving connection.
+                @param topic                The received topic
+                @param payload              The received payload
+                @param properties           The received properties
+                @param retain               The retain flag for this message.
+                @param QoS                  The quality of service delivery flag to use.
+                @param newTopic             If provided, the message is published on this topic instead of the received one
+                @param editedProperties     If provided, those properties are sent along the received ones, replacing the received properties
+                                            of the same type (except for User Property which is appended)
+                @param packetIdentifier     If using a QoS different than AtMostOne, you can force packet identifier (leave to 0 for auto selection of this identifier)
+                @return An ErrorType. BadProperties is returned if the received properties are malformed
+                @warning The views must still be valid, so call this from the callback or on a retained MessageHandle.
+                         For QoS packets, the packet storage saves a copy of the packet (like publish).
+                @note Like the zero copy publish method, if MQTTOutboundQueue is set, the message can't be queued, so ErrorType::Throttled
+                      is returned unless it can be sent now. */
+            ErrorType forward(const DynamicStringView & topic, const DynamicBinDataView & payload, const PropertiesView & properties, const bool retain = false,
+                              const QoSDelivery QoS = QoSDelivery::AtMostOne, const char * newTopic = nullptr, Properties * editedProperties = nullptr,
+                              const uint16 packetIdentifier = 0);
+  #if MQTTRecvBufferPool > 1
+            /** Republish a received message without rebuilding it. @sa forward above */
+            ErrorType forward(const MessageHandle & message, const bool retain = false, const QoSDelivery QoS = QoSDelivery::AtMostOne,
+                              const char * newTopic = nullptr, Properties * editedProperties = nullptr, const uint16 packetIdentifier = 0)
+            {
+                return forward(message.topic, message.payload, message.properties, retain, QoS, newTopic, editedProperties, packetIdentifier);
+            }
+  #endif
+#endif
+
             /** The client event loop you must call regularly.
                 MQTT is a bidirectional protocol where the server sends packet to the client even without it asking for it.
                 So you must call this method regularly to fetch any pending message and prevent the client from being disconnected from the server.
@@ -365,6 +813,116 @@ namespace Network
             /** Set the default network timeout used in millisecond */
             void setDefaultTimeout(const uint32 timeoutMs);
 
+#if MQTTUseReconnect == 1
+            /** Set the automatic reconnection policy.
+                This must be called before connectTo so the connection parameters are stored.
+                Upon connection loss, eventLoop will return NotConnected (without blocking) until it's time to retry, and then it'll
+                try to reconnect. Calling disconnect stops reconnecting until the next successful connectTo.
+                @param policy       A pointer to the policy that must outlive this client (it's not owned) or null to disable reconnection
+                @warning The will message given to connectTo isn't copied, so it must outlive the client too
+                @note This is expected to be called before the eventLoop thread is started or in the eventLoop thread. */
+            void setReconnectPolicy(ReconnectPolicy * policy);
+#endif
+
+#if MQTTOutboundQueue > 0
+            /** Add an outbound rate limit.
+                Up to 32 limits can be added. A publication must be allowed by all the limits matching its topic to be sent.
+                @param limit        A pointer to the limit that must outlive this client (it's not owned)
+                @note This is expected to be called before publishing.
+                @return ErrorType::BadParameter if there's too many limits */
+            ErrorType addRateLimit(RateLimit * limit);
+            /** Set the outbound queue watermarks.
+                By default, they are 1/4 and 3/4 of the queue's size. @sa MessageReceived::outboundQueueWatermark
+                @param lowBytes     The low watermark in bytes
+                @param highBytes    The high watermark in bytes */
+            void setOutboundWatermarks(const uint32 lowBytes, const uint32 highBytes);
+#endif
+
+#if MQTTSocketTuning == 1
+            /** Select the socket tuning profile.
+                The profile is applied to the current connection (if any) and to the next ones.
+                @param profile      The tuning profile
+                @param cpu          If positive or zero, the calling thread is pinned to this CPU core (only on Linux)
+                @note This is expected to be called in the eventLoop thread (or before it's started, from the thread that'll run it).
+                @return ErrorType::BadParameter if the thread can't be pinned, ErrorType::NetworkError if the options can't be set */
+            ErrorType setTuningProfile(const TuningProfile profile, const int cpu = -1);
+#endif
+
+#if MQTTMessageExpiry == 1
+            /** Get the number of publications that expired (as per their Message Expiry Interval property) before being sent
+                or retransmitted, and were dropped. This is updated by the event loop thread */
+            uint32 getExpiredMessagesCount() const;
+#endif
+
+#if MQTTLatencyProbe == 1
+            /** Start the end to end latency probe.
+                The client subscribes to the given topic (with auto feedback, so it receives its own publications) and the event
+                loop publishes a small probe (QoS 0) on it at the given period. Each probe carries a sequence number and the time
+                it was sent (from a monotonic clock), so the round trip time through the broker is recorded in a histogram when
+                it's received back, and the missing, reordered and duplicated probes are counted.
+                The probes are consumed by the client, they don't reach the MessageReceived callback, and the probes published on
+                the topic by other clients are ignored. With MQTTUseReconnect, the topic is subscribed again if the session is lost.
+                @param topic        The dedicated topic for the probes (it's copied)
+                @param periodMs     The period between two probes in milliseconds. The event loop's timeout limits the accuracy
+                @note This is expected to be called in the eventLoop thread (or before it's started), once connected.
+                @return An ErrorType */
+            ErrorType startLatencyProbe(const char * topic, const uint32 periodMs);
+            /** Stop the latency probe. With MQTTUseUnsubscribe, the topic is unsubscribed.
+                Until the unsubscription succeeds (so always without MQTTUseUnsubscribe), the messages on the probe's topic are
+                still consumed by the client and don't reach the MessageReceived callback.
+                @note This is expected to be called in the eventLoop thread (or before it's started) */
+            ErrorType stopLatencyProbe();
+            /** Get the latency probe's results
+                @param stats        On output, filled with the probe's results
+                @param reset        If true, the results are reset after being copied (to measure the next interval)
+                @note This is expected to be called in the eventLoop thread, else the results might be inconsistent */
+            void getLatencyProbe(ProbeStatistics & stats, const bool reset = false);
+#endif
+
+#if MQTTStatistics == 1
+            /** Get a snapshot of the client's statistics.
+                This can be called from any thread. The counters are read one by one without locking, so they might be slightly
+                inconsistent with each other if the event loop is running at the same time.
+                @param stats        On output, filled with the current statistics */
+            void getStatistics(Statistics & stats) const;
+#endif
+
+#if MQTTPacketCapture > 0
+            /** Start recording the packets sent and received in the capture ring.
+                The ring is split in slots of the given size (plus a small header), so each packet is truncated to this length.
+                Previously recorded packets are discarded.
+                @param snapLength   The maximum number of bytes captured per packet (the packet's length is always recorded)
+                @note This must not be called while the client is sending or receiving in another thread
+                @return BadParameter if the ring can't hold at least 2 slots of this size */
+            ErrorType startCapture(const uint32 snapLength = 256);
+            /** Stop recording packets. The ring is kept, so it can still be saved */
+            void stopCapture();
+            /** Save the recorded packets to a pcap file.
+                The packets are wrapped in synthesized IPv4 and TCP headers (the client is 10.0.0.1, the broker 10.0.0.2 on port
+                1883, the sequence numbers follow the recorded packets' length) so Wireshark's MQTT dissector decodes them.
+                This can be called from any thread, even while capturing (the slots being overwritten while saved are skipped).
+                @param path         The file to write
+                @return StorageError if the file can't be written */
+            ErrorType saveCapture(const char * path) const;
+#endif
+
+#if MQTTTLSSessionCache > 0
+            /** Forget all the TLS sessions cached for resumption (for all the clients of the process).
+                The next connections will perform a full handshake. This is useful if the certificates were renewed */
+            static void forgetTLSSessions();
+#endif
+
+#if MQTTTLSCoalesceWrites > 0
+            /** Start a batch of packets: on a TLS connection, the packets sent until endBatch are packed in as few TLS
+                records as possible. Batches can be nested, the data is sent when the outermost batch ends (or when the write
+                buffer is full, or before waiting for an answer from the broker).
+                This has no effect on a plain connection */
+            void beginBatch();
+            /** End a batch of packets and send the pending data if it's the outermost batch
+                @return NetworkError if the pending data can't be sent */
+            ErrorType endBatch();
+#endif
+
             // Construction and destruction
         public:
             /** Default constructor
@@ -77,6 +77,20 @@
   #define MQTTOnlyBSDSocket   1
 #endif
 
+/** io_uring transport
+    If set to 1, the BSD socket code (MQTTOnlyBSDSocket) uses Linux's io_uring interface for the plain (non TLS) connections.
+    The kernel receives the data in a ring of provided buffers with a single (multishot) receive request, the small packets
+    are sent from a registered buffer and the packets made of many buffers are sent as linked requests with a single system call.
+    If set to 2, a kernel thread also polls the sending queue (SQPOLL), so sending doesn't require any system call while the
+    connection is busy, at the cost of a CPU core spinning.
+    On older kernels (or if io_uring is disabled or forbidden), the connection uses the usual socket calls instead.
+    This has no effect on TLS connections. With CMake, use the ENABLE_IO_URING option to set it to 1.
+
+    Default: 0 */
+#ifndef MQTTUseIOUring
+  #define MQTTUseIOUring      0
+#endif
+
 /** Low latency mode
     If set to 1, this will only wait on the receiving socket in a non blocking fashion.
     You'll use this if you need to do other processing in your main application loop. It reduces latency for your
@@ -103,6 +117,250 @@
   #define MQTTMultithread 1
 #endif
 
+/** Coalesce acknowledgements
+    If set to a positive value, the PUBACK / PUBREC / PUBREL / PUBCOMP replies generated while receiving packets are not
+    sent immediately but accumulated and sent in a single call at the end of the event loop pass. In that mode, the
+    event loop also drains any packet that's already available on the socket before returning.
+    The value is the maximum number of replies to accumulate before flushing them (so it bounds both the memory used,
+    roughly 8 bytes per reply, and the latency added to an acknowledgement).
+    This dramatically reduces the number of system calls when receiving a lot of QoS packets.
+    Replies are always sent in the order they were generated and before any other packet from the event loop.
+
+    Default: 0 */
+#ifndef MQTTCoalesceACK
+  #define MQTTCoalesceACK 0
+#endif
+
+/** Manual acknowledgement
+    If set to 1, the PUBACK / PUBREC reply for a received QoS packet is not sent automatically when the messageReceived
+    callback returns. Instead, the packet identifier given to the callback acts as an acknowledgement token and the
+    application must call MQTTv5::acknowledge with it once it's done processing the message (from any thread).
+    This allows to hand over the message to worker threads without stalling the event loop, while still providing
+    end to end "at least once" semantic. Until acknowledged, the packet identifier is kept in the in-flight table, so
+    the broker will not send more than maxUnACKedPackets unacknowledged messages.
+    This has no effect if MQTTQoSSupportLevel is -1.
+
+    Default: 0 */
+#ifndef MQTTManualACK
+  #define MQTTManualACK 0
+#endif
+
+/** Receive buffers pool
+    If set to a value larger than 1, the client allocates this number of receive buffers (each of maxPacketSize bytes)
+    instead of a single one. The MessageReceived::messageReceivedWithHandle callback can then retain the received message
+    (with no copy) and release it later on from any thread while the client continues receiving in another buffer.
+    This is useful to hand over messages to worker threads, with a bounded memory usage.
+    An additional buffer is allocated for the control packets received while all the buffers of the pool are retained.
+
+    Default: 1 */
+#ifndef MQTTRecvBufferPool
+  #define MQTTRecvBufferPool 1
+#endif
+
+/** Zero copy publishing
+    If set to 1, a publish method taking a reference on an application owned payload buffer (with a release callback) is
+    added. The payload is never copied: it's sent along the serialized header in a single vectored call and, if
+    MQTTQoSSupportLevel is 1, the packet storage only saves the packet header and keeps the payload reference until the
+    packet is acknowledged. The memory used by the storage and the copy cost doesn't depend on the payload size anymore.
+
+    Default: 0 */
+#ifndef MQTTZeroCopyPublish
+  #define MQTTZeroCopyPublish 0
+#endif
+
+/** Automatic reconnection
+    If set to 1, a reconnection policy can be given to the client. The client then stores the connection parameters
+    and reconnects from the event loop upon connection loss, with an exponential and randomized delay between attempts.
+    The session is resumed on the broker if possible (so the QoS packets are retransmitted), or you're asked to
+    subscribe again if not. This adds some binary size and stores a copy of the connection parameters.
+
+    Default: 0 */
+#ifndef MQTTUseReconnect
+  #define MQTTUseReconnect 0
+#endif
+
+/** Asynchronous subscriptions
+    If set to a positive value, subscribeAsync (and unsubscribeAsync if MQTTUseUnsubscribe is set) are added. They pack
+    many topics in as few packets as possible and don't wait for the broker's answer, the result being reported through a
+    callback. The value is the maximum number of such packets in flight (each slot uses 16 bytes).
+    This is useful when subscribing to a lot of topics, since it takes a single round trip instead of one per topic.
+
+    Default: 0 */
+#ifndef MQTTAsyncSubscribe
+  #define MQTTAsyncSubscribe 0
+#endif
+
+/** Outbound rate limiting
+    If set to a positive value, rate limits (in messages and bytes per second, for all topics or per topic prefix) can be
+    added to the client, and the publications that can't be sent immediately are queued in an outbound queue of this size
+    (in bytes), to be sent later on by the event loop. Watermark callbacks report when the queue fills up or drains, so
+    producers can slow down. The broker's Receive Maximum and Maximum Packet Size are also honored when publishing.
+
+    Default: 0 */
+#ifndef MQTTOutboundQueue
+  #define MQTTOutboundQueue 0
+#endif
+
+/** Priority scheduler
+    If set to a positive value, publications can be given a priority class (high, normal or bulk) and the packets are
+    sent in priority order: the client's control packets (PINGREQ, acknowledgements, ...) first, then the high, normal
+    and bulk publications. A packet is never interrupted once started, so a bulk payload larger than this value (in bytes)
+    can be split (if asked for when publishing) in many publications of at most this size, and the other packets are sent
+    in between the slices.
+    This is useful to avoid delaying the keep alive and the urgent messages by large uploads on slow links.
+
+    Default: 0 */
+#ifndef MQTTPriorityScheduler
+  #define MQTTPriorityScheduler 0
+#endif
+
+/** Message expiry enforcement
+    If set to 1, the client remembers when a QoS publication with a Message Expiry Interval property was saved (for
+    retransmission) or queued in the outbound queue. The expired publications are dropped instead of being retransmitted
+    upon reconnection (or sent from the outbound queue), and the interval is decremented by the time spent waiting on the
+    client when they are sent, like a broker does. The number of dropped publications is counted.
+    This only has an effect if MQTTQoSSupportLevel is 1 or MQTTOutboundQueue is set. The interval has a second resolution.
+
+    Default: 0 */
+#ifndef MQTTMessageExpiry
+  #define MQTTMessageExpiry 0
+#endif
+
+/** Sharded client
+    If set to 1, the ShardedClient class is built (in MQTTSharded.hpp). It opens many connections to the same broker, each
+    with its own event loop thread, spreads the publications on them (while keeping the order for each topic) and consumes
+    with shared subscriptions, so the throughput scales with the number of connections.
+    This requires MQTTUseReconnect (used to reconnect each connection), MQTTMultithread (publishing is allowed from any
+    thread) and a platform with threads.
+
+    Default: 0 */
+#ifndef MQTTShardedClient
+  #define MQTTShardedClient 0
+#endif
+
+/** Socket tuning profiles
+    If set to 1, a tuning profile can be selected for the socket with setTuningProfile. Beyond the default profile (only TCP_NODELAY),
+    the LowLatency profile lets the kernel busy poll the device when reading (SO_BUSY_POLL), re-arms TCP_QUICKACK after each read so
+    the acknowledgements aren't delayed and limits the unsent data in the socket (TCP_NOTSENT_LOWAT). The BusyPoll profile also spins
+    on non blocking reads instead of sleeping in the kernel (this burns a CPU core) and the event loop thread can be pinned to a core.
+    This requires MQTTOnlyBSDSocket. The options are Linux specific (they are skipped if not available) and the spinning reads are only
+    used for plain (not TLS, not io_uring) connections.
+    The profiles don't always reduce the latency: when the broker or other threads share the event loop's core, BusyPoll makes the
+    tail latency much worse. Measure them on the target (tests/MQTTBench takes the profile and the core to pin) before using them.
+
+    Default: 0 */
+#ifndef MQTTSocketTuning
+  #define MQTTSocketTuning 0
+#endif
+
+/** Publication completion
+    If set to 1, the MessageReceived::publishCompleted callback is called when a QoS publication's cycle ends, either upon receiving
+    its final acknowledgement or when it's given up. It tells the broker's reason code and the time elapsed since the publication was
+    sent (from a monotonic clock), so the application can implement its own flow control or measure the broker's latency.
+    The sending time is stored along the packet identifier in the client's in flight table (no additional allocation).
+
+    Default: 0 */
+#ifndef MQTTPublishCompletion
+  #define MQTTPublishCompletion 0
+#endif
+
+/** Runtime statistics
+    If set to 1, the client counts the packets sent and received (per control packet type), the bytes, the calls to the
+    transport, the partial reads, the timeouts, the errors and the reconnections, and getStatistics returns a snapshot of these
+    counters along with the in flight table's and queues' occupancy.
+    The counters are relaxed atomics (no lock, no ordering), so it's cheap enough to be enabled in production, unlike
+    MQTTDumpCommunication. If set to 0, it's completely compiled out.
+
+    Default: 0 */
+#ifndef MQTTStatistics
+  #define MQTTStatistics 0
+#endif
+
+/** End to end latency probe
+    If set to 1, startLatencyProbe makes the client publish timestamped probes on a dedicated topic it's subscribed to and
+    measure their round trip time through the broker in a histogram, along with the lost, reordered and duplicated probes.
+    This can run continuously in production, the probes are small and consumed by the client.
+
+    Default: 0 */
+#ifndef MQTTLatencyProbe
+  #define MQTTLatencyProbe 0
+#endif
+
+/** Packet capture
+    If set to a positive value, a ring of this size (in bytes) is allocated with the client and startCapture makes it record
+    the raw packets sent and received (optionally truncated), with their direction and a timestamp. Recording a packet is a
+    single atomic increment and a copy, it doesn't lock and doesn't format anything, so it can run under load, unlike
+    MQTTDumpCommunication. When the ring is full, the oldest packets are overwritten.
+    saveCapture writes the ring to a pcap file where each packet is wrapped in synthesized IPv4 and TCP headers (the broker
+    being on port 1883), so it can be opened with Wireshark's MQTT dissector after an incident.
+
+    Default: 0 */
+#ifndef MQTTPacketCapture
+  #define MQTTPacketCapture 0
+#endif
+
+/** TLS session resumption
+    If set to a positive value, the TLS sessions (session identifier or ticket) negotiated with the brokers are kept in a process
+    wide cache of this many entries, so the next connection to the same broker (by the same client upon reconnection, or by any
+    other client of the process) resumes the session with an abbreviated handshake instead of a full one. The sessions are
+    looked up by host, port and certificates (a session is never resumed with a different client certificate).
+    This requires MQTTUseTLS and MQTTOnlyBSDSocket and mbedtls to be built with session resumption (it is by default).
+
+    Default: 0 */
+#ifndef MQTTTLSSessionCache
+  #define MQTTTLSSessionCache 0
+#endif
+
+/** TLS write coalescing
+    If set to a positive value, the TLS socket uses a write buffer of this size (in bytes, up to the TLS record size of
+    16384 bytes) so a packet made of multiple parts is sent in a single TLS record, and the packets sent in a batch (queued
+    or retransmitted packets sent by the client, or the ones sent between beginBatch and endBatch) are packed in as few
+    records as possible. This saves the per record overhead (header, MAC or AEAD tag) and the encryption calls.
+    The pending data is always sent before waiting for an answer or at the end of the batch.
+    This requires MQTTUseTLS and MQTTOnlyBSDSocket.
+
+    Default: 0 */
+#ifndef MQTTTLSCoalesceWrites
+  #define MQTTTLSCoalesceWrites 0
+#endif
+
+/** Kernel TLS offload
+    If set to 1, once the TLS handshake is done by mbedtls, the negotiated keys are given to the Linux kernel (kTLS) which then
+    encrypts and decrypts the records. The connection then uses the plain socket paths (vectored sends are done with a
+    single writev call without copying the parts) and the encryption happens in the kernel.
+    Only TLS 1.2 with AES-GCM or ChaCha20-Poly1305 can be offloaded. If the negotiated cipher can't be offloaded or the kernel
+    doesn't support it (the tls module must be loaded), mbedtls is used as usual.
+    This requires MQTTUseTLS and MQTTOnlyBSDSocket on Linux, and mbedtls to be built with key export (it is by default).
+
+    Default: 0 */
+#ifndef MQTTUseKTLS
+  #define MQTTUseKTLS 0
+#endif
+
+/** Forwarding received messages
+    If set to 1, the forward method republishes a message received by a client (on this client or any other one, like in a
+    bridge between two brokers) without rebuilding it: only the fixed header, the topic and the packet identifier are
+    serialized, the received properties and payload are sent from the receive buffer in a single vectored call.
+    The Subscription Identifier and Topic Alias properties (which only make sense on the receiving connection) are removed
+    and the given properties replace the received properties of the same type.
+
+    Default: 0 */
+#ifndef MQTTForwardPublish
+  #define MQTTForwardPublish 0
+#endif
+
+/** Coroutine layer
+    If set to 1, the CoClient class (in MQTTCoroutine.hpp) wraps the client with C++20 coroutines: publishing and subscribing
+    are awaited until the broker acknowledges them and the received messages are awaited too, so many logical flows can run
+    in a single thread without a stack per flow.
+    The library itself is still built as C++11, only the code including MQTTCoroutine.hpp must be built as C++20.
+    This requires MQTTAsyncSubscribe and MQTTPublishCompletion.
+
+    Default: 0 */
+#ifndef MQTTCoroutines
+  #define MQTTCoroutines 0
+#endif
+
 // The part below is for building only, it's made to generate a message so the configuration is visible at build time
 #if _DEBUG == 1
   #if MQTTUseAuth == 1
@@ -150,7 +408,131 @@
     #define CONF_LL "_"
   #endif
 
-  #if MQTTOnlyBSDSocket == 1
+  #if MQTTCoalesceACK > 0
+    #define CONF_ACK "ACK_"
+  #else
+    #define CONF_ACK "_"
+  #endif
+
+  #if MQTTManualACK == 1
+    #define CONF_MACK "MACK_"
+  #else
+    #define CONF_MACK "_"
+  #endif
+
+  #if MQTTRecvBufferPool > 1
+    #define CONF_POOL "Pool_"
+  #else
+    #define CONF_POOL "_"
+  #endif
+
+  #if MQTTZeroCopyPublish == 1
+    #define CONF_ZC "ZC_"
+  #else
+    #define CONF_ZC "_"
+  #endif
+
+  #if MQTTUseReconnect == 1
+    #define CONF_RECO "Reco_"
+  #else
+    #define CONF_RECO "_"
+  #endif
+
+  #if MQTTAsyncSubscribe > 0
+    #define CONF_ASUB "ASub_"
+  #else
+    #define CONF_ASUB "_"
+  #endif
+
+  #if MQTTOutboundQueue > 0
+    #define CONF_OUTQ "OutQ_"
+  #else
+    #define CONF_OUTQ "_"
+  #endif
+
+  #if MQTTPriorityScheduler > 0
+    #define CONF_PRIO "Prio_"
+  #else
+    #define CONF_PRIO "_"
+  #endif
+
+  #if MQTTMessageExpiry == 1
+    #define CONF_EXP "Exp_"
+  #else
+    #define CONF_EXP "_"
+  #endif
+
+  #if MQTTShardedClient == 1
+    #define CONF_SHARD "Shard_"
+  #else
+    #define CONF_SHARD "_"
+  #endif
+
+  #if MQTTPublishCompletion == 1
+    #define CONF_PCOMP "PComp_"
+  #else
+    #define CONF_PCOMP "_"
+  #endif
+
+  #if MQTTStatistics == 1
+    #define CONF_STAT "Stats_"
+  #else
+    #define CONF_STAT "_"
+  #endif
+
+  #if MQTTLatencyProbe == 1
+    #define CONF_PROBE "Probe_"
+  #else
+    #define CONF_PROBE "_"
+  #endif
+
+  #if MQTTPacketCapture > 0
+    #define CONF_PCAP "PCap_"
+  #else
+    #define CONF_PCAP "_"
+  #endif
+
+  #if MQTTTLSSessionCache > 0
+    #define CONF_TLSRES "TLSRes_"
+  #else
+    #define CONF_TLSRES "_"
+  #endif
+
+  #if MQTTTLSCoalesceWrites > 0
+    #define CONF_TLSCOAL "TLSCoal_"
+  #else
+    #define CONF_TLSCOAL "_"
+  #endif
+
+  #if MQTTUseKTLS == 1
+    #define CONF_KTLS "KTLS_"
+  #else
+    #define CONF_KTLS "_"
+  #endif
+
+  #if MQTTForwardPublish == 1
+    #define CONF_FWD "Fwd_"
+  #else
+    #define CONF_FWD "_"
+  #endif
+
+  #if MQTTCoroutines == 1
+    #define CONF_CORO "Coro_"
+  #else
+    #define CONF_CORO "_"
+  #endif
+
+  #if MQTTSocketTuning == 1
+    #define CONF_TUNE "Tune_"
+  #else
+    #define CONF_TUNE "_"
+  #endif
+
+  #if MQTTOnlyBSDSocket == 1 && MQTTUseIOUring == 2
+    #define CONF_SOCKET "URingPoll"
+  #elif MQTTOnlyBSDSocket == 1 && MQTTUseIOUring == 1
+    #define CONF_SOCKET "URing"
+  #elif MQTTOnlyBSDSocket == 1
     #define CONF_SOCKET "BSD"
   #else
     #define CONF_SOCKET "CP"
@@ -158,7 +540,7 @@
 
 
 
-  #pragma message("Building eMQTT5 with flags: " CONF_AUTH CONF_UNSUB CONF_DUMP CONF_VALID CONF_QOS CONF_TLS CONF_LL CONF_SOCKET)
+  #pragma message("Building eMQTT5 with flags: " CONF_AUTH CONF_UNSUB CONF_DUMP CONF_VALID CONF_QOS CONF_TLS CONF_LL CONF_ACK CONF_MACK CONF_POOL CONF_ZC CONF_RECO CONF_ASUB CONF_OUTQ CONF_PRIO CONF_EXP CONF_SHARD CONF_TUNE CONF_PCOMP CONF_STAT CONF_PROBE CONF_PCAP CONF_TLSRES CONF_TLSCOAL CONF_KTLS CONF_FWD CONF_CORO CONF_SOCKET)
 #endif
 
 #endif
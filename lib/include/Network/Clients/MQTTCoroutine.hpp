@@ -0,0 +1,509 @@
+#ifndef hpp_CPP_MQTTCoroutine_CPP_hpp
+#define hpp_CPP_MQTTCoroutine_CPP_hpp
+
+// We need the MQTT client
+#include <Network/Clients/MQTT.hpp>
+
+#if MQTTCoroutines == 1
+  #if MQTTAsyncSubscribe == 0
+    #error The coroutine layer requires MQTTAsyncSubscribe to be set
+  #endif
+  #if MQTTPublishCompletion != 1
+    #error The coroutine layer requires MQTTPublishCompletion to be set
+  #endif
+  #if !defined(__cpp_impl_coroutine)
+    #error The coroutine layer requires a C++20 compiler (only for the code including this file, the library itself is C++11)
+  #endif
+
+// We need coroutines
+#include <coroutine>
+// We need std::terminate
+#include <exception>
+
+namespace Network
+{
+    namespace Client
+    {
+        /** A client whose operations are awaited from C++20 coroutines.
+
+            This wraps a MQTTv5 client and is its MessageReceived callback. Publishing with QoS resumes the awaiting coroutine
+            when the broker acknowledges the publication (PUBACK or PUBCOMP), subscribing resumes it when all the topics are
+            acknowledged, and the received messages are awaited with nextMessage.
+
+            Everything happens in a single thread: call poll() in a loop, it runs the client's event loop once and then resumes
+            the coroutines whose operation completed. The coroutines are never resumed from inside the client's callbacks, so
+            they can use the client freely. Since poll() blocks in the event loop while waiting for data, either build with
+            MQTTLowLatency or set a short default timeout (@sa setDefaultTimeout) if you also need to do something else in the loop.
+
+            Connecting is still done synchronously (it's bounded by the default timeout), connectTo is only awaitable for consistency.
+
+            When the connection is lost, the pending publications and subscriptions are resumed with a NotConnected error while
+            the coroutines waiting for a message keep waiting (for a reconnection).
+
+            The received messages are copied in a fixed number of slots (allocated once). If no slot is free when a message is
+            received, the message is dropped and counted. A message keeps its slot until it's destructed.
+
+            QoS publications use packet identifiers in the upper half of the range, and the client allocates its own identifiers in
+            the lower half, so publishing with QoS on the wrapped client is safe. Only explicit packet identifiers given to the
+            wrapped client must stay below 0x8000.
+
+            A typical flow looks like this:
+            @code
+                CoClient::Task flow(CoClient & client)
+                {
+                    auto sub = co_await client.subscribe("replies/me");
+                    if (!sub.ok()) co_return;
+                    auto pub = co_await client.publish("requests", payload, length, false, CoClient::QoSDelivery::AtLeastOne);
+                    if (!pub.ok()) co_return;
+                    CoClient::Message reply = co_await client.nextMessage();
+                    // Use reply.topic, reply.payload here
+                }
+            @endcode */
+        struct CoClient : public MessageReceived
+        {
+            // Type definition and enumeration
+        public:
+            typedef MQTTv5::ErrorType           ErrorType;
+            typedef MQTTv5::QoSDelivery         QoSDelivery;
+            typedef MQTTv5::RetainHandling      RetainHandling;
+            typedef MQTTv5::ReasonCodes         ReasonCodes;
+            typedef MQTTv5::Properties          Properties;
+            typedef MQTTv5::SubscribeTopicArray SubscribeTopicArray;
+
+            /** A detached coroutine, started immediately and destroyed when it returns.
+                Use this as the return type of your flows */
+            struct Task
+            {
+                struct promise_type
+                {
+                    Task get_return_object() { return Task(); }
+                    std::suspend_never initial_suspend() noexcept { return {}; }
+                    std::suspend_never final_suspend() noexcept { return {}; }
+                    void return_void() {}
+                    void unhandled_exception() { std::terminate(); }
+                };
+            };
+
+            /** The result of an awaited operation */
+            struct Result
+            {
+                /** Success if the request was sent (and acknowledged if it's waiting for an acknowledgement),
+                    NotConnected if the connection was lost before the acknowledgement */
+                ErrorType   error;
+                /** The broker's reason code. For a subscription, the first failure or the last granted QoS */
+                ReasonCodes reason;
+                /** For a QoS publication, the time between sending it and receiving its acknowledgement in microseconds */
+                uint32      latencyUs;
+
+                /** Check if the operation succeeded */
+                bool ok() const { return error == ErrorType::Success && (uint8)reason < 0x80; }
+
+                Result(const ErrorType error = ErrorType::Success, const ReasonCodes reason = ReasonCodes::Success) : error(error), reason(reason), latencyUs(0) {}
+            };
+
+            /** A received message. It keeps its slot until it's destructed */
+            struct Message
+            {
+                /** The topic */
+                DynamicStringView   topic;
+                /** The payload */
+                DynamicBinDataView  payload;
+                /** The packet identifier (only useful with MQTTManualACK) */
+                uint16              packetIdentifier;
+                /** The message's properties */
+                PropertiesView      properties;
+
+                /** Check if the message is valid */
+                bool isValid() const { return owner != nullptr; }
+
+                Message(Message && other) : topic(other.topic), payload(other.payload), packetIdentifier(other.packetIdentifier),
+                                            properties(other.properties), owner(other.owner), slot(other.slot) { other.owner = nullptr; }
+                ~Message() { if (owner) owner->releaseSlot(slot); }
+
+            private:
+                friend struct CoClient;
+                CoClient *  owner;
+                uint32      slot;
+
+                Message() : packetIdentifier(0), owner(nullptr), slot(0) {}
+                Message(const Message &);
+                Message & operator = (const Message &);
+            };
+
+            /** A suspended operation waiting for the broker */
+            struct Waiter
+            {
+                /** The coroutine to resume */
+                std::coroutine_handle<>     handle;
+                /** The packet identifier or the request identifier */
+                uint32                      id;
+                /** The number of topics that are still to be acknowledged (for a subscription) */
+                uint32                      remaining;
+                /** Whether this is a subscription */
+                bool                        subscription;
+                /** The result */
+                Result                      result;
+                /** The next waiter in the list */
+                Waiter *                    next;
+
+                Waiter() : id(0), remaining(0), subscription(false), next(nullptr) {}
+            };
+
+            /** An operation whose result is known immediately */
+            struct ReadyAwaiter
+            {
+                Result result;
+                bool await_ready() const noexcept { return true; }
+                void await_suspend(std::coroutine_handle<>) const noexcept {}
+                Result await_resume() const noexcept { return result; }
+            };
+
+            /** A publication that's waiting for its acknowledgement */
+            struct PublishAwaiter : public Waiter
+            {
+                CoClient &          owner;
+                const char *        topic;
+                const uint8 *       payload;
+                uint32              length;
+                bool                retain;
+                QoSDelivery         QoS;
+                Properties *        properties;
+
+                bool await_ready()
+                {
+                    if (QoS == QoSDelivery::AtMostOne)
+                    {
+                        result.error = owner.client.publish(topic, payload, length, retain, QoS, 0, properties);
+                        return true;
+                    }
+                    id = owner.allocateID();
+                    result.error = owner.client.publish(topic, payload, length, retain, QoS, (uint16)id, properties);
+                    if (result.error != ErrorType::Success) return true;
+                    owner.wait(*this);
+                    return false;
+                }
+                void await_suspend(std::coroutine_handle<> h) noexcept { handle = h; }
+                Result await_resume() const noexcept { return result; }
+
+                PublishAwaiter(CoClient & owner, const char * topic, const uint8 * payload, const uint32 length, const bool retain, const QoSDelivery QoS, Properties * properties)
+                    : owner(owner), topic(topic), payload(payload), length(length), retain(retain), QoS(QoS), properties(properties) {}
+            };
+
+            /** A subscription that's waiting for its acknowledgements */
+            struct SubscribeAwaiter : public Waiter
+            {
+                CoClient &                  owner;
+                const SubscribeTopicArray & topics;
+                Properties *                properties;
+
+                bool await_ready()
+                {
+                    if (!topics.count()) { result.error = ErrorType::BadParameter; return true; }
+                    subscription = true;
+                    id = ++owner.requestID;
+                    remaining = topics.count();
+                    // The acknowledgements might be received while sending, so wait before
+                    owner.wait(*this);
+                    result.error = owner.client.subscribeAsync(topics, id, properties);
+                    if (result.error == ErrorType::Success) return false;
+                    owner.unwait(*this);
+                    return true;
+                }
+                void await_suspend(std::coroutine_handle<> h) noexcept { handle = h; }
+                Result await_resume() const noexcept { return result; }
+
+                SubscribeAwaiter(CoClient & owner, const SubscribeTopicArray & topics, Properties * properties)
+                    : owner(owner), topics(topics), properties(properties) {}
+            };
+
+            /** A subscription to a single topic, the topic list is owned */
+            struct SingleSubscribeAwaiter : public SubscribeAwaiter
+            {
+                SubscribeTopicArray list;
+
+                SingleSubscribeAwaiter(CoClient & owner, const char * topic, const uint8 option, Properties * properties)
+                    : SubscribeAwaiter(owner, list, properties), list(0) { list.append(topic, 0, option); }
+            };
+
+            /** Waiting for the next received message */
+            struct MessageAwaiter : public Waiter
+            {
+                CoClient &  owner;
+                Message     message;
+
+                bool await_ready()
+                {
+                    if (owner.popMessage(message)) return true;
+                    owner.waitMessage(*this);
+                    return false;
+                }
+                void await_suspend(std::coroutine_handle<> h) noexcept { handle = h; }
+                Message await_resume() noexcept { return static_cast<Message &&>(message); }
+
+                MessageAwaiter(CoClient & owner) : owner(owner) {}
+            };
+
+            // Members
+        private:
+            /** Each slot starts with the topic length (16 bits), the packet identifier (16 bits), the payload length (32 bits) and
+                the properties size (32 bits), followed by the properties, the topic and the payload */
+            enum { SlotHeaderSize = 12 };
+            /** The maximum packet size and the number of publications in flight (given to the client upon construction) */
+            uint32          packetSize, inFlight;
+            /** The wrapped client */
+            MQTTv5          client;
+            /** The operations waiting for the broker */
+            Waiter *        waiters;
+            /** The operations that are complete and the coroutines to resume, in order */
+            Waiter *        readyHead, * readyTail;
+            /** The coroutines waiting for a message, in order */
+            Waiter *        messageHead, * messageTail;
+            /** The last packet identifier used */
+            uint16          lastID;
+            /** The last request identifier used */
+            uint32          requestID;
+            /** The message slots */
+            uint8 *         slots;
+            /** The number of slots and their size */
+            uint32          slotCount, slotSize;
+            /** The free slots (as a stack) and the received messages' slots (as a ring) */
+            uint32 *        freeSlots, * queuedSlots;
+            uint32          freeCount, queuedHead, queuedCount;
+            /** The number of messages dropped because no slot was free */
+            uint32          dropped;
+
+            // Helpers
+        private:
+            /** Allocate a packet identifier in the upper half of the range, that's not used by a pending publication */
+            uint16 allocateID()
+            {
+                do { lastID = lastID == 0xFFFF ? 0x8000 : lastID + 1; } while (find(lastID, false));
+                return lastID;
+            }
+            /** Find a waiting operation */
+            Waiter * find(const uint32 id, const bool subscription) const
+            {
+                for (Waiter * w = waiters; w; w = w->next)
+                    if (w->id == id && w->subscription == subscription) return w;
+                return nullptr;
+            }
+            /** Add an operation to the waiting list */
+            void wait(Waiter & w) { w.next = waiters; waiters = &w; }
+            /** Remove an operation from the waiting list */
+            void unwait(Waiter & w)
+            {
+                for (Waiter ** p = &waiters; *p; p = &(*p)->next)
+                    if (*p == &w) { *p = w.next; w.next = nullptr; return; }
+            }
+            /** Move an operation from the waiting list to the ready list */
+            void complete(Waiter & w)
+            {
+                unwait(w);
+                if (readyTail) readyTail->next = &w; else readyHead = &w;
+                readyTail = &w;
+            }
+            /** Add a coroutine to the list of coroutines waiting for a message */
+            void waitMessage(Waiter & w)
+            {
+                w.next = nullptr;
+                if (messageTail) messageTail->next = &w; else messageHead = &w;
+                messageTail = &w;
+            }
+
+            uint8 * slotData(const uint32 slot) const { return slots + (size_t)slot * slotSize; }
+            /** Give a slot back */
+            void releaseSlot(const uint32 slot) { freeSlots[freeCount++] = slot; }
+            /** Fill a message from a slot */
+            void fillMessage(Message & message, const uint32 slot)
+            {
+                const uint8 * p = slotData(slot);
+                uint16 topicLength; uint32 payloadLength, propertiesSize;
+                memcpy(&topicLength, p, 2); memcpy(&message.packetIdentifier, p + 2, 2);
+                memcpy(&payloadLength, p + 4, 4); memcpy(&propertiesSize, p + 8, 4);
+                p += SlotHeaderSize;
+                if (propertiesSize) message.properties.readFrom(p, propertiesSize);
+                message.topic = DynamicStringView((const char*)p + propertiesSize, topicLength);
+                message.payload = DynamicBinDataView(payloadLength, p + propertiesSize + topicLength);
+                message.owner = this;
+                message.slot = slot;
+            }
+            /** Get the oldest received message if any */
+            bool popMessage(Message & message)
+            {
+                if (!queuedCount) return false;
+                fillMessage(message, queuedSlots[queuedHead]);
+                queuedHead = (queuedHead + 1) % slotCount;
+                queuedCount--;
+                return true;
+            }
+            /** Fail all the operations waiting for the broker */
+            void failAll(const ErrorType error)
+            {
+                while (waiters)
+                {
+                    waiters->result.error = error;
+                    complete(*waiters);
+                }
+            }
+
+            // MessageReceived interface
+        public:
+            void messageReceived(const DynamicStringView & topic, const DynamicBinDataView & payload, const uint16 packetIdentifier, const PropertiesView & properties)
+            {
+                const uint32 propertiesSize = properties.buffer ? properties.getSize() : 0;
+                if (!freeCount || SlotHeaderSize + propertiesSize + topic.length + payload.length > slotSize) { dropped++; return; }
+                const uint32 slot = freeSlots[--freeCount];
+                uint8 * p = slotData(slot);
+                const uint16 topicLength = topic.length;
+                memcpy(p, &topicLength, 2); memcpy(p + 2, &packetIdentifier, 2);
+                memcpy(p + 4, &payload.length, 4); memcpy(p + 8, &propertiesSize, 4);
+                p += SlotHeaderSize;
+                if (propertiesSize) properties.copyInto(p);
+                memcpy(p + propertiesSize, topic.data, topic.length);
+                memcpy(p + propertiesSize + topic.length, payload.data, payload.length);
+
+                // Give it to the first waiting coroutine or queue it
+                if (messageHead)
+                {
+                    MessageAwaiter & w = static_cast<MessageAwaiter &>(*messageHead);
+                    messageHead = w.next;
+                    if (!messageHead) messageTail = nullptr;
+                    w.next = nullptr;
+                    fillMessage(w.message, slot);
+                    if (readyTail) readyTail->next = &w; else readyHead = &w;
+                    readyTail = &w;
+                    return;
+                }
+                queuedSlots[(queuedHead + queuedCount++) % slotCount] = slot;
+            }
+            void publishCompleted(const uint16 packetID, const ReasonCodes reasonCode, const uint32 latencyUs)
+            {
+                Waiter * w = find(packetID, false);
+                if (!w) return;
+                w->result.reason = reasonCode;
+                w->result.latencyUs = latencyUs;
+                complete(*w);
+            }
+            void scribeCompleted(const uint32 requestID, const bool unsubscribe, const uint32 firstTopic, const uint8 * reasonCodes, const uint32 count)
+            {
+                Waiter * w = unsubscribe ? nullptr : find(requestID, true);
+                if (!w) return;
+                if (!reasonCodes) { w->result.error = ErrorType::NotConnected; complete(*w); return; }
+                for (uint32 i = 0; i < count; i++)
+                    if ((uint8)w->result.reason < 0x80) w->result.reason = (ReasonCodes)reasonCodes[i];
+                w->remaining -= count < w->remaining ? count : w->remaining;
+                if (!w->remaining) complete(*w);
+            }
+            void connectionLost(const ReasonCodes reasonCode, const PropertiesView * properties) { failAll(ErrorType::NotConnected); }
+            uint32 maxPacketSize() const { return packetSize; }
+            uint32 maxUnACKedPackets() const { return inFlight; }
+
+            // Interface
+        public:
+            /** Connect to the server. This is done synchronously. @sa MQTTv5::connectTo */
+            ReadyAwaiter connectTo(const char * serverHost, const uint16 port, bool useTLS = false, const uint16 keepAliveTimeInSec = 300,
+                                   const bool cleanStart = true, const char * userName = nullptr, const DynamicBinDataView * password = nullptr)
+            {
+                return ReadyAwaiter{ Result(client.connectTo(serverHost, port, useTLS, keepAliveTimeInSec, cleanStart, userName, password)) };
+            }
+
+            /** Publish to a topic.
+                With QoS 0, the result is ready when the packet is sent. Else, the coroutine is resumed when the broker acknowledges
+                the publication (the Result's reason is the broker's reason code).
+                The payload and properties must stay valid until the awaited expression returns. @sa MQTTv5::publish */
+            PublishAwaiter publish(const char * topic, const uint8 * payload, const uint32 payloadLength, const bool retain = false,
+                                   const QoSDelivery QoS = QoSDelivery::AtMostOne, Properties * properties = nullptr)
+            {
+                return PublishAwaiter(*this, topic, payload, payloadLength, retain, QoS, properties);
+            }
+
+            /** Subscribe to some topics. The coroutine is resumed when all topics are acknowledged.
+                The list must stay valid until the awaited expression returns. @sa MQTTv5::subscribeAsync */
+            SubscribeAwaiter subscribe(const SubscribeTopicArray & topics, Properties * properties = nullptr)
+            {
+                return SubscribeAwaiter(*this, topics, properties);
+            }
+            /** Subscribe to a single topic. The coroutine is resumed when the topic is acknowledged. @sa MQTTv5::subscribe */
+            SingleSubscribeAwaiter subscribe(const char * topic, const RetainHandling retainHandling = RetainHandling::GetRetainedMessageForNewSubscriptionOnly,
+                                             const bool withAutoFeedBack = false, const QoSDelivery maxAcceptedQoS = QoSDelivery::ExactlyOne,
+                                             const bool retainAsPublished = true, Properties * properties = nullptr)
+            {
+                return SingleSubscribeAwaiter(*this, topic, SubscribeTopicArray::makeOption((uint8)retainHandling, retainAsPublished, !withAutoFeedBack, (uint8)maxAcceptedQoS), properties);
+            }
+
+            /** Wait for the next received message. The messages are given to the waiting coroutines in order */
+            MessageAwaiter nextMessage() { return MessageAwaiter(*this); }
+
+            /** Run the client's event loop once and resume the coroutines whose operation completed
+                @return The event loop's result */
+            ErrorType poll()
+            {
+                ErrorType ret = client.eventLoop();
+                resumeReady();
+                return ret;
+            }
+            /** Resume the coroutines whose operation completed (this is done by poll) */
+            void resumeReady()
+            {
+                while (readyHead)
+                {
+                    Waiter * w = readyHead;
+                    readyHead = w->next;
+                    if (!readyHead) readyTail = nullptr;
+                    w->next = nullptr;
+                    // This might add new ready operations to the list
+                    w->handle.resume();
+                }
+            }
+
+            /** Disconnect from the server. The pending operations are failed. @sa MQTTv5::disconnect */
+            ErrorType disconnect(const ReasonCodes code = ReasonCodes::NormalDisconnection)
+            {
+                ErrorType ret = client.disconnect(code);
+                failAll(ErrorType::NotConnected);
+                resumeReady();
+                return ret;
+            }
+
+            /** Set the default network timeout used in millisecond. @sa MQTTv5::setDefaultTimeout */
+            void setDefaultTimeout(const uint32 timeoutMs) { client.setDefaultTimeout(timeoutMs); }
+            /** Get the number of messages dropped because all the slots were used */
+            uint32 getDroppedMessagesCount() const { return dropped; }
+            /** Get the wrapped client (for specific operations, from the polling thread) */
+            MQTTv5 & getClient() { return client; }
+
+            // Construction and destruction
+        public:
+            /** Default constructor
+                @param clientID         @sa MQTTv5::MQTTv5
+                @param maxPacketSize    The maximum packet size to receive, @sa MessageReceived::maxPacketSize
+                @param maxInFlight      The maximum number of QoS publications that can be pending, @sa MessageReceived::maxUnACKedPackets
+                @param messageSlots     The number of received messages that can be stored until they are awaited (each slot is maxPacketSize large)
+                @param storage          @sa MQTTv5::MQTTv5
+                @param brokerCert       @sa MQTTv5::MQTTv5
+                @param clientCert       @sa MQTTv5::MQTTv5
+                @param clientKey        @sa MQTTv5::MQTTv5 */
+            CoClient(const char * clientID, const uint32 maxPacketSize = 2048, const uint32 maxInFlight = 16, const uint32 messageSlots = 8, PacketStorage * storage = 0,
+                     const DynamicBinDataView * brokerCert = 0, const DynamicBinDataView * clientCert = 0, const DynamicBinDataView * clientKey = 0)
+                : packetSize(maxPacketSize), inFlight(maxInFlight),
+                  client(clientID, this, storage, brokerCert, clientCert, clientKey), waiters(nullptr), readyHead(nullptr), readyTail(nullptr),
+                  messageHead(nullptr), messageTail(nullptr), lastID(0xFFFF), requestID(0),
+                  slots((uint8*)Platform::malloc((size_t)(messageSlots ? messageSlots : 1) * (maxPacketSize + SlotHeaderSize))), slotCount(messageSlots ? messageSlots : 1),
+                  slotSize(maxPacketSize + SlotHeaderSize), freeSlots((uint32*)Platform::malloc(slotCount * 2 * sizeof(uint32))), queuedSlots(freeSlots + slotCount),
+                  freeCount(slotCount), queuedHead(0), queuedCount(0), dropped(0)
+            {
+                for (uint32 i = 0; i < slotCount; i++) freeSlots[i] = slotCount - 1 - i;
+            }
+            /** Destructor. The pending coroutines are never resumed, so destroy them before */
+            ~CoClient() { Platform::free(slots); Platform::free(freeSlots); slots = 0; freeSlots = 0; }
+
+        private:
+            /** Prevent copying */
+            CoClient(const CoClient &);
+            CoClient & operator = (const CoClient &);
+        };
+    }
+}
+#endif
+
+#endif
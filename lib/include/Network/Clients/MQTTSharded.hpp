@@ -0,0 +1,153 @@
+#ifndef hpp_CPP_MQTTSharded_CPP_hpp
+#define hpp_CPP_MQTTSharded_CPP_hpp
+
+// We need the MQTT client
+#include <Network/Clients/MQTT.hpp>
+
+#if MQTTShardedClient == 1
+  #if MQTTUseReconnect != 1
+    #error The sharded client requires MQTTUseReconnect to be set to 1
+  #endif
+  #if MQTTMultithread != 1
+    #error The sharded client requires MQTTMultithread to be set to 1 (publish is called from any thread)
+  #endif
+
+namespace Network
+{
+    namespace Client
+    {
+        /** A client made of many connections to the same broker.
+
+            A single MQTTv5 client is a single TCP stream, processed by a single thread, and a single session queue on the broker.
+            This class opens a given number of connections (called shards), each with its own socket, client identifier and event loop
+            thread, so that the throughput scales with the number of connections.
+
+            Publications are spread on the shards with a hash of the topic, so the messages for a given topic are always sent
+            on the same connection and their order is preserved.
+            Subscriptions are made as shared subscriptions (`$share/group/filter`) on every shard, so the broker distributes
+            the messages among them.
+
+            Each shard reconnects by itself upon connection loss with a copy of the given reconnection policy, the delays being
+            staggered between shards so they don't all hit the broker at the same time. If a shard's session is lost, the shared
+            subscriptions are made again.
+
+            The MessageReceived callback is shared by all the shards and is called from any of the event loop threads.
+
+            The expected usage pattern is to call `connectTo`, `subscribe`, then `start` and `publish` from any thread. Call `disconnect`
+            to stop the threads and close the connections. */
+        struct ShardedClient
+        {
+            // Type definition and enumeration
+        public:
+            typedef MQTTv5::ErrorType           ErrorType;
+            typedef MQTTv5::QoSDelivery         QoSDelivery;
+            typedef MQTTv5::RetainHandling      RetainHandling;
+            typedef MQTTv5::ReasonCodes         ReasonCodes;
+            typedef MQTTv5::Properties          Properties;
+            typedef MQTTv5::DynamicBinDataView  DynamicBinDataView;
+            typedef MQTTv5::ReconnectPolicy     ReconnectPolicy;
+
+            /** The statistics, aggregated for all shards */
+            struct Statistics
+            {
+                /** The number of shards */
+                uint32  shards;
+                /** The number of shards currently connected */
+                uint32  connected;
+                /** The number of successful publications */
+                uint64  published;
+                /** The number of failed publications */
+                uint64  publishErrors;
+                /** The number of successful reconnections */
+                uint32  reconnections;
+                /** The total number of failed reconnection attempts */
+                uint32  failedAttempts;
+                /** The number of reconnections where the broker had lost the session */
+                uint32  sessionsLost;
+                /** The longest time it took for a shard to recover from a connection loss, in milliseconds */
+                uint32  maxRecoveryTimeMs;
+            };
+
+            struct Impl;
+
+            // Members
+        private:
+            /** The PImpl idiom used here to avoid exposing the internal implementation */
+            Impl * impl;
+
+            // Interface
+        public:
+            /** Connect all shards to the given server.
+                The shards are connected one after the other, each with its client identifier (made of the prefix and the shard's index).
+                The will message isn't supported here since it would be published by each shard.
+                @sa MQTTv5::connectTo for the parameters
+                @return An ErrorType. Upon error, the shards that were already connected are left connected */
+            ErrorType connectTo(const char * serverHost, const uint16 port, bool useTLS = false, const uint16 keepAliveTimeInSec = 300,
+                const bool cleanStart = true, const char * userName = nullptr, const DynamicBinDataView * password = nullptr);
+
+            /** Subscribe to a topic with a shared subscription on every shard.
+                The subscription is remembered and made again if a shard reconnects to a broker that lost its session.
+                @param group                The shared subscription group name (it can't contain '/', '+' or '#')
+                @param topic                The topic filter to subscribe to
+                @param maxAcceptedQoS       The maximum accepted quality of service
+                @param retainHandling       The retain handling policy
+                @note This must be called before start.
+                @return An ErrorType */
+            ErrorType subscribe(const char * group, const char * topic, const QoSDelivery maxAcceptedQoS = QoSDelivery::ExactlyOne,
+                                const RetainHandling retainHandling = RetainHandling::GetRetainedMessageForNewSubscriptionOnly);
+
+            /** Start the event loop threads (one per shard)
+                @return An ErrorType */
+            ErrorType start();
+            /** Stop the event loop threads. The connections are kept open (but not pinged anymore) */
+            void stop();
+
+            /** Publish to a topic on the shard selected by the topic's hash.
+                @sa MQTTv5::publish for the parameters (the packet identifier is always selected automatically)
+                @note You can call this method anytime from anywhere, in any thread.
+                @return An ErrorType */
+            ErrorType publish(const char * topic, const uint8 * payload, const uint32 payloadLength, const bool retain = false,
+                              const QoSDelivery QoS = QoSDelivery::AtMostOne, Properties * properties = nullptr);
+
+            /** Stop the threads and disconnect all shards from the server
+                @param code                 The disconnection reason
+                @return The first error met or ErrorType::Success */
+            ErrorType disconnect(const ReasonCodes code);
+
+            /** Get the number of shards */
+            uint32 getShardCount() const;
+            /** Get the index of the shard used to publish on the given topic */
+            uint32 getShardFor(const char * topic) const;
+            /** Get a shard's client (for specific operations). You're responsible for calling it from the right thread, @sa MQTTv5 */
+            MQTTv5 & getShard(const uint32 index);
+
+            /** Get the statistics, aggregated for all shards.
+                This can be called from any thread, the values are updated by each shard's thread after each event loop */
+            void getStatistics(Statistics & stats) const;
+
+            // Construction and destruction
+        public:
+            /** Default constructor
+                @param clientIDPrefix   The client identifier prefix. Each shard uses this prefix followed by '-' and its index.
+                                        It can't be empty since the identifiers must be stable for resuming the sessions
+                @param shards           The number of connections to open (at least 1)
+                @param callback         A pointer to a MessageReceived callback object, shared by all shards and called from any thread
+                @param policy           The reconnection policy to copy for each shard
+                @param brokerCert       @sa MQTTv5::MQTTv5
+                @param clientCert       @sa MQTTv5::MQTTv5
+                @param clientKey        @sa MQTTv5::MQTTv5 */
+            ShardedClient(const char * clientIDPrefix, const uint32 shards, MessageReceived * callback, const ReconnectPolicy & policy = ReconnectPolicy(),
+                          const DynamicBinDataView * brokerCert = 0, const DynamicBinDataView * clientCert = 0, const DynamicBinDataView * clientKey = 0);
+            /** Default destructor. This stops the threads but doesn't disconnect cleanly, call disconnect before */
+            ~ShardedClient();
+
+        private:
+            /** Prevent copying */
+            ShardedClient(const ShardedClient &);
+            ShardedClient & operator = (const ShardedClient &);
+        };
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef hpp_TLSSessionCache_hpp
+#define hpp_TLSSessionCache_hpp
+
+// We need types like uint32 here
+#include <Types.hpp>
+// We need strcmp and strcpy
+#include <string.h>
+
+namespace Network
+{
+    namespace Client
+    {
+        /** The bookkeeping of the TLS session cache, @sa MQTTTLSSessionCache.
+            The entries are keyed by the broker's host name, port and a hash of the certificates used for the connection, and
+            the least recently used entry is replaced when the cache is full.
+            This doesn't depend on the TLS library: the session is stored as is and it's up to the caller to copy it in and
+            out of the entries (and to free it when an entry is replaced). This isn't thread safe either.
+            @param Session  The TLS library's session type
+            @param Count    The number of entries in the cache */
+        template <typename Session, unsigned Count>
+        struct TLSSessionCache
+        {
+            struct Entry
+            {
+                /** The broker's host name and port */
+                char                    host[64];
+                uint16                  port;
+                /** A hash of the certificates used for the connection */
+                uint32                  certHash;
+                /** The last time this entry was used (a counter), to replace the least recently used entry */
+                uint32                  lastUse;
+                /** Is the session valid ? */
+                bool                    valid;
+                /** The session itself */
+                Session                 session;
+            } entries[Count];
+            /** The counter giving the entries' last use */
+            uint32 useCounter;
+
+            /** Find the valid entry for the given broker and certificates
+                @return 0 if there's none */
+            Entry * find(const char * host, const uint16 port, const uint32 certHash)
+            {
+                for (unsigned i = 0; i < Count; i++)
+                    if (entries[i].valid && entries[i].port == port && entries[i].certHash == certHash && !strcmp(entries[i].host, host)) return &entries[i];
+                return 0;
+            }
+            /** Find the valid entry for the given broker and certificates and mark it as the most recently used
+                @return 0 if there's none */
+            Entry * use(const char * host, const uint16 port, const uint32 certHash)
+            {
+                Entry * entry = find(host, port, certHash);
+                if (entry) entry->lastUse = ++useCounter;
+                return entry;
+            }
+            /** Get the entry to store a session for the given broker and certificates: the existing one, or else a free one
+                or the least recently used one, that's then assigned to this broker. It's marked as the most recently used.
+                @param host     The broker's host name, it must be shorter than the entry's buffer
+                @return The entry, whose previous session (if valid) must be freed before it's replaced */
+            Entry & assign(const char * host, const uint16 port, const uint32 certHash)
+            {
+                Entry * entry = find(host, port, certHash);
+                if (!entry)
+                {   // Replace the least recently used entry
+                    entry = &entries[0];
+                    for (unsigned i = 1; i < Count && entry->valid; i++)
+                        if (!entries[i].valid || entries[i].lastUse < entry->lastUse) entry = &entries[i];
+                    strcpy(entry->host, host); entry->port = port; entry->certHash = certHash;
+                }
+                entry->lastUse = ++useCounter;
+                return *entry;
+            }
+
+            TLSSessionCache() : useCounter(0)
+            {
+                for (unsigned i = 0; i < Count; i++) { entries[i].host[0] = 0; entries[i].port = 0; entries[i].certHash = 0; entries[i].lastUse = 0; entries[i].valid = false; }
+            }
+        };
+    }
+}
+
+#endif
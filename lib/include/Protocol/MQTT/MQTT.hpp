@@ -1099,6 +1099,39 @@ namespace Protocol
                     26, // SharedSubAvailable      ,
                 };
 
+                /** The visitor type (see isValidType above) for each property, indexed by invPropertyMap.
+                    This is a compile time constant so it can be used without the registry singleton */
+                static const uint8 propertiesType[PropertiesCount] =
+                {
+                    0, /* PODVisitor<uint8>              */ // PayloadFormat
+                    2, /* LittleEndianPODVisitor<uint32> */ // MessageExpiryInterval
+                    5, /* DynamicStringView              */ // ContentType
+                    5, /* DynamicStringView              */ // ResponseTopic
+                    4, /* DynamicBinDataView             */ // CorrelationData
+                    3, /* MappedVBInt                    */ // SubscriptionID
+                    2, /* LittleEndianPODVisitor<uint32> */ // SessionExpiryInterval
+                    5, /* DynamicStringView              */ // AssignedClientID
+                    1, /* LittleEndianPODVisitor<uint16> */ // ServerKeepAlive
+                    5, /* DynamicStringView              */ // AuthenticationMethod
+                    4, /* DynamicBinDataView             */ // AuthenticationData
+                    0, /* PODVisitor<uint8>              */ // RequestProblemInfo
+                    2, /* LittleEndianPODVisitor<uint32> */ // WillDelayInterval
+                    0, /* PODVisitor<uint8>              */ // RequestResponseInfo
+                    5, /* DynamicStringView              */ // ResponseInfo
+                    5, /* DynamicStringView              */ // ServerReference
+                    5, /* DynamicStringView              */ // ReasonString
+                    1, /* LittleEndianPODVisitor<uint16> */ // ReceiveMax
+                    1, /* LittleEndianPODVisitor<uint16> */ // TopicAliasMax
+                    1, /* LittleEndianPODVisitor<uint16> */ // TopicAlias
+                    0, /* PODVisitor<uint8>              */ // QoSMax
+                    0, /* PODVisitor<uint8>              */ // RetainAvailable
+                    6, /* DynamicStringPairView          */ // UserProperty
+                    2, /* LittleEndianPODVisitor<uint32> */ // PacketSizeMax
+                    0, /* PODVisitor<uint8>              */ // WildcardSubAvailable
+                    0, /* PODVisitor<uint8>              */ // SubIDAvailable
+                    0, /* PODVisitor<uint8>              */ // SharedSubAvailable
+                };
+
                 /** Get the property name for a given property type */
                 static const char * getPropertyName(const uint8 propertyType)
                 {
@@ -1238,8 +1271,6 @@ namespace Protocol
             /** A registry used to store the mapping between properties and their visitor */
             class MemMappedPropertyRegistry
             {
-                uint8 propertiesType[PrivateRegistry::PropertiesCount];
-
             public:
                 /** Singleton pattern */
                 static MemMappedPropertyRegistry & getInstance()
@@ -1273,41 +1304,11 @@ namespace Protocol
 
                     uint8 index = PrivateRegistry::invPropertyMap[propertyType];
                     if (index == PrivateRegistry::PropertiesCount) return false;
-                    return visitor.mutate(propertiesType[index], (PropertyType)propertyType);
+                    return visitor.mutate(PrivateRegistry::propertiesType[index], (PropertyType)propertyType);
                 }
 
             private:
-                MemMappedPropertyRegistry()
-                {
-                    // Register all properties now
-                    propertiesType[ 0] = 0; /* PODVisitor<uint8>              */ // PayloadFormat
-                    propertiesType[ 1] = 2; /* LittleEndianPODVisitor<uint32> */ // MessageExpiryInterval
-                    propertiesType[ 2] = 5; /* DynamicStringView              */ // ContentType
-                    propertiesType[ 3] = 5; /* DynamicStringView              */ // ResponseTopic
-                    propertiesType[ 4] = 4; /* DynamicBinDataView             */ // CorrelationData
-                    propertiesType[ 5] = 3; /* MappedVBInt                    */ // SubscriptionID
-                    propertiesType[ 6] = 2; /* LittleEndianPODVisitor<uint32> */ // SessionExpiryInterval
-                    propertiesType[ 7] = 5; /* DynamicStringView              */ // AssignedClientID
-                    propertiesType[ 8] = 1; /* LittleEndianPODVisitor<uint16> */ // ServerKeepAlive
-                    propertiesType[ 9] = 5; /* DynamicStringView              */ // AuthenticationMethod
-                    propertiesType[10] = 4; /* DynamicBinDataView             */ // AuthenticationData
-                    propertiesType[11] = 0; /* PODVisitor<uint8>              */ // RequestProblemInfo
-                    propertiesType[12] = 2; /* LittleEndianPODVisitor<uint32> */ // WillDelayInterval
-                    propertiesType[13] = 0; /* PODVisitor<uint8>              */ // RequestResponseInfo
-                    propertiesType[14] = 5; /* DynamicStringView              */ // ResponseInfo
-                    propertiesType[15] = 5; /* DynamicStringView              */ // ServerReference
-                    propertiesType[16] = 5; /* DynamicStringView              */ // ReasonString
-                    propertiesType[17] = 1; /* LittleEndianPODVisitor<uint16> */ // ReceiveMax
-                    propertiesType[18] = 1; /* LittleEndianPODVisitor<uint16> */ // TopicAliasMax
-                    propertiesType[19] = 1; /* LittleEndianPODVisitor<uint16> */ // TopicAlias
-                    propertiesType[20] = 0; /* PODVisitor<uint8>              */ // QoSMax
-                    propertiesType[21] = 0; /* PODVisitor<uint8>              */ // RetainAvailable
-                    propertiesType[22] = 6; /* DynamicStringPairView          */ // UserProperty
-                    propertiesType[23] = 2; /* LittleEndianPODVisitor<uint32> */ // PacketSizeMax
-                    propertiesType[24] = 0; /* PODVisitor<uint8>              */ // WildcardSubAvailable
-                    propertiesType[25] = 0; /* PODVisitor<uint8>              */ // SubIDAvailable
-                    propertiesType[26] = 0; /* PODVisitor<uint8>              */ // SharedSubAvailable
-                }
+                MemMappedPropertyRegistry() {}
             };
 
 
@@ -2117,11 +2118,11 @@ namespace Protocol
                     Properties * ret = new Properties();
                     ret->length = length;
                     const PropertyBase * n = head;
-                    PropertyBase * & m = ret->head;
+                    PropertyBase ** m = &ret->head;
                     while (n)
                     {
-                        m = n->clone();
-                        m = m->next;
+                        *m = n->clone();
+                        m = &(*m)->next;
                         n = n->next;
                     }
                     return ret;
@@ -2259,6 +2260,163 @@ namespace Protocol
 #endif
             };
 
+            /** An index on a properties view.
+                Iterating a PropertiesView with getProperty is a linear search for each property you are interested in.
+                Instead, this index walks the properties once and remembers where the first occurrence of each property
+                type is, so that fetching any property later on is a constant time operation.
+                Properties that can appear multiple times (like UserProperty) only have their first occurrence indexed, use
+                PropertiesView::getProperty to iterate them all.
+
+                Like the view, this does not allocate and does not copy anything, so the viewed buffer must outlive it.
+
+                Typically, you'll use this class like this:
+                @code
+                    PropertiesIndex index(packet.props);
+                    uint32 maxSize = 0;
+                    DynamicStringView contentType;
+                    if (index.getValue(PacketSizeMax, maxSize)) { } // Do something with maxSize
+                    if (index.getValue(ContentType, contentType)) { } // Do something with contentType
+                @endcode */
+            struct PropertiesIndex
+            {
+                /** The viewed properties buffer */
+                const uint8 *   buffer;
+                /** The offset (in buffer) of the value of the first occurrence of each property, or 0 if missing */
+                uint32          offsets[PrivateRegistry::PropertiesCount];
+
+                /** Index the given properties view
+                    @param view     The properties to index
+                    @return false if the properties are malformed (in that case, the index is left empty) */
+                bool index(const PropertiesView & view)
+                {
+                    clear();
+                    const uint32 length = (uint32)view.length;
+                    if (!length) return true;
+                    if (!view.buffer) return false;
+
+                    uint32 offset = 0;
+                    while (offset < length)
+                    {
+                        const uint8 t = view.buffer[offset++];
+                        if (t >= MaxUsedPropertyType) return clear();
+                        const uint8 i = PrivateRegistry::invPropertyMap[t];
+                        if (i == PrivateRegistry::PropertiesCount) return clear();
+
+                        const uint32 size = valueSize(PrivateRegistry::propertiesType[i], view.buffer + offset, length - offset);
+                        if (!size) return clear();
+                        if (!offsets[i]) offsets[i] = offset;
+                        offset += size;
+                    }
+                    buffer = view.buffer;
+                    return true;
+                }
+                /** Check if the given property was found */
+                bool has(const PropertyType type) const { return find(type, 0xFF) != 0; }
+                /** Get the position of the given property value in the viewed buffer (this is useful to modify it in place)
+                    @return A pointer on the value or 0 if the property is missing */
+                const uint8 * getPosition(const PropertyType type) const { return find(type, 0xFF); }
+
+                /** Get the value of a byte sized property (like PayloadFormat or QoSMax) */
+                bool getValue(const PropertyType type, uint8 & value) const
+                {
+                    const uint8 * p = find(type, PrivateRegistry::isValidType< PODVisitor<uint8> >::Value);
+                    if (!p) return false;
+                    value = p[0];
+                    return true;
+                }
+                /** Get the value of a 2 bytes property (like ReceiveMax or TopicAlias) */
+                bool getValue(const PropertyType type, uint16 & value) const
+                {
+                    const uint8 * p = find(type, PrivateRegistry::isValidType< LittleEndianPODVisitor<uint16> >::Value);
+                    if (!p) return false;
+                    value = ((uint16)p[0] << 8) | p[1];
+                    return true;
+                }
+                /** Get the value of a 4 bytes or variable byte integer property (like PacketSizeMax or SubscriptionID) */
+                bool getValue(const PropertyType type, uint32 & value) const
+                {
+                    const uint8 * p = find(type, PrivateRegistry::isValidType< LittleEndianPODVisitor<uint32> >::Value);
+                    if (p) { value = ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3]; return true; }
+                    p = find(type, PrivateRegistry::isValidType< MappedVBInt >::Value);
+                    if (!p) return false;
+                    MappedVBInt v;
+                    if (isError(v.acceptBuffer(p, 4))) return false;
+                    value = v.getValue();
+                    return true;
+                }
+                /** Get the value of a string property (like ContentType or ReasonString) */
+                bool getValue(const PropertyType type, DynamicStringView & value) const
+                {
+                    const uint8 * p = find(type, PrivateRegistry::isValidType< DynamicStringView >::Value);
+                    if (!p) return false;
+                    value.length = ((uint16)p[0] << 8) | p[1];
+                    value.data = (const char*)&p[2];
+                    return true;
+                }
+                /** Get the value of a binary data property (like CorrelationData or AuthenticationData) */
+                bool getValue(const PropertyType type, DynamicBinDataView & value) const
+                {
+                    const uint8 * p = find(type, PrivateRegistry::isValidType< DynamicBinDataView >::Value);
+                    if (!p) return false;
+                    value.length = ((uint32)p[0] << 8) | p[1];
+                    value.data = &p[2];
+                    return true;
+                }
+                /** Get the value of the first string pair property (only UserProperty) */
+                bool getValue(const PropertyType type, DynamicStringPairView & value) const
+                {
+                    const uint8 * p = find(type, PrivateRegistry::isValidType< DynamicStringPairView >::Value);
+                    if (!p) return false;
+                    value.key.length = ((uint16)p[0] << 8) | p[1];
+                    value.key.data = (const char*)&p[2];
+                    p += 2 + value.key.length;
+                    value.value.length = ((uint16)p[0] << 8) | p[1];
+                    value.value.data = (const char*)&p[2];
+                    return true;
+                }
+
+                /** Build an empty index */
+                PropertiesIndex() { clear(); }
+                /** Build an index on the given properties view */
+                PropertiesIndex(const PropertiesView & view) { index(view); }
+
+            private:
+                /** Clear the index. This always returns false so it can be used for error path */
+                bool clear() { buffer = 0; memset(offsets, 0, sizeof(offsets)); return false; }
+                /** Find the given property value position in the buffer if it exists and has the given visitor type (or any type if 0xFF) */
+                const uint8 * find(const PropertyType type, const uint8 visitorType) const
+                {
+                    if (!buffer || type >= MaxUsedPropertyType) return 0;
+                    const uint8 i = PrivateRegistry::invPropertyMap[type];
+                    if (i == PrivateRegistry::PropertiesCount || !offsets[i]) return 0;
+                    if (visitorType != 0xFF && PrivateRegistry::propertiesType[i] != visitorType) return 0;
+                    return &buffer[offsets[i]];
+                }
+                /** Compute the size of a property value of the given visitor type, or 0 if it does not fit in the buffer */
+                static uint32 valueSize(const uint8 visitorType, const uint8 * p, const uint32 len)
+                {
+                    uint32 size = 0;
+                    switch (visitorType)
+                    {
+                    case 0: size = 1; break;
+                    case 1: size = 2; break;
+                    case 2: size = 4; break;
+                    case 3: while (size < 4 && size < len && (p[size++] & 0x80)) {} if (size && (p[size-1] & 0x80)) return 0; break;
+                    case 4: case 5: if (len < 2) return 0; size = 2 + (((uint32)p[0] << 8) | p[1]); break;
+                    case 6:
+                    {
+                        if (len < 2) return 0;
+                        size = 2 + (((uint32)p[0] << 8) | p[1]);
+                        if (len < size + 2) return 0;
+                        size += 2 + (((uint32)p[size] << 8) | p[size+1]);
+                        break;
+                    }
+                    default: return 0;
+                    }
+                    return size <= len ? size : 0;
+                }
+            };
+
             /** The possible value for retain handling in subscribe packet */
             enum RetainHandling
             {
@@ -2445,6 +2603,120 @@ namespace Protocol
                     : ScribeTopicBase(topic, stackBased) {}
             };
 
+            /** A contiguous list of subscribe (or unsubscribe) topics.
+                Unlike the chained lists above, all the topics are stored in a single buffer, already in their wire format
+                (the topic filter's length, its content and, for subscribing, the subscribe option byte).
+                Appending a topic and counting them takes a constant time and the list is serialized with a single copy, so
+                this is the preferred way to build very large subscription sets. Use reserve if you know the total size
+                in advance so only one allocation happens.
+                @param WithOptions  Set to true for a list of topics to subscribe to, false for unsubscribing */
+            template <bool WithOptions>
+            struct ScribeTopicArray
+            {
+                /** The serialized topics */
+                uint8 *             buffer;
+                /** The used size in bytes */
+                uint32              size;
+                /** The allocated size in bytes */
+                uint32              capacity;
+                /** The number of topics in the buffer */
+                uint32              topics;
+
+            public:
+                /** Make a subscribe option byte (only used when WithOptions is true) @sa SubscribeTopic */
+                static uint8 makeOption(const uint8 retainHandling, const bool retainAsPublished, const bool nonLocal, const uint8 QoS)
+                {
+                    return (uint8)(((retainHandling & 3) << 4) | (retainAsPublished ? 8 : 0) | (nonLocal ? 4 : 0) | (QoS & 3));
+                }
+                /** Reserve enough space for the given size in bytes
+                    @return false upon allocation failure */
+                bool reserve(const uint32 bytes)
+                {
+                    if (bytes <= capacity) return true;
+                    uint8 * p = (uint8*)Platform::realloc(buffer, bytes);
+                    if (!p) return false;
+                    buffer = p; capacity = bytes;
+                    return true;
+                }
+                /** Append a topic to the end of this list.
+                    @param topic    The topic filter to append
+                    @param length   The topic's length in bytes (if 0, it's computed)
+                    @param option   The subscribe option (ignored if WithOptions is false), @sa makeOption
+                    @return false upon allocation failure or if the topic is invalid */
+                bool append(const char * topic, uint32 length = 0, const uint8 option = 0)
+                {
+                    if (!topic) return false;
+                    if (!length) length = (uint32)strlen(topic);
+                    if (!length || length > 65535) return false;
+                    const uint32 entry = 2 + length + (WithOptions ? 1 : 0);
+                    if (size + entry > capacity && !reserve(size + entry > capacity * 2 ? size + entry : capacity * 2)) return false;
+
+                    uint8 * p = buffer + size;
+                    p[0] = (uint8)(length >> 8); p[1] = (uint8)length;
+                    memcpy(p + 2, topic, length);
+                    if (WithOptions) p[2 + length] = option;
+                    size += entry; topics++;
+                    return true;
+                }
+                /** Count the number of topic */
+                inline uint32 count() const { return topics; }
+                /** Remove all topics (the buffer is kept for reuse) */
+                inline void clear() { size = 0; topics = 0; }
+                /** Get the serialized topics */
+                inline const uint8 * getBuffer() const { return buffer; }
+
+                /** This give the size required for serializing this list in bytes */
+                inline uint32 getSize() const { return size; }
+                /** Copy the value into the given buffer.
+                    @param dest     A pointer to an allocated buffer that's getSize() long.
+                    @return The number of bytes used in the buffer */
+                uint32 copyInto(uint8 * dest) const { if (size) memcpy(dest, buffer, size); return size; }
+#if MQTTAvoidValidation != 1
+                /** Check if this list is valid (it must not be empty, and the options must be valid) */
+                bool check() const
+                {
+                    if (!topics) return false;
+                    if (!WithOptions) return true;
+                    for (uint32 o = 0; o < size; )
+                    {
+                        o += 2 + ((buffer[o] << 8) | buffer[o+1]);
+                        const uint8 option = buffer[o++];
+                        if ((option & 0xC0) || (option & 3) == 3 || (option & 0x30) == 0x30) return false;
+                    }
+                    return true;
+                }
+#endif
+#if MQTTDumpCommunication == 1
+                void dump(MQTTString & out, const int indent = 0) const
+                {
+                    for (uint32 o = 0; o < size; )
+                    {
+                        const uint32 length = (buffer[o] << 8) | buffer[o+1];
+                        if (WithOptions)
+                        {
+                            const uint8 option = buffer[o + 2 + length];
+                            out += MQTTStringPrintf("%*sSubscribe (QoS %d, nonLocal %d, retainAsPublished %d, retainHandling %d): %.*s\n", (int)indent, "", option & 3, (option >> 2) & 1, (option >> 3) & 1, (option >> 4) & 3, (int)length, buffer + o + 2);
+                        }
+                        else out += MQTTStringPrintf("%*sUnsubscribe: %.*s\n", (int)indent, "", (int)length, buffer + o + 2);
+                        o += 2 + length + (WithOptions ? 1 : 0);
+                    }
+                }
+#endif
+
+                /** Build an empty list, optionally reserving the given size in bytes */
+                ScribeTopicArray(const uint32 reservedBytes = 0) : buffer(0), size(0), capacity(0), topics(0) { reserve(reservedBytes); }
+                ~ScribeTopicArray() { Platform::free(buffer); buffer = 0; size = capacity = topics = 0; }
+
+            private:
+                /** Prevent copying */
+                ScribeTopicArray(const ScribeTopicArray &);
+                ScribeTopicArray & operator = (const ScribeTopicArray &);
+            };
+            /** The contiguous list of topics to subscribe to */
+            typedef ScribeTopicArray<true>  SubscribeTopicArray;
+            /** The contiguous list of topics to unsubscribe from */
+            typedef ScribeTopicArray<false> UnsubscribeTopicArray;
+
             /** The variable header presence for each possible packet type, the payload presence in each packet type */
             template <ControlPacketType type>
             struct ControlPacketMeta
@@ -3166,16 +3438,18 @@ namespace Protocol
             {
                 /** The subscribe topics */
                 SubscribeTopic * topics;
+                /** The contiguous topics list, if set, it's used instead of the topics above (it's not owned) */
+                const SubscribeTopicArray * topicArray;
 
                 /** Set the expected packet size (this is useful for packet whose payload is application defined) */
                 inline void setExpectedPacketSize(uint32 sizeInBytes) { expSize = sizeInBytes; }
 
                 /** This give the size required for serializing this property header in bytes */
-                uint32 getSize() const { return topics ? topics->getSize() : 0; }
+                uint32 getSize() const { return topicArray ? topicArray->getSize() : (topics ? topics->getSize() : 0); }
                 /** Copy the value into the given buffer.
                     @param buffer   A pointer to an allocated buffer that's getSize() long.
                     @return The number of bytes used in the buffer */
-                uint32 copyInto(uint8 * buffer) const { return topics ? topics->copyInto(buffer) : 0; }
+                uint32 copyInto(uint8 * buffer) const { return topicArray ? topicArray->copyInto(buffer) : (topics ? topics->copyInto(buffer) : 0); }
 #if MQTTClientOnlyImplementation != 1
                 /** Read the value from a buffer.
                     @param buffer   A pointer to an allocated buffer that's at least 1 byte long
@@ -3184,6 +3458,7 @@ namespace Protocol
                 {
                     if (bufLength < expSize) return NotEnoughData;
                     if (topics) topics->suicide();
+                    topicArray = 0;
                     topics = new SubscribeTopic();
                     return topics->readFrom(buffer, expSize);
                 }
@@ -3191,18 +3466,19 @@ namespace Protocol
 
 #if MQTTAvoidValidation != 1
                 /** Check if this property is valid */
-                bool check() const { return topics ? topics->check() : true; }
+                bool check() const { return topicArray ? topicArray->check() : (topics ? topics->check() : true); }
 #endif
 #if MQTTDumpCommunication == 1
                 void dump(MQTTString & out, const int indent = 0)
                 {
                     out += MQTTStringPrintf("%*sSUBSCRIBE Payload\n", (int)indent, "");
-                    if (topics) topics->dump(out, indent + 2);
+                    if (topicArray) topicArray->dump(out, indent + 2);
+                    else if (topics) topics->dump(out, indent + 2);
                 }
 #endif
 
 
-                Payload() : topics(0), expSize(0) {}
+                Payload() : topics(0), topicArray(0), expSize(0) {}
                 ~Payload() { if (topics) topics->suicide(); topics = 0; }
             private:
                 uint32 expSize;
@@ -3214,16 +3490,18 @@ namespace Protocol
             {
                 /** The subscribe topics */
                 UnsubscribeTopic * topics;
+                /** The contiguous topics list, if set, it's used instead of the topics above (it's not owned) */
+                const UnsubscribeTopicArray * topicArray;
 
                 /** Set the expected packet size (this is useful for packet whose payload is application defined) */
                 inline void setExpectedPacketSize(uint32 sizeInBytes) { expSize = sizeInBytes; }
 
                 /** This give the size required for serializing this property header in bytes */
-                uint32 getSize() const { return topics ? topics->getSize() : 0; }
+                uint32 getSize() const { return topicArray ? topicArray->getSize() : (topics ? topics->getSize() : 0); }
                 /** Copy the value into the given buffer.
                     @param buffer   A pointer to an allocated buffer that's getSize() long.
                     @return The number of bytes used in the buffer */
-                uint32 copyInto(uint8 * buffer) const { return topics ? topics->copyInto(buffer) : 0; }
+                uint32 copyInto(uint8 * buffer) const { return topicArray ? topicArray->copyInto(buffer) : (topics ? topics->copyInto(buffer) : 0); }
 #if MQTTClientOnlyImplementation != 1
                 /** Read the value from a buffer.
                     @param buffer   A pointer to an allocated buffer that's at least 1 byte long
@@ -3232,24 +3510,26 @@ namespace Protocol
                 {
                     if (bufLength < expSize) return NotEnoughData;
                     if (topics) topics->suicide();
+                    topicArray = 0;
                     topics = new UnsubscribeTopic();
                     return topics->readFrom(buffer, expSize);
                 }
 #endif
 #if MQTTAvoidValidation != 1
                 /** Check if this property is valid */
-                bool check() const { return topics ? topics->check() : true; }
+                bool check() const { return topicArray ? topicArray->check() : (topics ? topics->check() : true); }
 #endif
 #if MQTTDumpCommunication == 1
                 void dump(MQTTString & out, const int indent = 0)
                 {
                     out += MQTTStringPrintf("%*sUNSUBSCRIBE Payload\n", (int)indent, "");
-                    if (topics) topics->dump(out, indent + 2);
+                    if (topicArray) topicArray->dump(out, indent + 2);
+                    else if (topics) topics->dump(out, indent + 2);
                 }
 #endif
 
 
-                Payload() : topics(0), expSize(0) {}
+                Payload() : topics(0), topicArray(0), expSize(0) {}
                 ~Payload() { if (topics) topics->suicide(); topics = 0; }
             private:
                 uint32 expSize;
@@ -3440,6 +3720,214 @@ namespace Protocol
                 {}
             };
 
+            /** A read only view on a received PUBLISH packet.
+                Receiving PUBLISH packets is the hot path of a client, so unlike ROPublishPacket that's using the generic
+                (and virtual) ControlPacketSerializableImpl::readFrom method, this is decoding the packet in a single pass over the
+                buffer, without any virtual call.
+                The topic name, properties and payload are views on the given buffer so it must outlive this object.
+                Other packets types should still use the generic ControlPacket code. */
+            struct PublishPacketView
+            {
+                /** The fixed header (with QoS, retain and dup flags) */
+                PublishHeader           header;
+                /** The topic name */
+                DynamicStringView       topicName;
+                /** The packet identifier (only valid for QoS 1 or 2, else it's 0) */
+                uint16                  packetID;
+                /** The packet properties */
+                PropertiesView          props;
+                /** The packet payload */
+                DynamicBinDataView      payload;
+
+                /** Read the packet from the given buffer.
+                    @param buffer       A pointer to the buffer containing a complete PUBLISH packet, including its fixed header
+                    @param bufLength    The buffer length in bytes
+                    @return The number of bytes read from the buffer, or an error (use isError() to check) */
+                uint32 readFrom(const uint8 * buffer, uint32 bufLength)
+                {
+                    if (bufLength < 2) return NotEnoughData;
+                    const uint8 flags = buffer[0];
+                    if ((flags >> 4) != PUBLISH || (flags & 6) == 6) return BadData;
+                    const_cast<uint8&>(header.typeAndFlags) = flags;
+
+                    // Remaining length is a variable byte integer
+                    uint32 remLength = 0, o = 1;
+                    for (uint32 shift = 0; ; shift += 7)
+                    {
+                        if (o >= bufLength) return NotEnoughData;
+                        const uint8 b = buffer[o++];
+                        remLength |= (uint32)(b & 0x7F) << shift;
+                        if (b < 0x80) break;
+                        if (o == 5) return BadData;
+                    }
+                    if (remLength > bufLength - o) return NotEnoughData;
+                    const uint32 end = o + remLength;
+
+                    // Topic name and packet identifier
+                    if (end - o < 2) return BadData;
+                    topicName.length = ((uint16)buffer[o] << 8) | buffer[o+1]; o += 2;
+                    if (end - o < topicName.length) return BadData;
+                    topicName.data = (const char*)&buffer[o]; o += topicName.length;
+                    packetID = 0;
+                    if (flags & 6)
+                    {
+                        if (end - o < 2) return BadData;
+                        packetID = ((uint16)buffer[o] << 8) | buffer[o+1]; o += 2;
+                    }
+
+                    // Properties
+                    uint32 s = props.length.readFrom(&buffer[o], end - o);
+                    if (isError(s)) return BadData;
+                    o += s;
+                    if ((uint32)props.length > end - o) return BadData;
+                    props.buffer = &buffer[o];
+                    o += (uint32)props.length;
+
+                    // Payload is everything that's left
+                    payload.length = end - o;
+                    payload.data = &buffer[o];
+                    return end;
+                }
+
+                PublishPacketView() : packetID(0) {}
+            };
+
+            /** A received PUBLISH packet's content republished in a new PUBLISH packet without rebuilding it (for bridges).
+                Only the fixed header, the topic length, the packet identifier, the properties length and the edited properties are
+                serialized, the topic, the kept received properties and the payload are referred to where they were received.
+                The Subscription Identifier and Topic Alias properties are removed since they only make sense on the receiving connection,
+                and so are the received properties replaced by the edited ones (except for User Property which is appended).
+                Call prepare, then build with buffers of middleSize() and compactSize() bytes, and send the parts in order. */
+            struct ForwardedPublish
+            {
+                /** A part of the packet */
+                struct Part
+                {
+                    const uint8 *   data;
+                    uint32          size;
+                };
+                enum
+                {
+                    MaxRuns     = 8,            //!< The maximum number of runs of received properties that are referred to, else they're copied
+                    MaxParts    = MaxRuns + 4,  //!< The header, the topic, the middle part, the runs and the payload
+                };
+                /** The packet's parts, in order */
+                Part                    parts[MaxParts];
+                /** The packet's size in bytes */
+                uint32                  packetSize;
+
+                /** Find the runs of received properties that are forwarded, and either refer to them or copy them in the given buffer.
+                    @param runs     Filled with up to maxRuns runs (unless compact is given)
+                    @param compact  If not null, the runs are copied in this buffer instead
+                    @param size     On output, the total size of the runs
+                    @return The number of runs (it can be larger than maxRuns), or -1 if the properties are malformed */
+                static int findRuns(const PropertiesView & received, const Properties * edited, Part * runs, const int maxRuns, uint8 * compact, uint32 & size)
+                {
+                    VisitorVariant visitor;
+                    uint32 from = 0, offset = 0;
+                    int count = 0;
+                    size = 0;
+                    while (true)
+                    {
+                        const bool more = received.getProperty(visitor);
+                        const PropertyType type = visitor.propertyType();
+                        if (more && type != SubscriptionID && type != TopicAlias && (type == UserProperty || !edited || !edited->getProperty(type)))
+                        {   // Kept, so extend the current run
+                            offset = visitor.getOffset();
+                            continue;
+                        }
+                        if (offset > from)
+                        {
+                            if (compact) memcpy(compact + size, received.buffer + from, offset - from);
+                            else if (count < maxRuns) { runs[count].data = received.buffer + from; runs[count].size = offset - from; }
+                            count++;
+                            size += offset - from;
+                        }
+                        if (!more) break;
+                        offset = from = visitor.getOffset();
+                    }
+                    return offset == (uint32)received.length ? count : -1;
+                }
+
+                /** Prepare the packet.
+                    @param topic        The topic to publish on
+                    @param payload      The received payload
+                    @param received     The received properties
+                    @param edited       If not null, the properties sent along the received ones
+                    @return false if the received properties are malformed */
+                bool prepare(const DynamicStringView & topic, const DynamicBinDataView & payload, const PropertiesView & received, const Properties * edited,
+                             const uint8 QoS, const bool retain)
+                {
+                    runs = findRuns(received, edited, &parts[3], MaxRuns, 0, keptSize);
+                    if (runs < 0) return false;
+                    this->received = &received; this->edited = edited; qos = QoS;
+                    parts[1].data = (const uint8*)topic.data; parts[1].size = topic.length;
+                    parts[MaxParts - 1].data = payload.data; parts[MaxParts - 1].size = payload.length;
+
+                    const uint32 editedSize = edited ? (uint32)edited->length : 0;
+                    propLength = keptSize + editedSize;
+                    const uint32 remaining = topic.getSize() + (qos ? 2 : 0) + propLength.getSize() + keptSize + editedSize + payload.length;
+                    remLength = remaining;
+                    header[0] = PublishHeader(false, qos, retain).typeAndFlags;
+                    parts[0].size = 1 + remLength.copyInto(header + 1);
+                    header[parts[0].size++] = (uint8)(topic.length >> 8);
+                    header[parts[0].size++] = (uint8)topic.length;
+                    parts[0].data = header;
+                    packetSize = 1 + remLength.getSize() + remaining;
+                    return true;
+                }
+                /** Check if the prepared packet isn't too large for the protocol */
+                bool fits() const { return propLength.checkImpl() && remLength.checkImpl(); }
+                /** The size of the buffer for the packet identifier, the properties length and the edited properties */
+                uint32 middleSize() const { return 6 + (edited ? (uint32)edited->length : 0); }
+                /** The size of the buffer to copy the received properties if there are too many runs, else 0 */
+                uint32 compactSize() const { return runs > MaxRuns ? keptSize : 0; }
+
+                /** Serialize the packet identifier and the properties, and list the packet's parts
+                    @param packetID     The packet identifier (ignored for QoS 0)
+                    @param middle       A buffer that's middleSize() bytes long
+                    @param compact      A buffer that's compactSize() bytes long
+                    @return The number of parts to send (in order) */
+                int build(const uint16 packetID, uint8 * middle, uint8 * compact)
+                {
+                    uint32 size = 0;
+                    if (qos)
+                    {
+                        middle[size++] = (uint8)(packetID >> 8);
+                        middle[size++] = (uint8)packetID;
+                    }
+                    size += propLength.copyInto(middle + size);
+                    for (const PropertyBase * c = edited ? edited->head : 0; c; c = c->next)
+                        size += c->copyInto(middle + size);
+                    parts[2].data = middle; parts[2].size = size;
+
+                    int count = 3 + runs;
+                    if (runs > MaxRuns)
+                    {   // Too many properties are removed, copy the remaining ones instead
+                        findRuns(*received, edited, 0, 0, compact, keptSize);
+                        parts[3].data = compact; parts[3].size = keptSize;
+                        count = 4;
+                    }
+                    if (parts[MaxParts - 1].size) parts[count++] = parts[MaxParts - 1];
+                    return count;
+                }
+
+                ForwardedPublish() : packetSize(0), received(0), edited(0), keptSize(0), runs(0), qos(0) {}
+
+            private:
+                /** The fixed header, and the topic length */
+                uint8                   header[7];
+                /** The received and edited properties */
+                const PropertiesView *  received;
+                const Properties *      edited;
+                /** The properties and remaining lengths */
+                VBInt                   propLength, remLength;
+                /** The size of the kept received properties and the number of runs */
+                uint32                  keptSize;
+                int                     runs;
+                uint8                   qos;
+            };
+
 
             /** Ping control packet are so empty that it makes sense to further optimize their parsing to strict minimum */
             template <ControlPacketType type>
@@ -1,9 +1,18 @@
 // We need our implementation
 #include <Network/Clients/MQTT.hpp>
+#if MQTTZeroCopyPublish == 1 || MQTTQoSSupportLevel == 1 || MQTTForwardPublish == 1
+  // Sending a packet made of multiple buffers is used for zero copy publishing, forwarding and for retransmitting packets
+  #define MQTTVectoredSend 1
+#endif
 #if MQTTMultithread == 1 &&  __cplusplus >= 201703L
   // If it's available, use the OS version of the shared mutex
   #include <shared_mutex>
 #endif
+#if MQTTMultithread == 1 && MQTTPriorityScheduler > 0
+  // The senders of a lower priority class sleep until the higher classes are sent
+  #include <mutex>
+  #include <condition_variable>
+#endif
 
 #if MQTTUseAuth == 1
   /** Used to track reentrancy in the AUTH recursive scheme */
@@ -15,6 +24,19 @@
 #endif
 
 
+#if MQTTUseIOUring >= 1 && (MQTTOnlyBSDSocket != 1 || !defined(__linux__))
+  #error The io_uring transport requires MQTTOnlyBSDSocket to be set to 1 and Linux
+#endif
+#if MQTTSocketTuning == 1 && MQTTOnlyBSDSocket != 1
+  #error The socket tuning profiles require MQTTOnlyBSDSocket to be set to 1
+#endif
+#if (MQTTTLSSessionCache > 0 || MQTTTLSCoalesceWrites > 0) && (MQTTUseTLS != 1 || MQTTOnlyBSDSocket != 1)
+  #error The TLS session resumption and write coalescing require MQTTUseTLS and MQTTOnlyBSDSocket to be set to 1
+#endif
+#if MQTTUseKTLS == 1 && (MQTTUseTLS != 1 || MQTTOnlyBSDSocket != 1 || !defined(__linux__))
+  #error The kernel TLS offload requires MQTTUseTLS and MQTTOnlyBSDSocket to be set to 1 and Linux
+#endif
+
 #if MQTTOnlyBSDSocket != 1
 #pragma message("This configuration is not supported and depends on external code in tests folder that is not exported upon install")
 // We need socket declaration
@@ -23,6 +45,10 @@
 //#include "../../../include/Network/SSLSocket.hpp"
 // We need FastLock too
 #include "Threading/Lock.hpp"
+  #if MQTTVectoredSend == 1
+    // We need iovec
+    #include <sys/uio.h>
+  #endif
   #if MQTTDumpCommunication == 1
     // We need hexDump
     #include "Utils/Dump.hpp"
@@ -36,6 +62,23 @@
 #include <netinet/tcp.h>
 // We need std::atomic too
 #include <atomic>
+  #if MQTTVectoredSend == 1
+    // We need writev
+    #include <sys/uio.h>
+  #endif
+  #if MQTTSocketTuning == 1 && defined(__linux__)
+    // We need pthread_setaffinity_np
+    #include <pthread.h>
+    #include <sched.h>
+  #endif
+  #if MQTTUseIOUring >= 1
+    // We need io_uring's structures and system calls (liburing isn't required)
+    #include <linux/io_uring.h>
+    #include <sys/syscall.h>
+    // We need mmap for the rings
+    #include <sys/mman.h>
+    #include <unistd.h>
+  #endif
   #if MQTTUseTLS == 1
     // We need MBedTLS code
     #include <mbedtls/version.h>
@@ -48,14 +91,60 @@
     #include <mbedtls/net_sockets.h>
     #include <mbedtls/platform.h>
     #include <mbedtls/ssl.h>
+    #if MQTTTLSSessionCache > 0
+      // We need the session cache's bookkeeping
+      #include <Network/Clients/TLSSessionCache.hpp>
+    #endif
+    #if MQTTUseKTLS == 1
+      // We need the kernel TLS structures
+      #include <linux/tls.h>
+      #ifndef TCP_ULP
+        #define TCP_ULP 31
+      #endif
+      #ifndef SOL_TLS
+        #define SOL_TLS 282
+      #endif
+    #endif
   #endif
 #endif
+#if MQTTPacketCapture > 0
+  // We need fopen to save the capture
+  #include <stdio.h>
+#endif
 // We need StackHeapBuffer to avoid stressing the heap allocator when it's not required
 #include <Platform/StackHeapBuffer.hpp>
 
 // This is the maximum allocation that'll be performed on the stack before it's being replaced by heap allocation
 // This also means that the stack size for the thread using such function must be larger than this value
 #define StackSizeAllocationLimit    512
+// This is the maximum time to wait in the event loop for the broker to acknowledge packets when the outbound queue is blocked by the receive maximum
+#define MaxOutboundWaitMs           100
+#if MQTTSocketTuning == 1
+  // This is the time the kernel busy polls the device when reading with the low latency profiles, in microseconds
+  #define TuningBusyPollUs          50
+  // This is the maximum amount of unsent data in the socket with the low latency profiles, in bytes
+  #define TuningNotSentLowAt        16384
+#endif
+#if MQTTLatencyProbe == 1
+  // This is the size of a latency probe's payload: the probe's generation (to ignore the other clients' probes), its sequence number and its sending time
+  #define ProbePayloadSize          12
+#endif
+#if MQTTPacketCapture > 0
+  // This is the size of the synthesized headers written before each captured packet in the pcap file: the record's header, IPv4 and TCP
+  #define CaptureFrameHeaderSize    56
+  // These are the TCP ports given to the broker (the one Wireshark's MQTT dissector is registered on) and the client in the pcap file
+  #define CaptureBrokerPort         1883
+  #define CaptureClientPort         49152
+#endif
+#if MQTTUseIOUring >= 1
+  // This is the number of buffers the kernel fills when receiving with io_uring, and their size (also used for the registered sending buffer)
+  #define URingBufferCount          16
+  #define URingBufferSize           4096
+  // This is the number of sending requests that can be submitted at once
+  #define URingSendEntries          16
+  // This is the time the kernel's polling thread spins before sleeping, in milliseconds
+  #define URingPollIdleMs           1000
+#endif
 
 
 namespace Network { namespace Client {
@@ -68,11 +157,23 @@ namespace Network { namespace Client {
           1. We use bit 16 for storing the communication direction (1 is for broker to client, 0 for client to broker), since packet ID allocation is independent of direction
           2. We use bit 31 for storing the QoS level (0 is for QoS1, 1 for QoS2)
           3. We use bit 30 for storing the publish cycle step (0 for non ACKed QoS2, 1 for PUBREC or PUBREL depending on direction)
+
+        With MQTTPublishCompletion, the packet IDs are followed by the time each of them was stored at (in microseconds).
         */
     struct Buffers
     {
-        uint8 * recvBuffer() { return end() * sizeof(uint32) + buffer; }
-        const uint8 * recvBuffer() const { return end() * sizeof(uint32) + buffer; }
+#if MQTTPublishCompletion == 1
+        enum { EntrySize = 2 * sizeof(uint32) };
+#else
+        enum { EntrySize = sizeof(uint32) };
+#endif
+#if MQTTRecvBufferPool > 1
+        uint8 * recvBuffer() { return end() * EntrySize + current * size + buffer; }
+        const uint8 * recvBuffer() const { return end() * EntrySize + current * size + buffer; }
+#else
+        uint8 * recvBuffer() { return end() * EntrySize + buffer; }
+        const uint8 * recvBuffer() const { return end() * EntrySize + buffer; }
+#endif
         uint8 findID(uint32 ID)
         {
             for (uint8 i = 0; i < end(); i++)
@@ -94,9 +195,13 @@ namespace Network { namespace Client {
         inline bool storeQoS2ID(uint32 ID)  { return clearSetID((uint32)ID | 0x80000000, 0); }
         inline bool avanceQoS2(uint32 ID)   { uint8 p = findID(ID); if (p == maxID) return false; packetsID()[p] |= 0x40000000; return true; }
         inline bool releaseID(uint32 ID)    { return clearSetID(0, (uint32)ID); }
+#if MQTTPublishCompletion == 1
+        inline bool stampID(uint32 ID, uint32 now) { uint8 p = findID(ID); if (p == maxID) return false; packetsID()[maxID + p] = now; return true; }
+        inline uint32 stampOf(uint32 ID)    { uint8 p = findID(ID); return p == maxID ? 0 : packetsID()[maxID + p]; }
+#endif
         inline uint8 end() const            { return maxID; }
         inline uint8 packetsCount() const   { return maxID / 3; }
-        inline void reset()                 { memset(packetsID(), 0, maxID * 3 * sizeof(uint32)); }
+        inline void reset()                 { memset(packetsID(), 0, maxID * EntrySize); }
         inline uint32 packetID(uint8 i) const { return packetsID()[i]; }
         inline uint8 countSentID() const    {
             uint8 count = 0;
@@ -106,10 +211,19 @@ namespace Network { namespace Client {
             return count;
         }
 
-        Buffers(uint32 size, uint32 maxID) : size(size), buffer((uint8*)::calloc(size + maxID * 3 * sizeof(uint32), 1)), maxID((uint8)(maxID * 3)) {}
+#if MQTTRecvBufferPool > 1
+        // The last buffer is only used for control packets when all the others are retained, @sa ImplBase::rotateRecvBuffer
+        Buffers(uint32 size, uint32 maxID) : size(size), current(0), buffer((uint8*)::calloc(size * (MQTTRecvBufferPool + 1) + maxID * 3 * EntrySize, 1)), maxID((uint8)(maxID * 3)) {}
+#else
+        Buffers(uint32 size, uint32 maxID) : size(size), buffer((uint8*)::calloc(size + maxID * 3 * EntrySize, 1)), maxID((uint8)(maxID * 3)) {}
+#endif
         ~Buffers() { ::free(buffer); buffer = 0; size = 0; maxID = 0; }
 
         uint32  size;
+#if MQTTRecvBufferPool > 1
+        /** The receive buffer currently used in the pool */
+        uint8   current;
+#endif
 
     private:
         uint32 * packetsID() { return (uint32*)buffer; }
@@ -165,6 +279,10 @@ namespace Network { namespace Client {
         uint16 ID;
         uint32 size;
         uint32 pos;
+  #if MQTTZeroCopyPublish == 1
+        /** The packet's payload if it's not stored in the ring buffer */
+        PayloadRef payload;
+  #endif
 
         inline void set(uint16 ID, uint32 size, uint32 pos) { this->ID = ID; this->size = size; this->pos = pos; }
         PacketBookmark(uint16 ID = 0, uint32 size = 0, uint32 pos = 0) : ID(ID), size(size), pos(pos) {}
@@ -248,6 +366,10 @@ namespace Network { namespace Client {
             // Let's deal with the former case first
             uint32 pos = packet.pos, size = packet.size, end = (packet.pos + packet.size) & sm1;
             packet.set(0, 0, 0);
+  #if MQTTZeroCopyPublish == 1
+            packet.payload.release();
+            packet.payload = PayloadRef();
+  #endif
             if (pos == r)
             {
                 r = (r + size) & sm1;
@@ -327,6 +449,25 @@ namespace Network { namespace Client {
             return true;
         }
 
+  #if MQTTZeroCopyPublish == 1
+        /** Add a packet header to this buffer and keep a reference on its payload */
+        bool saveParts(const uint16 packetID, const uint8 * header, uint32 size, const PayloadRef & payload)
+        {
+            if (!save(packetID, header, size)) return false;
+            packets[findID(packetID)].payload = payload;
+            return true;
+        }
+        /** Get the payload for a packet saved with saveParts */
+        bool loadPayload(const uint16 packetID, const uint8 *& payload, uint32 & size)
+        {
+            uint8 i = findID(packetID);
+            if (i == packetsCount || !packets[i].payload.data) return false;
+            payload = packets[i].payload.data;
+            size = packets[i].payload.size;
+            return true;
+        }
+  #endif
+
   #if 0
         /** This is only used in the test code to ensure it's working as expected */
         bool selfCheck() const
@@ -375,10 +516,28 @@ namespace Network { namespace Client {
     {
         return impl->load(packetID, bufferHead, sizeHead, bufferTail, sizeTail);
     }
+  #if MQTTZeroCopyPublish == 1
+    bool RingBufferStorage::savePacketParts(const uint16 packetID, const uint8 * header, const uint32 size, const PayloadRef & payload) { return impl->saveParts(packetID, header, size, payload); }
+    bool RingBufferStorage::loadPacketPayload(const uint16 packetID, const uint8 *& payload, uint32 & size) { return impl->loadPayload(packetID, payload, size); }
+  #endif
 
     /** The ring buffer storage size. Must be a power of 2 */
     RingBufferStorage::RingBufferStorage(const size_t bufferSize, const size_t maxPacketCount) : impl(allocImpl(bufferSize, maxPacketCount)) {}
+  #if MQTTZeroCopyPublish == 1
+    RingBufferStorage::~RingBufferStorage()
+    {
+        // Give back the payloads that are still referenced
+        for (uint8 i = 0; impl && i < impl->packetsCount; i++) impl->packets[i].payload.release();
+        ::free0(impl);
+    }
+  #else
     RingBufferStorage::~RingBufferStorage() { ::free0(impl); }
+  #endif
+#endif
+
+#if MQTTRecvBufferPool > 1
+    void MessageHandle::retain()  { static_cast<std::atomic<uint32>*>(slot)->fetch_add(1, std::memory_order_relaxed); }
+    void MessageHandle::release() { static_cast<std::atomic<uint32>*>(slot)->fetch_sub(1, std::memory_order_release); }
 #endif
 
     static uint32 timeoutInMs(const struct timeval & tv)
@@ -393,6 +552,182 @@ namespace Network { namespace Client {
 
     }
 
+#if MQTTStatistics == 1
+    // Add to a statistics counter, this is compiled out if the statistics are disabled
+    #define MQTTCount(counter, value)   stats.counter.fetch_add(value, std::memory_order_relaxed)
+#else
+    #define MQTTCount(counter, value)
+#endif
+
+#if MQTTUseReconnect == 1 || MQTTOutboundQueue > 0 || MQTTSocketTuning == 1 || MQTTLatencyProbe == 1
+    /** Get a monotonic millisecond counter (wrapping every 49 days), so delays aren't affected by wall clock changes */
+    static uint32 getTimeMs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint32)ts.tv_sec * 1000 + (uint32)(ts.tv_nsec / 1000000);
+    }
+#endif
+#if (MQTTPublishCompletion == 1 && MQTTQoSSupportLevel != -1) || MQTTLatencyProbe == 1
+    /** Get a monotonic microsecond counter (wrapping every 71 minutes) */
+    static uint32 getTimeUs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint32)ts.tv_sec * 1000000 + (uint32)(ts.tv_nsec / 1000);
+    }
+#endif
+#if MQTTUseReconnect == 1
+
+    /** The parameters given to connectTo that are used again upon reconnection */
+    struct ConnectParams
+    {
+        Protocol::MQTT::V5::DynamicString       host;
+        Protocol::MQTT::V5::DynamicString       userName;
+        Protocol::MQTT::V5::DynamicBinaryData   password;
+        MQTTv5::WillMessage *                   willMessage;
+        /** A deep copy of the CONNECT properties (views inside still refer to the application's data) */
+        Protocol::MQTT::V5::Properties *        properties;
+        uint16                                  port;
+        uint16                                  keepAlive;
+        MQTTv5::QoSDelivery                     willQoS;
+        bool                                    useTLS;
+        bool                                    hasUserName;
+        bool                                    hasPassword;
+        bool                                    willRetain;
+
+        ConnectParams() : willMessage(0), properties(0), port(0), keepAlive(0), willQoS(MQTTv5::QoSDelivery::AtMostOne), useTLS(false), hasUserName(false), hasPassword(false), willRetain(false) {}
+        ~ConnectParams() { delete0(properties); }
+    };
+#endif
+
+#if MQTTAsyncSubscribe > 0
+    /** A SUBSCRIBE or UNSUBSCRIBE packet waiting for its acknowledgement */
+    struct AsyncScribe
+    {
+        /** The request identifier given by the application */
+        uint32 requestID;
+        /** The index of the first topic in this packet, in the request's topics list */
+        uint32 firstTopic;
+        /** The packet identifier (0 if the slot is free) */
+        uint16 packetID;
+        /** The number of topics in this packet */
+        uint16 count;
+        /** Is it an unsubscribe packet ? */
+        bool   unsubscribe;
+    };
+#endif
+
+#if MQTTOutboundQueue > 0
+    /** The header for a packet in the outbound queue */
+    struct OutboundEntry
+    {
+        /** The packet size in bytes (0 is used as a marker for the unused space at the end of the queue) */
+        uint32 size;
+        /** The rate limits this packet matches (bitmask of the limit's index) */
+        uint32 limits;
+        /** The packet's QoS */
+        uint8  QoS;
+        /** The packet's priority class (only used with MQTTPriorityScheduler) */
+        uint8  priority;
+  #if MQTTMessageExpiry == 1
+        /** The offset of the Message Expiry Interval value in the packet (0 if it doesn't expire) */
+        uint32 expiryOffset;
+        /** The time the packet was queued, in seconds */
+        uint32 queuedAt;
+  #endif
+    };
+#endif
+
+#if MQTTMessageExpiry == 1
+  #if MQTTQoSSupportLevel == 1
+    /** The expiry information for a publication saved for retransmission */
+    struct MessageExpiry
+    {
+        /** The packet identifier (0 if the slot is free) */
+        uint16 packetID;
+        /** The offset of the Message Expiry Interval value in the packet */
+        uint32 offset;
+        /** The time the packet was saved, in seconds */
+        uint32 savedAt;
+        /** The Message Expiry Interval in seconds */
+        uint32 interval;
+    };
+  #endif
+
+    static inline uint32 readBE32(const uint8 * p) { return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3]; }
+    static inline void writeBE32(uint8 * p, const uint32 value) { p[0] = (uint8)(value >> 24); p[1] = (uint8)(value >> 16); p[2] = (uint8)(value >> 8); p[3] = (uint8)value; }
+
+    /** Find the Message Expiry Interval property in a serialized PUBLISH packet.
+        Only the packet header is read, so the payload doesn't need to follow it in memory.
+        @param packet       The serialized packet (at least its header)
+        @param size         The complete packet size in bytes
+        @param interval     Set to the property value if found
+        @return The offset of the property value in the packet, or 0 if it's missing */
+    static uint32 findMessageExpiry(const uint8 * packet, const uint32 size, uint32 & interval)
+    {
+        Protocol::MQTT::V5::PublishPacketView view;
+        if (Protocol::MQTT::Common::isError(view.readFrom(packet, size))) return 0;
+        Protocol::MQTT::V5::PropertiesIndex index(view.props);
+        if (!index.getValue(Protocol::MQTT::V5::MessageExpiryInterval, interval)) return 0;
+        return (uint32)(index.getPosition(Protocol::MQTT::V5::MessageExpiryInterval) - packet);
+    }
+#endif
+
+#if MQTTPriorityScheduler > 0
+    /** Order the packets being sent by priority class.
+        A sender registers in its class and sleeps until no packet of a higher class is being sent or waiting to be sent.
+        Packets of the same class are sent in the send lock's order */
+    struct PriorityScheduler
+    {
+  #if MQTTMultithread == 1
+        /** The number of packets being sent (or waiting to be) in each class */
+        uint32                  waiting[4];
+        /** Protect the counters above */
+        std::mutex              lock;
+        /** Signaled when the last packet of a class is sent */
+        std::condition_variable sent;
+
+        bool higherWaiting(const uint8 priority) const
+        {
+            for (uint8 i = 0; i < priority; i++)
+                if (waiting[i]) return true;
+            return false;
+        }
+        void enter(const uint8 priority)
+        {
+            std::unique_lock<std::mutex> scope(lock);
+            waiting[priority]++;
+            while (higherWaiting(priority)) sent.wait(scope);
+        }
+        void leave(const uint8 priority)
+        {
+            std::unique_lock<std::mutex> scope(lock);
+            // The lower classes only need to be woken up when the last packet of this class is sent
+            if (--waiting[priority] || priority == 3) return;
+            scope.unlock();
+            sent.notify_all();
+        }
+
+        PriorityScheduler() { memset(waiting, 0, sizeof(waiting)); }
+  #else
+        // Only one thread is sending, there's nothing to order
+        inline void enter(const uint8) {}
+        inline void leave(const uint8) {}
+  #endif
+    };
+    /** Register a packet in its priority class while it's being sent */
+    struct PriorityGate
+    {
+        PriorityScheduler & scheduler;
+        /** This packet's class */
+        uint8 priority;
+
+        PriorityGate(PriorityScheduler & scheduler, const uint8 priority) : scheduler(scheduler), priority(priority) { scheduler.enter(priority); }
+        ~PriorityGate() { scheduler.leave(priority); }
+    };
+#endif
+
 #if MQTTMultithread == 1
 #if __cplusplus < 201703L
     struct SharedMutex
@@ -428,7 +763,7 @@ namespace Network { namespace Client {
                 }
 
             } while (!refcount.compare_exchange_weak(val, val+1, std::memory_order_acquire));
-            return false;
+            return true;
         }
 
         void releaseShared()
@@ -449,6 +784,22 @@ namespace Network { namespace Client {
 #endif
 #endif
 
+#if MQTTQoSSupportLevel == 1
+    /** Append the parts for a range of a saved packet that's split in a head and a tail (@sa PacketStorage::loadPacketBuffer)
+        @return The new number of parts */
+    static int appendRange(struct iovec * parts, int count, const uint8 * head, const uint32 sizeH, const uint8 * tail, uint32 from, const uint32 to)
+    {
+        if (from < sizeH && from < to)
+        {
+            const uint32 end = min(to, sizeH);
+            parts[count++] = { const_cast<uint8*>(head + from), end - from };
+            from = end;
+        }
+        if (from < to) parts[count++] = { const_cast<uint8*>(tail + from - sizeH), to - from };
+        return count;
+    }
+#endif
+
     /** Common base interface that's common to all implementation using CRTP to avoid code duplication */
     template <typename Child>
     struct ImplBase
@@ -498,6 +849,7 @@ namespace Network { namespace Client {
             GotType,
             GotLength,
             GotCompletePacket,
+            ParkedPublish,      //!< A complete PUBLISH packet is waiting for a receive buffer to be released, @sa unparkPublish
         }                   recvState;
         /** The maximum packet size the server is willing to accept */
         uint32              maxPacketSize;
@@ -519,10 +871,384 @@ namespace Network { namespace Client {
         /** Is the client in error from a previous operation? */
         bool                errored;
 #endif
+#if MQTTUseReconnect == 1
+        /** The reconnection policy if any */
+        MQTTv5::ReconnectPolicy *   reconnectPolicy;
+        /** The stored connection parameters */
+        ConnectParams               connectParams;
+        /** The time when the connection was lost in milliseconds */
+        uint32                      lostTime;
+        /** The time for the next reconnection attempt in milliseconds */
+        uint32                      nextAttempt;
+        /** The number of failed attempts since the connection was lost */
+        uint32                      attempt;
+        /** The state of the pseudo random generator for the delays */
+        uint32                      seed;
+        /** Set once connected, cleared upon voluntary disconnection */
+        bool                        shouldReconnect;
+        /** Set while the connection is lost and not recovered yet */
+        bool                        recovering;
+        /** Set while reconnecting, so the parameters aren't stored again */
+        bool                        reconnecting;
+        /** Did the broker resume our session in the last CONNACK? */
+        bool                        sessionPresent;
+#endif
+#if MQTTRecvBufferPool > 1
+        /** The number of references on each receive buffer in the pool */
+        std::atomic<uint32> recvBufferRefs[MQTTRecvBufferPool];
+#endif
+#if MQTTAsyncSubscribe > 0
+        /** The asynchronous SUBSCRIBE / UNSUBSCRIBE packets in flight */
+        AsyncScribe         asyncScribes[MQTTAsyncSubscribe];
+#endif
+#if MQTTCoalesceACK > 0 && MQTTQoSSupportLevel != -1
+        /** The publish replies waiting to be sent, in the order they were generated */
+        uint8               pendingReplies[MQTTCoalesceACK * 8];
+        /** The used size in the pending replies buffer */
+        uint32              pendingRepliesSize;
+        /** The number of replies in the pending replies buffer */
+        uint32              pendingRepliesCount;
+#endif
+#if MQTTManualACK == 1 && MQTTQoSSupportLevel != -1 && MQTTMultithread == 1
+        /** Protect the received packets' identifiers in the in flight table, since they are acknowledged from any thread */
+        SharedMutex         ackLock;
+#endif
+#if MQTTOutboundQueue > 0
+        /** The outbound rate limits */
+        MQTTv5::RateLimit * rateLimits;
+        /** The number of rate limits */
+        uint8               rateLimitsCount;
+        /** The queued packets are over the high watermark */
+        bool                outAboveHigh;
+        /** The number of QoS packets in the outbound queue */
+        uint16              outQueuedQoS;
+        /** The broker's receive maximum */
+        uint16              brokerReceiveMax;
+        /** The outbound queue read and write positions and the used size (including the unused space at the end when wrapping) */
+        uint32              outHead, outTail, outUsed;
+        /** The outbound queue watermarks */
+        uint32              outLow, outHigh;
+  #if MQTTMultithread == 1
+        /** Protect the outbound queue and the rate limits against concurrent publishing */
+        SharedMutex         outLock;
+  #endif
+        /** The outbound queue */
+        uint8               outQueue[MQTTOutboundQueue];
+#endif
+#if MQTTPriorityScheduler > 0
+        /** Order the packets being sent by priority class */
+        PriorityScheduler   sendScheduler;
+#endif
+#if MQTTMessageExpiry == 1
+  #if MQTTQoSSupportLevel == 1
+        /** The expiry information of the saved publications (one slot per packet identifier) */
+        MessageExpiry *     expiries;
+  #endif
+        /** The number of expired publications that were dropped */
+        uint32              expiredMessages;
+#endif
+#if MQTTLatencyProbe == 1
+        /** The latency probe's state, @sa MQTTv5::startLatencyProbe */
+        struct LatencyProbe
+        {
+            /** The probe's topic */
+            Protocol::MQTT::V5::DynamicString   topic;
+            /** The results */
+            MQTTv5::ProbeStatistics             stats;
+            /** The period between two probes and the time for the next one, in milliseconds */
+            uint32                              periodMs, nextMs;
+            /** A random value identifying this probing session */
+            uint32                              generation;
+            /** The next sequence number to send and the highest received */
+            uint32                              sequence, highest;
+            /** The received probes below the highest (bit i is set if highest - i was received) */
+            uint64                              window;
+            /** Is the probe running? */
+            bool                                active;
+            /** Is the client still subscribed to the probe's topic? Its messages are filtered out until it's unsubscribed */
+            bool                                subscribed;
+
+            LatencyProbe() : stats(), periodMs(0), nextMs(0), generation(0), sequence(0), highest(0), window(0), active(false), subscribed(false) {}
+        } probe;
+
+        /** Publish the next probe if it's time to do so */
+        ErrorType sendProbe(MQTTv5 & client)
+        {
+            uint32 now = getTimeMs();
+            if (!probe.active || (int32)(now - probe.nextMs) < 0) return ErrorType::Success;
+            // Don't send a burst of probes if the event loop wasn't called for a while
+            probe.nextMs = (int32)(now - probe.nextMs) < (int32)probe.periodMs ? probe.nextMs + probe.periodMs : now + probe.periodMs;
+
+            uint8 payload[ProbePayloadSize];
+            const uint32 sentAt = getTimeUs();
+            memcpy(payload, &probe.generation, 4); memcpy(payload + 4, &probe.sequence, 4); memcpy(payload + 8, &sentAt, 4);
+            ErrorType ret = client.publish(probe.topic.data, payload, sizeof(payload), false, MQTTv5::QoSDelivery::AtMostOne);
+            // A throttled probe is simply skipped
+            if (ret == ErrorType::Throttled) return ErrorType::Success;
+            if (ret != ErrorType::Success) return ret;
+            probe.sequence++;
+            probe.stats.sent++;
+            return ErrorType::Success;
+        }
+
+        /** Account for a received message if it's on the probe's topic
+            @return true if the message is on the probe's topic (so it's not given to the application) */
+        bool probeReceived(const Protocol::MQTT::V5::PublishPacketView & packet)
+        {
+            if (!probe.subscribed || packet.topicName.length + 1 != probe.topic.length || memcmp(packet.topicName.data, probe.topic.data, packet.topicName.length))
+                return false;
+            // A stopped probe still swallows the messages on its topic (the late probes or while the subscription is kept)
+            if (!probe.active) return true;
+            const uint32 now = getTimeUs();
+            uint32 generation, sequence, sentAt;
+            if (packet.payload.length != ProbePayloadSize) return true;
+            memcpy(&generation, packet.payload.data, 4); memcpy(&sequence, packet.payload.data + 4, 4); memcpy(&sentAt, packet.payload.data + 8, 4);
+            if (generation != probe.generation) return true;
+
+            MQTTv5::ProbeStatistics & stats = probe.stats;
+            int32 ahead = (int32)(sequence - probe.highest);
+            if (ahead > 0)
+            {   // The probes in between are missing (for now)
+                stats.lost += (uint32)ahead - 1;
+                probe.window = ahead >= 64 ? 1 : (probe.window << ahead) | 1;
+                probe.highest = sequence;
+            } else
+            {
+                uint32 behind = (uint32)-ahead;
+                if (behind < 64)
+                {
+                    if (probe.window & ((uint64)1 << behind)) { stats.duplicated++; return true; }
+                    probe.window |= (uint64)1 << behind;
+                }
+                // It was counted as lost
+                stats.reordered++;
+                if (stats.lost) stats.lost--;
+            }
+            stats.received++;
+            stats.latency.record(now - sentAt);
+            return true;
+        }
+#endif
+#if MQTTStatistics == 1
+        /** The statistics counters, @sa MQTTv5::Statistics.
+            They are relaxed atomics since packets can be sent from any thread and the snapshot can be taken from any thread */
+        struct Counters
+        {
+            std::atomic<uint32> packetsSent[16];
+            std::atomic<uint32> packetsReceived[16];
+            std::atomic<uint64> bytesSent;
+            std::atomic<uint64> bytesReceived;
+            std::atomic<uint32> sendCalls;
+            std::atomic<uint32> recvCalls;
+            std::atomic<uint32> partialReads;
+            std::atomic<uint32> timeouts;
+            std::atomic<uint32> networkErrors;
+            std::atomic<uint32> connectionsLost;
+            std::atomic<uint32> reconnections;
+
+            Counters()
+            {
+                for (uint8 i = 0; i < 16; i++) { packetsSent[i].store(0, std::memory_order_relaxed); packetsReceived[i].store(0, std::memory_order_relaxed); }
+                bytesSent.store(0, std::memory_order_relaxed); bytesReceived.store(0, std::memory_order_relaxed);
+                sendCalls.store(0, std::memory_order_relaxed); recvCalls.store(0, std::memory_order_relaxed); partialReads.store(0, std::memory_order_relaxed);
+                timeouts.store(0, std::memory_order_relaxed); networkErrors.store(0, std::memory_order_relaxed);
+                connectionsLost.store(0, std::memory_order_relaxed); reconnections.store(0, std::memory_order_relaxed);
+            }
+        } stats;
+
+        /** Count the control packets in the given sent buffer (many acknowledgements can be sent at once) */
+        void countSentPackets(const uint8 * buffer, const uint32 length)
+        {
+            uint32 pos = 0;
+            while (pos < length)
+            {
+                MQTTCount(packetsSent[buffer[pos] >> 4], 1);
+                Protocol::MQTT::Common::VBInt len;
+                uint32 r = len.readFrom(&buffer[pos + 1], length - pos - 1);
+                if (Protocol::MQTT::Common::isError(r)) return;
+                // The first part of a vectored packet doesn't contain the payload, so this ends the loop
+                pos += 1 + r + (uint32)len;
+            }
+        }
+#endif
+
+#if MQTTPacketCapture > 0
+        /** The packet capture ring, @sa MQTTv5::startCapture.
+            The ring is split in fixed size slots. A writer claims the next slot with an atomic increment (overwriting the oldest one)
+            and publishes it by storing its capture index once the packet is copied, so the reader can skip the slots that are being
+            written while it reads them (like a seqlock) */
+        struct PacketCapture
+        {
+            /** The header of each slot, followed by the captured bytes */
+            struct Slot
+            {
+                /** The capture index + 1 once the slot is written, 0 while it's being written */
+                std::atomic<uint32> sequence;
+                /** The packet's length and the number of bytes captured */
+                uint32              length, captured;
+                /** The time the packet was sent or received (wall clock, as expected in a pcap file) */
+                uint32              seconds, micros;
+                /** Was the packet sent (else it was received) ? */
+                bool                sent;
+
+                uint8 * data() { return (uint8*)(this + 1); }
+                const uint8 * data() const { return (const uint8*)(this + 1); }
+            };
+
+            /** The preallocated ring */
+            uint8 *             ring;
+            /** The slot's size (header included), the number of slots and the maximum number of bytes captured per packet */
+            uint32              slotSize, slotCount, snapLength;
+            /** The next capture index */
+            std::atomic<uint32> next;
+            /** Is the capture running ? */
+            std::atomic<bool>   active;
+
+            Slot * slot(const uint32 index) const { return (Slot*)(ring + (index % slotCount) * slotSize); }
+
+            /** Split the ring in slots for the given snap length and start capturing */
+            bool start(const uint32 snap)
+            {
+                active.store(false, std::memory_order_relaxed);
+                if (!ring || !snap || snap > MQTTPacketCapture / 2) return false;
+                // Keep the slots aligned for their header
+                uint32 size = (uint32)(sizeof(Slot) + snap + 7) & ~7;
+                if (MQTTPacketCapture / size < 2) return false;
+                slotSize = size; slotCount = MQTTPacketCapture / size; snapLength = snap;
+                for (uint32 i = 0; i < slotCount; i++) new (ring + i * slotSize) Slot();
+                next.store(0, std::memory_order_relaxed);
+                active.store(true, std::memory_order_release);
+                return true;
+            }
+
+            /** Claim a slot for a packet of the given length (the caller must check the capture is active first) */
+            Slot * begin(const bool sent, const uint32 length, uint32 & index)
+            {
+                index = next.fetch_add(1, std::memory_order_relaxed);
+                Slot * s = slot(index);
+                s->sequence.store(0, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                struct timeval tv;
+                gettimeofday(&tv, NULL);
+                s->seconds = (uint32)tv.tv_sec; s->micros = (uint32)tv.tv_usec;
+                s->length = length; s->captured = 0; s->sent = sent;
+                return s;
+            }
+            /** Copy the next part of the packet in the slot, up to the snap length */
+            void append(Slot * s, const uint8 * data, const uint32 length)
+            {
+                uint32 size = min(length, snapLength - s->captured);
+                memcpy(s->data() + s->captured, data, size);
+                s->captured += size;
+            }
+            /** Publish the slot to the reader */
+            void commit(Slot * s, const uint32 index) { s->sequence.store(index + 1, std::memory_order_release); }
+
+            /** Record a packet if capturing, this is the only cost when the capture is stopped */
+            inline void record(const bool sent, const uint8 * data, const uint32 length)
+            {
+                if (!active.load(std::memory_order_relaxed)) return;
+                uint32 index;
+                Slot * s = begin(sent, length, index);
+                append(s, data, length);
+                commit(s, index);
+            }
+
+            /** Store a 16 or 32 bits value in network order */
+            static void writeBE(uint8 * p, const uint16 v) { p[0] = (uint8)(v >> 8); p[1] = (uint8)v; }
+            static void writeBE(uint8 * p, const uint32 v) { writeBE(p, (uint16)(v >> 16)); writeBE(p + 2, (uint16)v); }
+
+            /** Build the pcap record's header and the synthesized IPv4 and TCP headers for a packet */
+            static void buildFrame(uint8 * frame, const Slot & s, const uint32 captured, const uint32 seq, const uint32 ack)
+            {
+                // pcap record header (in host order, like the file's header)
+                uint32 record[4] = { s.seconds, s.micros, captured + 40, s.length + 40 };
+                memcpy(frame, record, sizeof(record));
+                uint8 * ip = frame + 16, * tcp = ip + 20;
+                // IPv4 header, from 10.0.0.1 (the client) to 10.0.0.2 (the broker) or the opposite
+                memset(ip, 0, 40);
+                ip[0] = 0x45; ip[6] = 0x40; ip[8] = 64; ip[9] = 6;
+                writeBE(ip + 2, (uint16)min(s.length + 40, (uint32)65535));
+                writeBE(ip + 12, (uint32)(s.sent ? 0x0A000001 : 0x0A000002));
+                writeBE(ip + 16, (uint32)(s.sent ? 0x0A000002 : 0x0A000001));
+                uint32 sum = 0;
+                for (uint8 i = 0; i < 20; i += 2) sum += (uint32)(ip[i] << 8) | ip[i+1];
+                while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+                writeBE(ip + 10, (uint16)~sum);
+                // TCP header, with PSH and ACK, the checksum is left to 0 (Wireshark doesn't check it by default)
+                writeBE(tcp, (uint16)(s.sent ? CaptureClientPort : CaptureBrokerPort));
+                writeBE(tcp + 2, (uint16)(s.sent ? CaptureBrokerPort : CaptureClientPort));
+                writeBE(tcp + 4, seq);
+                writeBE(tcp + 8, ack);
+                tcp[12] = 5 << 4; tcp[13] = 0x18;
+                writeBE(tcp + 14, (uint16)65535);
+            }
+
+            /** Save the captured packets in a pcap file */
+            bool save(const char * path) const
+            {
+                if (!ring || !slotCount) return false;
+                FILE * f = fopen(path, "wb");
+                if (!f) return false;
+                // The pcap file header (in host order, the magic tells the order): version 2.4, timezone, accuracy, snap length and link type (raw IP)
+                struct { uint32 magic; uint16 major, minor; uint32 zone, accuracy, snap, link; } header = { 0xA1B2C3D4, 2, 4, 0, 0, snapLength + 40, 101 };
+                bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+                uint8 * frame = (uint8*)::malloc(CaptureFrameHeaderSize + snapLength);
+                if (!frame) { fclose(f); return false; }
+                // The next TCP sequence number for each direction, they follow the packets' length so Wireshark can reassemble them
+                uint32 seqs[2] = { 1, 1 };
+                uint32 last = next.load(std::memory_order_acquire), first = last > slotCount ? last - slotCount : 0;
+                for (uint32 i = first; ok && i != last; i++)
+                {
+                    const Slot * s = slot(i);
+                    if (s->sequence.load(std::memory_order_acquire) != i + 1) continue;
+                    Slot copy;
+                    copy.length = s->length; copy.seconds = s->seconds; copy.micros = s->micros; copy.sent = s->sent;
+                    uint32 captured = min(s->captured, snapLength);
+                    memcpy(frame + CaptureFrameHeaderSize, s->data(), captured);
+                    // If the slot was overwritten while copying it, skip it
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (s->sequence.load(std::memory_order_relaxed) != i + 1) continue;
+
+                    uint32 & seq = seqs[copy.sent ? 0 : 1];
+                    buildFrame(frame, copy, captured, seq, seqs[copy.sent ? 1 : 0]);
+                    seq += copy.length;
+                    ok = fwrite(frame, CaptureFrameHeaderSize + captured, 1, f) == 1;
+                }
+                ::free(frame);
+                return fclose(f) == 0 && ok;
+            }
+
+            PacketCapture() : ring((uint8*)::calloc(1, MQTTPacketCapture)), slotSize(0), slotCount(0), snapLength(0), next(0), active(false) {}
+            ~PacketCapture() { ::free(ring); }
+        } capture;
+#endif
+
+#if MQTTTLSCoalesceWrites > 0
+        /** Pack the packets sent in this scope in as few TLS records as possible, @sa MQTTv5::beginBatch */
+        struct Batch
+        {
+            Child & impl;
+            bool    ended;
+
+            /** End the batch now, @return A negative value if the pending data can't be sent */
+            int end() { ended = true; return impl.cork(false); }
+
+            Batch(Child & impl) : impl(impl), ended(false) { impl.cork(true); }
+            ~Batch() { if (!ended) impl.cork(false); }
+        };
+#endif
 
         uint16 allocatePacketID()
         {
+#if MQTTCoroutines == 1
+            // The upper half of the range is reserved for the coroutine layer, @sa CoClient::allocateID
+            publishCurrentId = publishCurrentId >= 0x7FFF ? 1 : publishCurrentId + 1;
+            return publishCurrentId;
+#else
             return ++publishCurrentId;
+#endif
         }
 
         ImplBase(const char * clientID, MessageReceived * callback, PacketStorage * storage, const Protocol::MQTT::Common::DynamicBinDataView * brokerCert,
@@ -537,12 +1263,35 @@ namespace Network { namespace Client {
 #endif
                recvState(Ready), maxPacketSize(65535), available(0), buffers(max(callback->maxPacketSize(), (uint32)8UL), min(callback->maxUnACKedPackets(), (uint32)127UL)),
                packetExpectedVBSize(Protocol::MQTT::Common::VBInt(max(callback->maxPacketSize(), (uint32)8UL)).getSize()), state(State::Unknown), errored(true)
+#if MQTTUseReconnect == 1
+               , reconnectPolicy(0), lostTime(0), nextAttempt(0), attempt(0), seed(getTimeMs() ^ (uint32)(size_t)this), shouldReconnect(false),
+               recovering(false), reconnecting(false), sessionPresent(false)
+#endif
+#if MQTTCoalesceACK > 0 && MQTTQoSSupportLevel != -1
+               , pendingRepliesSize(0), pendingRepliesCount(0)
+#endif
+#if MQTTOutboundQueue > 0
+               , rateLimits(0), rateLimitsCount(0), outAboveHigh(false), outQueuedQoS(0), brokerReceiveMax(65535), outHead(0), outTail(0), outUsed(0),
+               outLow(MQTTOutboundQueue / 4), outHigh(MQTTOutboundQueue * 3 / 4)
+#endif
         {
 #if MQTTQoSSupportLevel == 1
             if (!storage) this->storage = new RingBufferStorage(buffers.size, buffers.packetsCount() * 2);
 #else
             (void)storage; // Prevent variable unused warning
 #endif
+#if MQTTRecvBufferPool > 1
+            for (uint8 i = 0; i < MQTTRecvBufferPool; i++) recvBufferRefs[i].store(0, std::memory_order_relaxed);
+#endif
+#if MQTTAsyncSubscribe > 0
+            memset(asyncScribes, 0, sizeof(asyncScribes));
+#endif
+#if MQTTMessageExpiry == 1
+  #if MQTTQoSSupportLevel == 1
+            expiries = (MessageExpiry*)::calloc(buffers.end(), sizeof(*expiries));
+  #endif
+            expiredMessages = 0;
+#endif
 #if MQTTMultithread == 1
             usage.acquireExclusive();
 #endif
@@ -551,6 +1300,9 @@ namespace Network { namespace Client {
         ~ImplBase() {
 #if MQTTQoSSupportLevel == 1
             delete0(storage);
+  #if MQTTMessageExpiry == 1
+            ::free(expiries);
+  #endif
 #endif
 #if MQTTMultithread == 1
             if (errored) usage.releaseExclusive();
@@ -609,11 +1361,75 @@ namespace Network { namespace Client {
 
 
 
+#if MQTTRecvBufferPool > 1
+        /** Make sure the current receive buffer isn't retained by the application, else switch to a free one.
+            If all the buffers are retained, the control buffer (that's never given to the application) is used instead,
+            so the other control packets (like PINGRESP or acknowledgements) are still received */
+        void rotateRecvBuffer()
+        {
+            if (buffers.current < MQTTRecvBufferPool && recvBufferRefs[buffers.current].load(std::memory_order_acquire) == 0) return;
+            for (uint8 i = 0; i < MQTTRecvBufferPool; i++)
+                if (recvBufferRefs[i].load(std::memory_order_acquire) == 0) { buffers.current = i; return; }
+            buffers.current = MQTTRecvBufferPool;
+        }
+        /** Move a PUBLISH packet received in the control buffer to a released buffer, since the application can retain it
+            @return false if all the buffers are still retained (the packet stays parked and the socket isn't read anymore) */
+        bool unparkPublish()
+        {
+            for (uint8 i = 0; i < MQTTRecvBufferPool; i++)
+                if (recvBufferRefs[i].load(std::memory_order_acquire) == 0)
+                {
+                    const uint8 * packet = buffers.recvBuffer();
+                    buffers.current = i;
+                    memcpy(buffers.recvBuffer(), packet, available);
+                    return true;
+                }
+            return false;
+        }
+        inline bool isPublishParked() const { return recvState == ParkedPublish; }
+        /** Call the user callback for the received message */
+        inline void notifyMessage(Protocol::MQTT::V5::PublishPacketView & packet)
+        {
+  #if MQTTLatencyProbe == 1
+            if (probeReceived(packet)) return;
+  #endif
+            MessageHandle handle(packet.topicName, packet.payload, packet.packetID, packet.props, &recvBufferRefs[buffers.current]);
+            cb->messageReceivedWithHandle(handle);
+        }
+#else
+        inline void rotateRecvBuffer() {}
+        inline bool isPublishParked() const { return false; }
+        /** Call the user callback for the received message */
+        inline void notifyMessage(Protocol::MQTT::V5::PublishPacketView & packet)
+        {
+  #if MQTTLatencyProbe == 1
+            if (probeReceived(packet)) return;
+  #endif
+            cb->messageReceived(packet.topicName, packet.payload, packet.packetID, packet.props);
+        }
+#endif
+
+        /** Receive a part of a control packet from the transport (and count it in the statistics) */
+        template <typename TimeOut>
+        inline int recvPart(uint8 * buffer, const uint32 length, TimeOut & timeout)
+        {
+            int ret = that()->recv((char*)buffer, length, timeout);
+#if MQTTStatistics == 1
+            MQTTCount(recvCalls, 1);
+            if (ret > 0) MQTTCount(bytesReceived, (uint64)ret);
+            if (timeout == 0) MQTTCount(timeouts, 1);
+            else if (ret <= 0) MQTTCount(networkErrors, 1);
+            else if ((uint32)ret < length) MQTTCount(partialReads, 1);
+#endif
+            return ret;
+        }
+
         /** Receive a control packet from the socket in the given time.
             @retval positive    The number of bytes received
             @retval 0           Protocol error, you should close the socket
             @retval -1          Socket error
-            @retval -2          Timeout */
+            @retval -2          Timeout
+            @retval -5          The packet is larger than the receive buffer (protocol error), you should close the socket */
         int receiveControlPacket(const bool lowLatency = false)
         {
             if (!that()->socket) return -1;
@@ -631,6 +1447,20 @@ namespace Network { namespace Client {
             int ret = 0;
             Protocol::MQTT::Common::VBInt len;
 
+            // Don't overwrite a message the application is still using
+            if (recvState == Ready && !available) rotateRecvBuffer();
+#if MQTTTLSCoalesceWrites > 0
+            // Don't wait for an answer to a packet that's still held in the write buffer
+            if (that()->flushPending() < 0) return -1;
+#endif
+#if MQTTRecvBufferPool > 1
+            if (recvState == ParkedPublish)
+            {
+                if (!unparkPublish()) return -2;
+                recvState = GotCompletePacket;
+                return (int)available;
+            }
+#endif
 #if MQTTLowLatency == 1
             // In low latency mode, return as early as possible
             if (lowLatency && !that()->socket->select(true, false, 0)) return -2;
@@ -645,7 +1475,7 @@ namespace Network { namespace Client {
             {   // Here, make sure we only fetch the length first
                 // The minimal size is 2 bytes for PINGRESP, DISCONNECT and AUTH.
                 // Because of this, we can't really outsmart the system everytime
-                ret = that()->recv((char*)&buffers.recvBuffer()[available], 2 - available, timeout);
+                ret = recvPart(&buffers.recvBuffer()[available], 2 - available, timeout);
                 if (ret > 0) available += ret;
                 // Deal with timeout first
                 if (timeout == 0) return -2;
@@ -657,7 +1487,7 @@ namespace Network { namespace Client {
                 if (buffers.recvBuffer()[0] < 0xD0 || buffers.recvBuffer()[1]) // Below ping response or packet size larger than 2 bytes
                 {
                     int querySize = (packetExpectedVBSize + 1) - available;
-                    ret = that()->recv((char*)&buffers.recvBuffer()[available], querySize, timeout);
+                    ret = recvPart(&buffers.recvBuffer()[available], querySize, timeout);
                     if (ret > 0) available += ret;
                     // Deal with timeout first
                     if (timeout == 0) return -2;
@@ -687,7 +1517,9 @@ namespace Network { namespace Client {
             }
             uint32 remainingLength = len;
             uint32 totalPacketSize = remainingLength + 1 + len.getSize();
-            ret = totalPacketSize == available ? 0 : that()->recv((char*)&buffers.recvBuffer()[available], (totalPacketSize - available), timeout);
+            // The length's encoding only bounds the size to the next power of 128, so check it fits the buffer (it's a protocol error else)
+            if (totalPacketSize > buffers.size) return -5;
+            ret = totalPacketSize == available ? 0 : recvPart(&buffers.recvBuffer()[available], (totalPacketSize - available), timeout);
             if (ret > 0) available += ret;
             if (timeout == 0) return -2;
             if (ret < 0) return ret;
@@ -696,8 +1528,20 @@ namespace Network { namespace Client {
             if (available == totalPacketSize)
             {
                 recvState = GotCompletePacket;
+                MQTTCount(packetsReceived[buffers.recvBuffer()[0] >> 4], 1);
 #if MQTTDumpCommunication == 1
                 dumpBufferAsPacket("< Received packet", buffers.recvBuffer(), available);
+#endif
+#if MQTTPacketCapture > 0
+                capture.record(false, buffers.recvBuffer(), available);
+#endif
+#if MQTTRecvBufferPool > 1
+                // The application could retain this message, so it must not stay in the control buffer
+                if (buffers.current == MQTTRecvBufferPool && (buffers.recvBuffer()[0] >> 4) == Protocol::MQTT::V5::PUBLISH && !unparkPublish())
+                {
+                    recvState = ParkedPublish;
+                    return -2;
+                }
 #endif
                 return (int)available;
             }
@@ -705,6 +1549,14 @@ namespace Network { namespace Client {
             return -2;
         }
 
+        /** Convert the error returned by receiveControlPacket, and close the socket if it's required */
+        ErrorType receiveError(const int ret)
+        {
+            if (ret == 0 || ret == -5) close();
+            if (ret == -5) return ReasonCodes::ProtocolError;
+            return ret == -2 ? ErrorType::TimedOut : ErrorType::NetworkError;
+        }
+
         /** Get the last received packet type */
         Protocol::MQTT::V5::ControlPacketType getLastPacketType() const
         {
@@ -714,8 +1566,9 @@ namespace Network { namespace Client {
             return (Protocol::MQTT::V5::ControlPacketType)(uint8)header.type;
         }
 
-        /** Extract a control packet of the given type */
-        int extractControlPacket(const Protocol::MQTT::V5::ControlPacketType type, Protocol::MQTT::Common::Serializable & packet)
+        /** Make sure a complete packet of the given type is received
+            @return 1 upon success, or the error to return from extractControlPacket */
+        int completeControlPacket(const Protocol::MQTT::V5::ControlPacketType type)
         {
             if (recvState != GotCompletePacket)
             {
@@ -728,6 +1581,14 @@ namespace Network { namespace Client {
 
             // Check the packet is the last expected type
             if (getLastPacketType() != type) return -3;
+            return 1;
+        }
+
+        /** Extract a control packet of the given type */
+        int extractControlPacket(const Protocol::MQTT::V5::ControlPacketType type, Protocol::MQTT::Common::Serializable & packet)
+        {
+            int ret = completeControlPacket(type);
+            if (ret <= 0) return ret;
 
             // Seems to be the expected type, let's unserialize it
             uint32 r = packet.readFrom(buffers.recvBuffer(), buffers.size);
@@ -739,6 +1600,21 @@ namespace Network { namespace Client {
             return (int)r;
         }
 
+        /** Same as above, but using the specialized PUBLISH decoder that's avoiding the generic (virtual) parsing code */
+        int extractControlPacket(Protocol::MQTT::V5::PublishPacketView & packet)
+        {
+            int ret = completeControlPacket(Protocol::MQTT::V5::PUBLISH);
+            if (ret <= 0) return ret;
+
+            uint32 r = packet.readFrom(buffers.recvBuffer(), buffers.size);
+            if (Protocol::MQTT::Common::isError(r)) return -4; // Parsing error
+
+            // Done with receiving the packet let's remember it
+            resetPacketReceivingState();
+
+            return (int)r;
+        }
+
         void resetPacketReceivingState() { recvState = Ready; available = 0; }
         inline Child * that() { return static_cast<Child*>(this); }
         inline const Child * that() const { return static_cast<const Child*>(this); }
@@ -746,47 +1622,288 @@ namespace Network { namespace Client {
 
         void close(const Protocol::MQTT::V5::ReasonCodes code = Protocol::MQTT::V5::ReasonCodes::UnspecifiedError, const Protocol::MQTT::V5::PropertiesView * properties = nullptr)
         {
+#if MQTTStatistics == 1
+            if (that()->socket) MQTTCount(connectionsLost, 1);
+#endif
             delete0(that()->socket);
+#if MQTTRecvBufferPool > 1
+            // A parked message is lost, the broker will resend it upon reconnection if it's a QoS message
+            if (isPublishParked()) resetPacketReceivingState();
+#endif
+#if MQTTCoalesceACK > 0 && MQTTQoSSupportLevel != -1
+            // Replies can't be sent anymore, the broker will resend its packets upon reconnection
+            pendingRepliesSize = 0; pendingRepliesCount = 0;
+#endif
+#if MQTTAsyncSubscribe > 0
+            // Pending requests will never be acknowledged now
+            for (uint8 i = 0; i < MQTTAsyncSubscribe; i++)
+            {
+                AsyncScribe & req = asyncScribes[i];
+                if (!req.packetID) continue;
+                req.packetID = 0;
+                cb->scribeCompleted(req.requestID, req.unsubscribe, req.firstTopic, nullptr, req.count);
+            }
+#endif
+#if MQTTOutboundQueue > 0
+            // The queued QoS packets are saved, so they'll be retransmitted upon reconnection. The others are lost
+            clearOutbound();
+#endif
+#if MQTTPublishCompletion == 1 && MQTTQoSSupportLevel == 0
+            // The publications aren't saved so they can't be retransmitted, they are given up
+            for (uint8 i = 0; i < buffers.end(); i++)
+            {
+                uint32 packetID = buffers.packetID(i);
+                if (buffers.isSending(packetID)) completePublish((uint16)packetID, code);
+            }
+#endif
+#if MQTTUseReconnect == 1
+            if (shouldReconnect && !recovering)
+            {   // Schedule the first attempt
+                recovering = true;
+                attempt = 0;
+                lostTime = getTimeMs();
+                nextAttempt = reconnectPolicy ? lostTime + reconnectPolicy->nextDelay(attempt, random()) : lostTime;
+            }
+#endif
             cb->connectionLost(code, properties);
             state = State::Unknown;
         }
 
-        bool isOpen()
+#if MQTTUseReconnect == 1
+        /** A xorshift pseudo random generator, that's enough to spread the reconnection delays */
+        uint32 random()
         {
-            return that()->socket != nullptr;
+            seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+            return seed;
         }
 
-        int send(const char * buffer, const uint32 length)
+        /** Reconnect with the stored parameters if it's time to do so */
+        ErrorType tryReconnect(MQTTv5 & client)
         {
-            if (!that()->socket) return -1;
-            // Prevent mixing sending packet on the wire here, only one thread can send a complete packet at once.
-#if MQTTDumpCommunication == 1
-            dumpBufferAsPacket("> Sending packet", (const uint8*)buffer, length);
-#endif
+            if (!reconnectPolicy || !shouldReconnect || !connectParams.port) return ErrorType::NotConnected;
+            if ((int32)(getTimeMs() - nextAttempt) < 0) return ErrorType::NotConnected;
+
+            reconnecting = true;
+            DynamicBinDataView password(connectParams.password);
+            ErrorType ret = client.connectTo(connectParams.host.data, connectParams.port, connectParams.useTLS, connectParams.keepAlive, false,
+                                             connectParams.hasUserName ? connectParams.userName.data : nullptr,
+                                             connectParams.hasPassword ? &password : nullptr,
+                                             connectParams.willMessage, connectParams.willQoS, connectParams.willRetain, connectParams.properties);
+            reconnecting = false;
+
+            if (ret == ErrorType::Success && !sessionPresent)
+            {   // The broker doesn't know about us anymore, so we need to subscribe again
+                reconnectPolicy->sessionsLost++;
+                ret = reconnectPolicy->resubscribe(client);
+  #if MQTTLatencyProbe == 1
+                if (ret == ErrorType::Success && probe.active)
+                    ret = client.subscribe(probe.topic.data, MQTTv5::RetainHandling::NoRetainedMessage, true, MQTTv5::QoSDelivery::AtMostOne, false);
+  #endif
+                if (ret != ErrorType::Success && isOpen()) close();
+            }
+            if (ret != ErrorType::Success)
+            {
+                reconnectPolicy->failedAttempts++;
+                nextAttempt = getTimeMs() + reconnectPolicy->nextDelay(++attempt, random());
+                return ret;
+            }
+
+            // Done, let's update the statistics
+            MQTTCount(reconnections, 1);
+            recovering = false;
+            uint32 elapsed = getTimeMs() - lostTime;
+            reconnectPolicy->reconnections++;
+            reconnectPolicy->lastRecoveryTimeMs = elapsed;
+            if (elapsed > reconnectPolicy->maxRecoveryTimeMs) reconnectPolicy->maxRecoveryTimeMs = elapsed;
+            return ErrorType::Success;
+        }
+#endif
+
+        bool isOpen()
+        {
+            return that()->socket != nullptr;
+        }
+
+        int send(const char * buffer, const uint32 length, const uint8 priority = 0)
+        {
+            if (!that()->socket) return -1;
+#if MQTTPriorityScheduler > 0
+            PriorityGate gate(sendScheduler, priority);
+#else
+            (void)priority; // Prevent variable unused warning
+#endif
+            // Prevent mixing sending packet on the wire here, only one thread can send a complete packet at once.
+#if MQTTDumpCommunication == 1
+            dumpBufferAsPacket("> Sending packet", (const uint8*)buffer, length);
+#endif
+#if MQTTPacketCapture > 0
+            capture.record(true, (const uint8*)buffer, length);
+#endif
+#if MQTTStatistics == 1
+            int ret = that()->sendImpl(buffer, length);
+            countSent((const uint8*)buffer, length, ret);
+            return ret;
+#else
             return that()->sendImpl(buffer, length);
+#endif
+        }
+#if MQTTStatistics == 1
+        /** Update the statistics after sending a packet (the given buffer is the beginning of the packet) */
+        void countSent(const uint8 * buffer, const uint32 length, const int ret)
+        {
+            MQTTCount(sendCalls, 1);
+            if (ret <= 0) { MQTTCount(networkErrors, 1); return; }
+            MQTTCount(bytesSent, (uint64)ret);
+            countSentPackets(buffer, length);
+        }
+#endif
+
+#if MQTTVectoredSend == 1
+        int sendv(const struct iovec * parts, const int count, const uint8 priority = 0)
+        {
+            if (!that()->socket) return -1;
+  #if MQTTPriorityScheduler > 0
+            PriorityGate gate(sendScheduler, priority);
+  #else
+            (void)priority; // Prevent variable unused warning
+  #endif
+  #if MQTTDumpCommunication == 1
+            dumpBufferAsPacket("> Sending packet", (const uint8*)parts[0].iov_base, (uint32)parts[0].iov_len);
+  #endif
+  #if MQTTPacketCapture > 0
+            if (capture.active.load(std::memory_order_relaxed))
+            {
+                uint32 length = 0, index = 0;
+                for (int i = 0; i < count; i++) length += (uint32)parts[i].iov_len;
+                typename PacketCapture::Slot * s = capture.begin(true, length, index);
+                for (int i = 0; i < count; i++) capture.append(s, (const uint8*)parts[i].iov_base, (uint32)parts[i].iov_len);
+                capture.commit(s, index);
+            }
+  #endif
+  #if MQTTStatistics == 1
+            int ret = that()->sendvImpl(parts, count);
+            countSent((const uint8*)parts[0].iov_base, (uint32)parts[0].iov_len, ret);
+            return ret;
+  #else
+            return that()->sendvImpl(parts, count);
+  #endif
         }
 
-        ErrorType sendAndReceive(const void * buffer, const uint32 packetSize, bool withAnswer)
+        /** Same as below, but for a packet made of multiple parts that are sent in a single call */
+        ErrorType sendAndReceive(const struct iovec * parts, const int count, bool withAnswer, const uint8 priority = 0)
+        {
+            uint32 packetSize = 0;
+            for (int i = 0; i < count; i++) packetSize += (uint32)parts[i].iov_len;
+            if (sendv(parts, count, priority) != (int)packetSize)
+                return ErrorType::NetworkError;
+            return receiveAnswer(withAnswer);
+        }
+#endif
+
+        /** Send a packet and wait for the answer if required
+            @param priority     The packet's priority class (only used with MQTTPriorityScheduler, 0 is for the client's control packets) */
+        ErrorType sendAndReceive(const void * buffer, const uint32 packetSize, bool withAnswer, const uint8 priority = 0)
         {
-            if (send((const char*)buffer, packetSize) != packetSize)
+            if (send((const char*)buffer, packetSize, priority) != (int)packetSize)
                 return ErrorType::NetworkError;
+            return receiveAnswer(withAnswer);
+        }
 
+#if MQTTMessageExpiry == 1 && MQTTQoSSupportLevel == 1
+        /** Remember when a saved publication expires (if it has a Message Expiry Interval property) */
+        void saveExpiry(const uint16 packetID, const uint8 * packet, const uint32 size)
+        {
+            uint32 interval = 0, offset = findMessageExpiry(packet, size, interval);
+            if (!offset) return;
+            for (uint8 i = 0; i < buffers.end(); i++)
+            {
+                if (expiries[i].packetID) continue;
+                expiries[i].packetID = packetID;
+                expiries[i].offset = offset;
+                expiries[i].savedAt = (uint32)time(NULL);
+                expiries[i].interval = interval;
+                return;
+            }
+        }
+        /** Find the expiry information for a saved publication */
+        MessageExpiry * findExpiry(const uint16 packetID)
+        {
+            for (uint8 i = 0; i < buffers.end(); i++)
+                if (expiries[i].packetID == packetID) return &expiries[i];
+            return 0;
+        }
+        /** Forget the expiry information for a publication that's not saved anymore */
+        void releaseExpiry(const uint16 packetID) { if (MessageExpiry * e = findExpiry(packetID)) e->packetID = 0; }
+#endif
+#if MQTTMessageExpiry == 1
+        /** Count an expired publication that's dropped, and forget it if it was saved for retransmission */
+        void dropExpired(const uint16 packetID)
+        {
+            expiredMessages++;
+            if (!packetID) return;
+  #if MQTTQoSSupportLevel == 1
+            storage->releasePacketBuffer(packetID);
+            releaseExpiry(packetID);
+  #endif
+  #if MQTTPublishCompletion == 1 && MQTTQoSSupportLevel != -1
+            completePublish(packetID, ReasonCodes::UnspecifiedError);
+  #elif MQTTQoSSupportLevel != -1
+            buffers.releaseID(packetID);
+  #endif
+        }
+#endif
+
+#if MQTTQoSSupportLevel != -1
+        /** Save a serialized QoS publish packet (and its identifier) so it can be retransmitted until it's acknowledged */
+        ErrorType savePublish(const uint8 QoS, const uint16 packetID, const uint8 * buffer, const uint32 packetSize)
+        {
+            if (!QoS) return ErrorType::Success;
+            // Save packet ID first, so a full table doesn't leave a stored packet behind
+            if ((QoS == 1 && !buffers.storeQoS1ID(packetID)) || (QoS == 2 && !buffers.storeQoS2ID(packetID)))
+                return ErrorType::StorageError;
+  #if MQTTQoSSupportLevel == 1
+            // Save packet
+            if (!storage->savePacketBuffer(packetID, buffer, packetSize))
+            {
+                buffers.releaseID(packetID);
+                return ErrorType::StorageError;
+            }
+    #if MQTTMessageExpiry == 1
+            saveExpiry(packetID, buffer, packetSize);
+    #endif
+  #endif
+  #if MQTTPublishCompletion == 1
+            buffers.stampID(packetID, getTimeUs());
+  #endif
+            return ErrorType::Success;
+        }
+#endif
+#if MQTTPublishCompletion == 1 && MQTTQoSSupportLevel != -1
+        /** End a publication's cycle: forget its packet ID and tell the application */
+        bool completePublish(const uint16 packetID, const ReasonCodes reasonCode)
+        {
+            const uint32 latency = getTimeUs() - buffers.stampOf(packetID);
+            if (!buffers.releaseID(packetID)) return false;
+            cb->publishCompleted(packetID, reasonCode, latency);
+            return true;
+        }
+#endif
+
+        /** Update the communication time and wait for the answer if required */
+        ErrorType receiveAnswer(bool withAnswer)
+        {
             lastCommunication = (uint32)time(NULL);
             if (!withAnswer) return ErrorType::Success;
 
-            // Make sure we are on a clean receiving state
-            resetPacketReceivingState();
+            // Make sure we are on a clean receiving state (a parked message comes first, it isn't dropped)
+            if (!isPublishParked()) resetPacketReceivingState();
             // Next, we'll wait for server's CONNACK or AUTH coming here (or error)
             int receivedPacketSize = receiveControlPacket();
-            if (receivedPacketSize <= 0)
-            {   // This will also comes here
-                if (receivedPacketSize == 0) close();
-                return receivedPacketSize == -2 ? ErrorType::TimedOut : ErrorType::NetworkError;
-            }
+            if (receivedPacketSize <= 0) return receiveError(receivedPacketSize);
             return ErrorType::Success;
         }
 
-        ErrorType prepareSAR(Protocol::MQTT::V5::ControlPacketSerializable & packet, bool withAnswer = true, bool isPublish = false)
+        ErrorType prepareSAR(Protocol::MQTT::V5::ControlPacketSerializable & packet, bool withAnswer = true, bool isPublish = false, const uint8 priority = 0)
         {
             // Ok, setting are done, let's build this packet now
             uint32 packetSize = packet.computePacketSize();
@@ -799,19 +1916,9 @@ namespace Network { namespace Client {
             // Check for saving publish packet if required
             if (isPublish)
             {
-                Protocol::MQTT::V5::PublishPacket publish = (Protocol::MQTT::V5::PublishPacket&)packet;
-                uint8 QoS = publish.header.getQoS();
-                if (QoS > 0) {
-                    uint16 packetID = publish.fixedVariableHeader.packetID;
-  #if MQTTQoSSupportLevel == 1
-                    // Save packet
-                    if (!storage->savePacketBuffer(packetID, buffer, packetSize))
-                        return ErrorType::StorageError;
-  #endif
-                    // Save packet ID too
-                    if ((QoS == 1 && !buffers.storeQoS1ID(packetID)) || (QoS == 2 && !buffers.storeQoS2ID(packetID)))
-                        return ErrorType::StorageError;
-                }
+                Protocol::MQTT::V5::PublishPacket & publish = (Protocol::MQTT::V5::PublishPacket&)packet;
+                if (ErrorType err = savePublish(publish.header.getQoS(), publish.fixedVariableHeader.packetID, buffer, packetSize))
+                    return err;
             }
 #endif
 
@@ -820,11 +1927,493 @@ namespace Network { namespace Client {
     //      packet.dump(out, 2);
     //      printf("Prepared:\n%s\n", (const char*)out);
     #endif
-            return sendAndReceive(buffer, packetSize, withAnswer);
+            return sendAndReceive(buffer, packetSize, withAnswer, priority);
         }
 
+        /** Build a publish packet and send it (or queue it). This can be called from any thread
+            @param priority     The packet's priority class (only used with MQTTPriorityScheduler) */
+        ErrorType publish(const char * topic, const uint8 * payload, const uint32 payloadLength, const bool retain, const MQTTv5::QoSDelivery QoS, Properties * properties,
+                          const uint16 packetIdentifier = 0, const uint8 priority = 0)
+        {
+            if (topic == nullptr)
+                return ErrorType::BadParameter;
+
+            Protocol::MQTT::V5::PublishPacket packet;
+            // Capture properties (to avoid copying them)
+            packet.props.capture(properties);
+
+#if MQTTAvoidValidation != 1
+            if (!packet.props.checkPropertiesFor(Protocol::MQTT::V5::PUBLISH))
+                return ErrorType::BadProperties;
+#endif
+
+            // Create header now
+            packet.header.setRetain(retain);
+#if MQTTQoSSupportLevel == -1
+            const bool withAnswer = false;
+            packet.header.setQoS((uint8)MQTTv5::QoSDelivery::AtMostOne);
+#else
+            bool withAnswer = QoS != MQTTv5::QoSDelivery::AtMostOne;
+            packet.header.setQoS((uint8)QoS);
+#endif
+            packet.header.setDup(false); // At first, it's not a duplicate message
+            packet.fixedVariableHeader.topicName = topic;
+            packet.payload.setExpectedPacketSize(payloadLength);
+            packet.payload.readFrom(payload, payloadLength);
+
+            // Ok, shared code below
+            if (!acquire()) return ErrorType::NetworkError;
+            if (!isOpen()) return release(ErrorType::NotConnected);
+            if (state != State::Running) return release(ErrorType::TranscientPacket);
+
+            packet.fixedVariableHeader.packetID = withAnswer ? (packetIdentifier ? packetIdentifier : allocatePacketID()) : 0; // Only if QoS is not 0
+
+            // The publish cycle isn't run until the next event loop. This allow true asynchronous publishing
+#if MQTTOutboundQueue > 0
+            ErrorType err = queuePublish(packet, topic, priority);
+            // Throttling isn't a connection error and the packet identifier isn't used
+            if (err == ErrorType::Throttled || err == ErrorType::BadParameter) return release(err);
+#else
+            ErrorType err = prepareSAR(packet, false, true, priority);
+#endif
+            return release(err, err != ErrorType::Success); // Mark as error here
+        }
+
+#if MQTTZeroCopyPublish == 1
+        /** Send a publish packet whose payload is given by reference.
+            Only the header is serialized, the payload is never copied (unless the storage doesn't support it).
+            The payload is always released or owned by the storage when this returns */
+        ErrorType prepareZeroCopyPublish(Protocol::MQTT::V5::PublishPacket & packet, PayloadRef payload, const uint8 priority = 0)
+        {
+            packet.payload.data = payload.data;
+            packet.payload.size = payload.size;
+            uint32 packetSize = packet.computePacketSize();
+            // Serialize the header only, the remaining length is already computed with the payload
+            packet.payload.size = 0;
+            uint32 headerSize = packetSize - payload.size;
+            DeclareStackHeapBuffer(buffer, headerSize, StackSizeAllocationLimit);
+            if (packet.copyInto(buffer) != headerSize)
+            {
+                payload.release();
+                return ErrorType::UnknownError;
+            }
+
+  #if MQTTQoSSupportLevel != -1
+            uint8 QoS = packet.header.getQoS();
+            if (QoS > 0)
+            {
+                uint16 packetID = packet.fixedVariableHeader.packetID;
+                // Save packet ID first, so a full table doesn't leave a stored packet (and its payload reference) behind
+                if ((QoS == 1 && !buffers.storeQoS1ID(packetID)) || (QoS == 2 && !buffers.storeQoS2ID(packetID)))
+                {
+                    payload.release();
+                    return ErrorType::StorageError;
+                }
+    #if MQTTQoSSupportLevel == 1
+                // Let the storage own the payload if it can, else save the complete packet
+                if (storage->savePacketParts(packetID, buffer, headerSize, payload))
+                    payload = PayloadRef(payload.data, payload.size);
+                else
+                {
+                    DeclareStackHeapBuffer(full, packetSize, StackSizeAllocationLimit);
+                    memcpy(full, buffer, headerSize);
+                    memcpy((uint8*)full + headerSize, payload.data, payload.size);
+                    if (!storage->savePacketBuffer(packetID, full, packetSize))
+                    {
+                        buffers.releaseID(packetID);
+                        payload.release();
+                        return ErrorType::StorageError;
+                    }
+                }
+      #if MQTTMessageExpiry == 1
+                saveExpiry(packetID, buffer, packetSize);
+      #endif
+    #endif
+    #if MQTTPublishCompletion == 1
+                buffers.stampID(packetID, getTimeUs());
+    #endif
+            }
+  #endif
+
+            struct iovec parts[2] = { { (void*)buffer, headerSize }, { const_cast<uint8*>(payload.data), payload.size } };
+            ErrorType ret = sendAndReceive(parts, payload.size ? 2 : 1, false, priority);
+            // If the storage doesn't own the payload, it's not required anymore
+            payload.release();
+            return ret;
+        }
+#endif
+
+#if MQTTForwardPublish == 1
+        /** Republish a received message. Only the header is serialized, the received properties and payload are sent from the receive buffer.
+            This can be called from any thread
+            @param priority     The packet's priority class (only used with MQTTPriorityScheduler) */
+        ErrorType forward(const DynamicStringView & topic, const DynamicBinDataView & payload, const PropertiesView & received, Properties * edited,
+                          const bool retain, const MQTTv5::QoSDelivery QoS, const uint16 packetIdentifier = 0, const uint8 priority = 0)
+        {
+            if (!topic.length || !topic.data || (payload.length && !payload.data) || ((uint32)received.length && !received.buffer))
+                return ErrorType::BadParameter;
+#if MQTTAvoidValidation != 1
+            if (edited && !edited->checkPropertiesFor(Protocol::MQTT::V5::PUBLISH))
+                return ErrorType::BadProperties;
+#endif
+#if MQTTQoSSupportLevel == -1
+            const uint8 qos = (uint8)MQTTv5::QoSDelivery::AtMostOne;
+#else
+            const uint8 qos = (uint8)QoS;
+#endif
+            Protocol::MQTT::V5::ForwardedPublish packet;
+            if (!packet.prepare(topic, payload, received, edited, qos, retain)) return ErrorType::BadProperties;
+            if (!packet.fits()) return ErrorType::BadParameter;
+            const uint32 middleSize = packet.middleSize(), compactSize = max(packet.compactSize(), (uint32)1);
+            DeclareStackHeapBuffer(middle, middleSize, StackSizeAllocationLimit);
+            DeclareStackHeapBuffer(compact, compactSize, StackSizeAllocationLimit);
+
+            // Ok, shared code below
+            if (!acquire()) return ErrorType::NetworkError;
+            if (!isOpen()) return release(ErrorType::NotConnected);
+            if (state != State::Running) return release(ErrorType::TranscientPacket);
+
+#if MQTTOutboundQueue > 0
+            {   // The message isn't copied, so it can't be queued. It's only sent if the rate limits allow it and nothing is queued
+                uint32 waitMs = 0;
+                lockOutbound();
+                bool canSend = !outUsed && (!qos || canSendQoS()) && packet.packetSize <= maxPacketSize
+                            && takeTokens(matchLimits(topic.data, topic.length), packet.packetSize, waitMs);
+                unlockOutbound();
+                if (!canSend) return release(ErrorType::Throttled);
+            }
+#endif
+            const uint16 packetID = qos ? (packetIdentifier ? packetIdentifier : allocatePacketID()) : 0; // Only if QoS is not 0
+            const int count = packet.build(packetID, (uint8*)middle, (uint8*)compact);
+            struct iovec parts[Protocol::MQTT::V5::ForwardedPublish::MaxParts];
+            for (int i = 0; i < count; i++) parts[i] = { const_cast<uint8*>(packet.parts[i].data), packet.parts[i].size };
+
+#if MQTTQoSSupportLevel != -1
+            if (qos)
+            {
+  #if MQTTQoSSupportLevel == 1
+                // The storage needs a copy of the complete packet to retransmit it
+                const uint32 packetSize = packet.packetSize;
+                DeclareStackHeapBuffer(full, packetSize, StackSizeAllocationLimit);
+                uint32 o = 0;
+                for (int i = 0; i < count; o += (uint32)parts[i].iov_len, i++)
+                    memcpy((uint8*)full + o, parts[i].iov_base, parts[i].iov_len);
+                ErrorType err = savePublish(qos, packetID, full, packetSize);
+  #else
+                ErrorType err = savePublish(qos, packetID, 0, 0);
+  #endif
+                if (err) return release(err, true);
+            }
+#endif
+            ErrorType err = sendAndReceive(parts, count, false, priority);
+            return release(err, err != ErrorType::Success); // Mark as error here
+        }
+#endif
+
+#if MQTTOutboundQueue > 0
+  #if MQTTMultithread == 1
+        inline void lockOutbound()      { outLock.acquireExclusive(); }
+        inline void unlockOutbound()    { outLock.releaseExclusive(); }
+  #else
+        inline void lockOutbound()      {}
+        inline void unlockOutbound()    {}
+  #endif
+
+        /** Find the rate limits matching the given topic
+            @param length   The topic length if it's not zero terminated
+            @return A bitmask of the matching limits' index */
+        uint32 matchLimits(const char * topic, const size_t length = (size_t)-1) const
+        {
+            uint32 limits = 0, i = 0;
+            for (MQTTv5::RateLimit * limit = rateLimits; limit; limit = limit->next, i++)
+            {
+                const size_t prefixLength = limit->topicPrefix ? strlen(limit->topicPrefix) : 0;
+                if (!limit->topicPrefix || (prefixLength <= length && !strncmp(topic, limit->topicPrefix, prefixLength)))
+                    limits |= 1U << i;
+            }
+            return limits;
+        }
+
+        /** Take the tokens for sending a packet of the given size from all the matching limits.
+            The tokens are only taken if all the limits allow it.
+            @param waitMs   On failure, set to the time to wait before the packet can be sent
+            @return true if the packet can be sent now */
+        bool takeTokens(const uint32 limits, const uint32 size, uint32 & waitMs)
+        {
+            if (!limits) return true;
+            const uint32 now = getTimeMs();
+            uint32 wait = 0, i = 0;
+            for (MQTTv5::RateLimit * limit = rateLimits; limit; limit = limit->next, i++)
+            {
+                if (!(limits & (1U << i))) continue;
+                // Refill the buckets (a new bucket starts full)
+                const uint64 msgCap = (uint64)limit->messagesPerSecond * limit->burstMs, byteCap = (uint64)limit->bytesPerSecond * limit->burstMs;
+                const uint64 elapsed = limit->lastRefill ? (uint32)(now - limit->lastRefill) : limit->burstMs;
+                limit->messageTokens = min(limit->messageTokens + elapsed * limit->messagesPerSecond, msgCap);
+                limit->byteTokens = min(limit->byteTokens + elapsed * limit->bytesPerSecond, byteCap);
+                limit->lastRefill = now;
+
+                // A packet larger than the bucket only requires a full bucket
+                const uint64 msgs = min((uint64)1000, msgCap), bytes = min((uint64)size * 1000, byteCap);
+                if (limit->messagesPerSecond && limit->messageTokens < msgs)
+                    wait = max(wait, (uint32)((msgs - limit->messageTokens + limit->messagesPerSecond - 1) / limit->messagesPerSecond));
+                if (limit->bytesPerSecond && limit->byteTokens < bytes)
+                    wait = max(wait, (uint32)((bytes - limit->byteTokens + limit->bytesPerSecond - 1) / limit->bytesPerSecond));
+            }
+            if (wait) { waitMs = wait; return false; }
+
+            i = 0;
+            for (MQTTv5::RateLimit * limit = rateLimits; limit; limit = limit->next, i++)
+            {
+                if (!(limits & (1U << i))) continue;
+                if (limit->messagesPerSecond) limit->messageTokens -= min((uint64)1000, (uint64)limit->messagesPerSecond * limit->burstMs);
+                if (limit->bytesPerSecond) limit->byteTokens -= min((uint64)size * 1000, (uint64)limit->bytesPerSecond * limit->burstMs);
+            }
+            return true;
+        }
+
+        /** Check if the broker's receive maximum allows sending another QoS packet (the queued packets are already in the packet ID table) */
+        inline bool canSendQoS() const { return (uint16)(buffers.countSentID() - outQueuedQoS) < brokerReceiveMax; }
+
+        /** Get the entry at the head of the outbound queue (skipping the unused space at the end of the queue)
+            @return A pointer on the packet (right after the entry) or 0 if the queue is empty */
+        const uint8 * peekOutbound(OutboundEntry & entry)
+        {
+            while (outUsed)
+            {
+                if (MQTTOutboundQueue - outHead < sizeof(entry)) { outUsed -= MQTTOutboundQueue - outHead; outHead = 0; continue; }
+                memcpy(&entry, &outQueue[outHead], sizeof(entry));
+                if (entry.size) return &outQueue[outHead + sizeof(entry)];
+                // Marker for the unused space at the end of the queue
+                outUsed -= MQTTOutboundQueue - outHead; outHead = 0;
+            }
+            return 0;
+        }
+        /** Remove the entry at the head of the outbound queue */
+        void popOutbound(const OutboundEntry & entry)
+        {
+            outHead += sizeof(entry) + entry.size;
+            outUsed -= sizeof(entry) + entry.size;
+            if (outHead == MQTTOutboundQueue) outHead = 0;
+            if (!outUsed) outHead = outTail = 0;
+        }
+        /** Check if a packet fits in the outbound queue
+            @param padding  Set to the unused space to skip at the end of the queue to store the packet
+            @return false if there's not enough space in the queue */
+        bool fitsOutbound(const uint32 packetSize, uint32 & padding) const
+        {
+            const uint32 size = sizeof(OutboundEntry) + packetSize;
+            padding = 0;
+            if (MQTTOutboundQueue - outTail < size)
+            {   // Not enough space at the end, so skip it (if it's not used by the head)
+                padding = MQTTOutboundQueue - outTail;
+                if (outUsed && outTail < outHead) return false;
+            }
+            return outUsed + padding + size <= MQTTOutboundQueue;
+        }
+        /** Append a packet to the outbound queue (fitsOutbound must have succeeded) */
+        void pushOutbound(const OutboundEntry & entry, const uint8 * packet, const uint32 padding)
+        {
+            const uint32 size = sizeof(entry) + entry.size;
+            if (padding)
+            {
+                if (padding >= sizeof(entry)) memset(&outQueue[outTail], 0, sizeof(entry));
+                outUsed += padding;
+                outTail = 0;
+            }
+            memcpy(&outQueue[outTail], &entry, sizeof(entry));
+            memcpy(&outQueue[outTail + sizeof(entry)], packet, entry.size);
+            outTail += size;
+            if (outTail == MQTTOutboundQueue) outTail = 0;
+            outUsed += size;
+        }
+        /** Empty the outbound queue */
+        void clearOutbound()
+        {
+            lockOutbound();
+            bool wasHigh = outAboveHigh;
+            outHead = outTail = outUsed = 0; outQueuedQoS = 0; outAboveHigh = false;
+            unlockOutbound();
+            if (wasHigh) cb->outboundQueueWatermark(false, 0);
+        }
+
+        /** Send a publish packet now if the rate limits and the broker's receive maximum allow it, else queue it
+            @return ErrorType::Throttled if the packet can't be sent now and the queue is full */
+        ErrorType queuePublish(Protocol::MQTT::V5::PublishPacket & packet, const char * topic, const uint8 priority = 0)
+        {
+            uint32 packetSize = packet.computePacketSize();
+            if (packetSize > maxPacketSize) return ErrorType::BadParameter;
+            DeclareStackHeapBuffer(buffer, packetSize, StackSizeAllocationLimit);
+            if (packet.copyInto(buffer) != packetSize)
+                return ErrorType::UnknownError;
+
+  #if MQTTMessageExpiry == 1
+            OutboundEntry entry = { packetSize, matchLimits(topic), packet.header.getQoS(), priority, 0, 0 };
+  #else
+            OutboundEntry entry = { packetSize, matchLimits(topic), packet.header.getQoS(), priority };
+  #endif
+            uint32 waitMs = 0;
+            lockOutbound();
+            // Packets are sent in order, so a packet can only be sent directly if nothing is queued
+            uint32 padding = 0;
+            bool direct = !outUsed && (!entry.QoS || canSendQoS()) && takeTokens(entry.limits, packetSize, waitMs);
+            if (!direct && !fitsOutbound(packetSize, padding))
+            {
+                unlockOutbound();
+                return ErrorType::Throttled;
+            }
+  #if MQTTMessageExpiry == 1
+            if (!direct)
+            {
+                uint32 interval = 0;
+                entry.expiryOffset = findMessageExpiry(buffer, packetSize, interval);
+                entry.queuedAt = (uint32)time(NULL);
+            }
+  #endif
+  #if MQTTQoSSupportLevel != -1
+            if (ErrorType err = savePublish(entry.QoS, packet.fixedVariableHeader.packetID, buffer, packetSize))
+            {
+                unlockOutbound();
+                return err;
+            }
+  #endif
+            if (direct)
+            {
+                unlockOutbound();
+                return sendAndReceive(buffer, packetSize, false, priority);
+            }
+
+            pushOutbound(entry, buffer, padding);
+            if (entry.QoS) outQueuedQoS++;
+            const uint32 used = outUsed;
+            const bool crossed = !outAboveHigh && used >= outHigh;
+            if (crossed) outAboveHigh = true;
+            unlockOutbound();
+            if (crossed) cb->outboundQueueWatermark(true, used);
+            return ErrorType::Success;
+        }
+
+        /** Send the queued packets the rate limits and the broker's receive maximum allow.
+            This is called from the event loop thread only.
+            @param waitMs   Set to the time to wait before the next queued packet can be sent (0 if the queue is empty) */
+        ErrorType flushOutbound(uint32 & waitMs)
+        {
+            waitMs = 0;
+            bool sent = false;
+            lockOutbound();
+            OutboundEntry entry;
+            while (uint8 * packet = const_cast<uint8*>(peekOutbound(entry)))
+            {
+  #if MQTTMessageExpiry == 1
+                const uint32 interval = entry.expiryOffset ? readBE32(packet + entry.expiryOffset) : 0, elapsed = (uint32)time(NULL) - entry.queuedAt;
+                if (!entry.expiryOffset || elapsed < interval)
+  #endif
+                {
+                    if (entry.QoS && !canSendQoS()) { waitMs = MaxOutboundWaitMs; break; }
+                    if (!takeTokens(entry.limits, entry.size, waitMs)) break;
+  #if MQTTMessageExpiry == 1
+                    // Remove the time spent in the queue from the interval
+                    if (entry.expiryOffset && elapsed) writeBE32(packet + entry.expiryOffset, interval - elapsed);
+  #endif
+                    // Publishing threads only append to the queue, so the packet can be sent without holding the lock
+                    unlockOutbound();
+                    if (send((const char*)packet, entry.size, entry.priority) != (int)entry.size)
+                        return ErrorType::NetworkError;
+                    sent = true;
+                    lockOutbound();
+                }
+  #if MQTTMessageExpiry == 1
+                else
+                {   // It's expired, so drop it
+                    Protocol::MQTT::V5::PublishPacketView view;
+                    dropExpired(entry.QoS && !Protocol::MQTT::Common::isError(view.readFrom(packet, entry.size)) ? view.packetID : 0);
+                }
+  #endif
+                popOutbound(entry);
+                if (entry.QoS) outQueuedQoS--;
+                if (outAboveHigh && outUsed <= outLow)
+                {
+                    const uint32 used = outUsed;
+                    outAboveHigh = false;
+                    unlockOutbound();
+                    cb->outboundQueueWatermark(false, used);
+                    lockOutbound();
+                }
+            }
+            unlockOutbound();
+            if (waitMs > 1000) waitMs = 1000;
+            // Only real traffic delays the next ping
+            if (sent) lastCommunication = (uint32)time(NULL);
+            return ErrorType::Success;
+        }
+#endif
+
+#if MQTTCoalesceACK > 0 && MQTTQoSSupportLevel != -1
+        /** Check if some replies are waiting to be sent */
+        inline bool hasPendingReplies() const { return pendingRepliesCount > 0; }
+        /** Send all the pending replies in a single call */
+        ErrorType flushReplies()
+        {
+            if (!pendingRepliesSize) return ErrorType::Success;
+            const uint32 size = pendingRepliesSize;
+            pendingRepliesSize = 0; pendingRepliesCount = 0;
+            return sendAndReceive(pendingReplies, size, false);
+        }
+        /** Append a reply to the pending replies and flush them if the maximum number of replies is reached */
+        ErrorType queueReply(Protocol::MQTT::V5::PublishReplyPacket & packet)
+        {
+            uint32 packetSize = packet.computePacketSize();
+            if (pendingRepliesSize + packetSize > sizeof(pendingReplies))
+            {
+                if (ErrorType err = flushReplies()) return err;
+                // Should never happen since replies are small, but don't lose the reply anyway
+                if (packetSize > sizeof(pendingReplies)) return prepareSAR(packet, false);
+            }
+            if (packet.copyInto(&pendingReplies[pendingRepliesSize]) != packetSize)
+                return ErrorType::UnknownError;
+            pendingRepliesSize += packetSize;
+            if (++pendingRepliesCount >= MQTTCoalesceACK) return flushReplies();
+            return ErrorType::Success;
+        }
+#else
+        inline bool hasPendingReplies() const { return false; }
+        inline ErrorType flushReplies() { return ErrorType::Success; }
+#endif
+
+#if MQTTManualACK == 1 && MQTTQoSSupportLevel != -1
+  #if MQTTMultithread == 1
+        inline void lockAcks()          { ackLock.acquireExclusive(); }
+        inline void unlockAcks()        { ackLock.releaseExclusive(); }
+  #else
+        inline void lockAcks()          {}
+        inline void unlockAcks()        {}
+  #endif
+        /** Send the deferred reply for a received QoS packet.
+            This doesn't use the coalescing buffer since it can be called from any thread */
+        ErrorType acknowledge(const uint16 packetID, const Protocol::MQTT::V5::ReasonCodes reason)
+        {
+            // The table is updated before sending the reply, since the broker's PUBREL can be received (by the event loop) as soon as the PUBREC is sent
+            lockAcks();
+            uint8 i = buffers.findID(packetID | 0x10000);
+            if (i == buffers.end()) { unlockAcks(); return ErrorType::BadParameter; }
+            const bool QoS1 = Buffers::isQoS1(buffers.packetID(i));
+            // QoS1 cycle is done here, and so is a refused QoS2 packet. Else, wait for the broker's PUBREL.
+            // Acknowledging a QoS2 packet again simply resends the PUBREC (for a duplicate packet from the broker)
+            if (QoS1 || reason >= Protocol::MQTT::V5::UnspecifiedError) buffers.releaseID(packetID | 0x10000);
+            else buffers.avanceQoS2(packetID | 0x10000);
+            unlockAcks();
+
+            Protocol::MQTT::V5::PublishReplyPacket answer(QoS1 ? Protocol::MQTT::V5::PUBACK : Protocol::MQTT::V5::PUBREC);
+            answer.fixedVariableHeader.packetID = packetID;
+            answer.fixedVariableHeader.reasonCode = reason;
+            return prepareSAR(answer, false);
+        }
+#endif
+
         ErrorType requestOneLoop(Protocol::MQTT::V5::ControlPacketSerializable & packet)
         {
+            // Pending replies must be sent before any other packet
+            if (ErrorType ret = flushReplies()) return ret;
             ErrorType ret = prepareSAR(packet, true);
             if (ret) return ret;
 
@@ -835,11 +2424,7 @@ namespace Network { namespace Client {
 
                 // Receive a new packet to continue the loop
                 int receivedPacketSize = receiveControlPacket();
-                if (receivedPacketSize <= 0)
-                {   // This will also comes here
-                    if (receivedPacketSize == 0) close();
-                    return receivedPacketSize == -2 ? ErrorType::TimedOut : ErrorType::NetworkError;
-                }
+                if (receivedPacketSize <= 0) return receiveError(receivedPacketSize);
             }
             // Exit the special state if any the reply packet is the one expected
             if (ret == ErrorType::Success &&
@@ -850,6 +2435,253 @@ namespace Network { namespace Client {
             return ret;
         }
 
+#if MQTTAsyncSubscribe > 0
+        /** Find the asynchronous request for the given packet identifier (use 0 to find a free slot) */
+        uint8 findAsyncScribe(const uint16 packetID) const
+        {
+            for (uint8 i = 0; i < MQTTAsyncSubscribe; i++)
+                if (asyncScribes[i].packetID == packetID) return i;
+            return MQTTAsyncSubscribe;
+        }
+
+        /** Get the packet identifier of the received packet without extracting it */
+        uint16 peekPacketID() const
+        {
+            Protocol::MQTT::Common::VBInt l;
+            uint32 s = l.readFrom(buffers.recvBuffer() + 1, available - 1);
+            if (Protocol::MQTT::Common::isError(s) || available < 3 + s) return 0;
+            const uint8 * p = buffers.recvBuffer() + 1 + s;
+            return (uint16)((p[0] << 8) | p[1]);
+        }
+
+        /** Check if the received SUBACK or UNSUBACK packet is for an asynchronous request, and report it if it is
+            @return ErrorType::TranscientPacket if it was, ErrorType::Success if it's not for an asynchronous request, or any error */
+        ErrorType dealWithAsyncScribe(const Protocol::MQTT::V5::ControlPacketType type)
+        {
+            uint8 i = findAsyncScribe(peekPacketID());
+            if (!peekPacketID() || i == MQTTAsyncSubscribe) return ErrorType::Success;
+
+            Protocol::MQTT::V5::ROSubACKPacket subAck;
+            Protocol::MQTT::V5::ROUnsubACKPacket unsubAck;
+            const bool isSubAck = type == Protocol::MQTT::V5::SUBACK;
+            int ret = isSubAck ? extractControlPacket(type, subAck) : extractControlPacket(type, unsubAck);
+            if (ret <= 0) return ErrorType::NetworkError;
+
+            const uint8 * reasons = isSubAck ? subAck.payload.data : unsubAck.payload.data;
+            const uint32 count = isSubAck ? subAck.payload.size : unsubAck.payload.size;
+            AsyncScribe req = asyncScribes[i];
+            asyncScribes[i].packetID = 0;
+            if (req.unsubscribe == isSubAck || count != req.count) return ErrorType::NetworkError;
+
+            cb->scribeCompleted(req.requestID, req.unsubscribe, req.firstTopic, reasons, count);
+            return ErrorType::TranscientPacket;
+        }
+
+        /** Check the client's state and the given properties, then send the serialized topics with sendScribeBatch */
+        ErrorType scribeAsync(const bool unsubscribe, const uint8 * topics, const uint32 size, Properties * properties, const uint32 requestID)
+        {
+            if (!isOpen()) return ErrorType::NotConnected;
+            // If we are interrupting while receiving a packet, let's stop before make any more damage
+            if (state != State::Running)
+                return ErrorType::TranscientPacket;
+            if (!size) return ErrorType::BadParameter;
+
+            // Capture properties (to avoid copying them)
+            Properties props;
+            props.capture(properties);
+#if MQTTAvoidValidation != 1
+            if (!props.checkPropertiesFor(unsubscribe ? Protocol::MQTT::V5::UNSUBSCRIBE : Protocol::MQTT::V5::SUBSCRIBE))
+                return ErrorType::BadProperties;
+#endif
+            ErrorType ret = sendScribeBatch(unsubscribe, topics, size, props, requestID);
+            if (ret == ErrorType::BadParameter) return ret;
+            return ret ? saveError(ret) : ret;
+        }
+
+        /** Send the given serialized topics in as few SUBSCRIBE or UNSUBSCRIBE packets as possible, without waiting for their acknowledgement.
+            The packets are limited to the broker's maximum packet size and to MQTTAsyncSubscribe packets in flight.
+            If there are more packets in flight, the acknowledgements are processed until a slot is free */
+        ErrorType sendScribeBatch(const bool unsubscribe, const uint8 * topics, const uint32 size, const Properties & props, const uint32 requestID)
+        {
+            const uint32 propsSize = props.getSize();
+            // Fixed header, remaining length, packet identifier and properties
+            const uint32 overhead = 1 + 4 + 2 + propsSize;
+            if (maxPacketSize <= overhead) return ErrorType::BadParameter;
+            const uint32 maxPayload = maxPacketSize - overhead;
+
+            const uint32 packetSize = min(maxPayload, size) + overhead;
+            DeclareStackHeapBuffer(packet, packetSize, StackSizeAllocationLimit);
+            uint32 pos = 0, index = 0;
+            while (pos < size)
+            {
+                // Find out how many topics fit in this packet
+                uint32 start = pos, count = 0;
+                while (pos < size && count < 65535)
+                {
+                    if (pos + 2 > size) return ErrorType::BadParameter;
+                    uint32 entry = 2 + ((topics[pos] << 8) | topics[pos + 1]) + (unsubscribe ? 0 : 1);
+                    if (pos + entry > size) return ErrorType::BadParameter;
+                    if (pos - start + entry > maxPayload) break;
+                    pos += entry; count++;
+                }
+                // A single topic doesn't fit in a packet
+                if (!count) return ErrorType::BadParameter;
+
+                // Wait for a free slot
+                uint8 slot = findAsyncScribe(0);
+                while (slot == MQTTAsyncSubscribe)
+                {
+                    if (ErrorType ret = receiveAndDealWithNoise()) return ret;
+                    slot = findAsyncScribe(0);
+                }
+
+                uint16 packetID = allocatePacketID();
+                if (!packetID) packetID = allocatePacketID();
+
+                // Build the packet
+                Protocol::MQTT::Common::VBInt remLength(2 + propsSize + pos - start);
+                uint8 * p = packet;
+                uint32 o = 0;
+                p[o++] = unsubscribe ? 0xA2 : 0x82;
+                o += remLength.copyInto(p + o);
+                p[o++] = (uint8)(packetID >> 8); p[o++] = (uint8)packetID;
+                o += props.copyInto(p + o);
+                memcpy(p + o, topics + start, pos - start);
+                o += pos - start;
+
+                AsyncScribe & req = asyncScribes[slot];
+                req.requestID = requestID; req.firstTopic = index; req.count = (uint16)count; req.unsubscribe = unsubscribe;
+                req.packetID = packetID;
+                if (ErrorType ret = sendAndReceive(p, o, false))
+                {
+                    req.packetID = 0;
+                    return ret;
+                }
+                index += count;
+            }
+            return ErrorType::Success;
+        }
+#endif
+
+        /** Send the given SUBSCRIBE packet and wait for the broker's answer.
+            @param packet       The packet with its topics (either as a list or a contiguous list)
+            @param count        The number of topics in the packet
+            @param properties   The properties to send along the packet
+            @return ErrorType::Success if all topics were accepted by the broker, the first refused reason code or any error */
+        ErrorType subscribe(Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::SUBSCRIBE> & packet, const uint32 count, Properties * properties)
+        {
+            if (!isOpen()) return ErrorType::NotConnected;
+            // If we are interrupting while receiving a packet, let's stop before make any more damage
+            if (state != State::Running)
+                return ErrorType::TranscientPacket;
+
+            // Capture properties (to avoid copying them)
+            packet.props.capture(properties);
+
+#if MQTTAvoidValidation != 1
+            if (!packet.props.checkPropertiesFor(Protocol::MQTT::V5::SUBSCRIBE))
+                return ErrorType::BadProperties;
+#endif
+
+            packet.fixedVariableHeader.packetID = allocatePacketID();
+            setConnectionState(State::Subscribing);
+
+            // Then send the packet
+            if (ErrorType ret = requestOneLoop(packet))
+                return saveError(ret);
+
+            // Then extract the packet type
+            Protocol::MQTT::V5::ControlPacketType type = getLastPacketType();
+            if (type == Protocol::MQTT::V5::SUBACK)
+            {
+                Protocol::MQTT::V5::ROSubACKPacket rpacket;
+                int ret = extractControlPacket(type, rpacket);
+                if (ret <= 0) return saveError(ErrorType::NetworkError);
+
+                if (rpacket.fixedVariableHeader.packetID != packet.fixedVariableHeader.packetID)
+                    return saveError(ErrorType::NetworkError);
+
+                // Then check reason codes
+                if (!rpacket.payload.data || rpacket.payload.size < count)
+                    return ReasonCodes::ProtocolError;
+                for (uint32 i = 0; i < count; i++)
+                    if (rpacket.payload.data[i] >= ReasonCodes::UnspecifiedError)
+                        return (ReasonCodes)rpacket.payload.data[i];
+
+                return ErrorType::Success;
+            }
+
+            return saveError(ErrorType::NetworkError);
+        }
+
+#if MQTTUseUnsubscribe == 1
+        /** Send the given UNSUBSCRIBE packet and wait for the broker's answer.
+            @param packet       The packet with its topics (either as a list or a contiguous list)
+            @param properties   The properties to send along the packet
+            @return ErrorType::Success if all topics were unsubscribed, the first refused reason code or any error */
+        ErrorType unsubscribe(Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::UNSUBSCRIBE> & packet, Properties * properties)
+        {
+            if (!isOpen()) return ErrorType::NotConnected;
+            // If we are interrupting while receiving a packet, let's stop before make any more damage
+            if (state != State::Running)
+                return ErrorType::TranscientPacket;
+
+            // If we are currently unsubscribing and still waiting for ACK, don't accept any other unsubscription
+            if (unsubscribeId)
+                return ErrorType::TranscientPacket;
+
+            // Capture properties (to avoid copying them)
+            packet.props.capture(properties);
+
+#if MQTTAvoidValidation != 1
+            if (!packet.props.checkPropertiesFor(Protocol::MQTT::V5::UNSUBSCRIBE))
+                return ErrorType::BadProperties;
+#endif
+
+            packet.fixedVariableHeader.packetID = allocatePacketID();
+            setConnectionState(State::Unsubscribing);
+
+            // Then send the packet
+            if (ErrorType ret = requestOneLoop(packet))
+                return saveError(ret);
+
+            // Then extract the packet type
+            Protocol::MQTT::V5::ControlPacketType type = getLastPacketType();
+            if (type == Protocol::MQTT::V5::UNSUBACK)
+            {
+                Protocol::MQTT::V5::ROUnsubACKPacket rpacket;
+                int ret = extractControlPacket(type, rpacket);
+                if (ret <= 0) return saveError(ErrorType::NetworkError);
+
+                if (rpacket.fixedVariableHeader.packetID != packet.fixedVariableHeader.packetID)
+                    return saveError(ErrorType::NetworkError);
+
+                // Then check reason codes
+                uint32 count = rpacket.payload.size;
+                if (!rpacket.payload.data)
+                    return ReasonCodes::ProtocolError;
+                for (uint32 i = 0; i < count; i++)
+                    if (rpacket.payload.data[i] >= ReasonCodes::UnspecifiedError)
+                        return (ErrorType::Type)rpacket.payload.data[i];
+
+                return ErrorType::Success;
+            }
+
+            return saveError(ErrorType::NetworkError);
+        }
+#endif
+
+        /** Receive a packet and process it, for the time the connection isn't in the event loop.
+            @return ErrorType::Success if a packet was processed or any error */
+        ErrorType receiveAndDealWithNoise()
+        {
+            int receivedPacketSize = receiveControlPacket();
+            if (receivedPacketSize <= 0) return receiveError(receivedPacketSize);
+            ErrorType ret = dealWithNoise();
+            if (ret == ErrorType::TranscientPacket) return ErrorType::Success;
+            return ret;
+        }
+
         /** Deal with answer packet noise here.
             This is called after receiving a control packet.
             The mask is used to filter the allowed packet types we expect to see.
@@ -877,6 +2709,14 @@ namespace Network { namespace Client {
             Protocol::MQTT::V5::ControlPacketType type = getLastPacketType();
             uint16 typeMask = bit(type);
 
+#if MQTTRecvBufferPool > 1
+            if (type == Protocol::MQTT::V5::PINGRESP && state == State::Running)
+            {   // The late answer to a ping that couldn't be waited for, @sa MQTTv5::eventLoop
+                Protocol::MQTT::V5::PingRespPacket packet;
+                if (extractControlPacket(type, packet) <= 0) return ErrorType::NetworkError;
+                return ErrorType::TranscientPacket;
+            }
+#endif
             if (type == Protocol::MQTT::V5::DISCONNECT)
             {   // Disconnect is a special packet that can happens at any state
                 Protocol::MQTT::V5::RODisconnectPacket packet;
@@ -887,6 +2727,14 @@ namespace Network { namespace Client {
                 return ErrorType::NotConnected; // No work to perform upon server sending disconnect
             }
 
+#if MQTTAsyncSubscribe > 0
+            // Acknowledgements for asynchronous requests can happen in any running state
+            if ((type == Protocol::MQTT::V5::SUBACK || type == Protocol::MQTT::V5::UNSUBACK) && state >= State::Running && state < State::Disconnecting)
+            {
+                if (ErrorType ret = dealWithAsyncScribe(type))
+                    return ret;
+            }
+#endif
             // Check for unexpected packet
             if ((State::expectedPacketMask[state] & typeMask) == 0)
                 return ErrorType::NetworkError;
@@ -898,15 +2746,31 @@ namespace Network { namespace Client {
                 Protocol::MQTT::V5::ControlPacketType next = Protocol::MQTT::V5::RESERVED;
                 if (type == Protocol::MQTT::V5::PUBLISH)
                 {
-                    Protocol::MQTT::V5::ROPublishPacket packet;
-                    int ret = extractControlPacket(type, packet);
+                    Protocol::MQTT::V5::PublishPacketView packet;
+                    int ret = extractControlPacket(packet);
                     if (ret == 0) { close(); return ErrorType::NotConnected; }
                     if (ret < 0) return ErrorType::NetworkError;
+                    uint8 QoS = packet.header.getQoS();
+#if MQTTManualACK == 1 && MQTTQoSSupportLevel != -1
+                    if (QoS)
+                    {   // The ID must be known before the user gets the token, since it can be acknowledged from another thread
+                        // A retransmitted packet (after a reconnection) reuses the ID that's already stored
+                        packetID = packet.packetID;
+                        lockAcks();
+                        bool store = buffers.findID(packetID | 0x10000) != buffers.end()
+                                  || ((QoS == 1) ? buffers.storeQoS1ID(packetID | 0x10000) : buffers.storeQoS2ID(packetID | 0x10000));
+                        unlockAcks();
+                        if (!store) return ErrorType::StorageError;
+                    }
+                    // The reply is sent when the user calls acknowledge()
+                    notifyMessage(packet);
+                    resetPacketReceivingState();
+                    return ErrorType::TranscientPacket;
+#else
                     // Call the user as soon as possible to limit latency
                     // Notice that the user might be PUBLISH'ing here
-                    cb->messageReceived(packet.fixedVariableHeader.topicName, Protocol::MQTT::Common::DynamicBinDataView(packet.payload.size, packet.payload.data), packet.fixedVariableHeader.packetID, packet.props);
+                    notifyMessage(packet);
                     // Save the ID if QoS
-                    uint8 QoS = packet.header.getQoS();
                     if (QoS == 0)
                     {
                         // Done with this packet
@@ -917,11 +2781,12 @@ namespace Network { namespace Client {
                     return ErrorType::NetworkError;
 #else
 
-                    packetID = packet.fixedVariableHeader.packetID;
+                    packetID = packet.packetID;
 
                     bool store = (QoS == 1) ? buffers.storeQoS1ID(packetID | 0x10000) : buffers.storeQoS2ID(packetID | 0x10000);
                     if (!store) return ErrorType::StorageError;
                     next = (QoS == 1) ? Protocol::MQTT::V5::ControlPacketType::PUBACK : Protocol::MQTT::V5::ControlPacketType::PUBREC;
+#endif
 #endif
                 } else
                 {
@@ -938,12 +2803,22 @@ namespace Network { namespace Client {
                     {
                         if (!storage->releasePacketBuffer(packetID)) // They always come from us
                             return ErrorType::StorageError;
+  #if MQTTMessageExpiry == 1
+                        releaseExpiry(packetID);
+  #endif
                     }
 #endif
-                    if (typeMask & State::releaseIDMask)
+                    // A PUBREC with a failure reason code ends the QoS 2 cycle too (no PUBREL is sent, as per 4.3.3)
+                    if ((typeMask & State::releaseIDMask) || (type == Protocol::MQTT::V5::PUBREC && reply.fixedVariableHeader.reasonCode >= 0x80))
                     {
+  #if MQTTPublishCompletion == 1
+                        // The publication cycle is complete
+                        if (!completePublish(packetID, (ReasonCodes)reply.fixedVariableHeader.reasonCode)) // They always come from us
+                            return ErrorType::StorageError;
+  #else
                         if (!buffers.releaseID(packetID)) // They always come from us
                             return ErrorType::StorageError;
+  #endif
                     } else
                     {   // We need to reply to the broker (for example: PUBREL or PUBREC)
                         next = Protocol::MQTT::Common::Helper::getNextPacketType(type);
@@ -959,15 +2834,29 @@ namespace Network { namespace Client {
                     Protocol::MQTT::V5::PublishReplyPacket answer(next);
                     answer.fixedVariableHeader.packetID = packetID;
                     next = Protocol::MQTT::Common::Helper::getNextPacketType(next);
+#if MQTTCoalesceACK > 0
+                    if (ErrorType err = queueReply(answer))
+                        return err;
+#else
                     if (ErrorType err = prepareSAR(answer, false))
                         return err;
+#endif
 
                     // Check we need to advance the QoS2 processing now
                     if (type == Protocol::MQTT::V5::PUBREC && !buffers.avanceQoS2(packetID))
                         return ErrorType::StorageError;
                     // Or remove the ID for if there's no next packet to send (ACK or REL)
-                    else if (next == Protocol::MQTT::V5::RESERVED && !buffers.releaseID(packetID | 0x10000))
-                        return ErrorType::StorageError;
+                    else if (next == Protocol::MQTT::V5::RESERVED)
+                    {
+#if MQTTManualACK == 1
+                        lockAcks();
+                        bool released = buffers.releaseID(packetID | 0x10000);
+                        unlockAcks();
+#else
+                        bool released = buffers.releaseID(packetID | 0x10000);
+#endif
+                        if (!released) return ErrorType::StorageError;
+                    }
                 }
 
                 resetPacketReceivingState();
@@ -989,20 +2878,9 @@ namespace Network { namespace Client {
                 // Try to find the auth method, and the auth data
                 DynamicStringView authMethod;
                 DynamicBinDataView authData;
-                Protocol::MQTT::V5::VisitorVariant visitor;
-                while (packet.props.getProperty(visitor) && (authMethod.length == 0 || authData.length == 0))
-                {
-                    if (visitor.propertyType() == Protocol::MQTT::V5::AuthenticationMethod)
-                    {
-                        auto view = visitor.as< DynamicStringView >();
-                        authMethod = *view;
-                    }
-                    else if (visitor.propertyType() == Protocol::MQTT::V5::AuthenticationData)
-                    {
-                        auto data = visitor.as< DynamicBinDataView >();
-                        authData = *data;
-                    }
-                }
+                Protocol::MQTT::V5::PropertiesIndex index(packet.props);
+                index.getValue(Protocol::MQTT::V5::AuthenticationMethod, authMethod);
+                index.getValue(Protocol::MQTT::V5::AuthenticationData, authData);
                 return cb->authReceived(packet.fixedVariableHeader.reason(), authMethod, authData, packet.props) ? MQTTv5::ErrorType::Success : MQTTv5::ErrorType::NetworkError;
             }
             return ErrorType::NetworkError;
@@ -1016,10 +2894,10 @@ namespace Network { namespace Client {
             if (ret > 0)
             {
                 // We are only interested in the result of the connection
-                if (packet.fixedVariableHeader.acknowledgeFlag & 1)
-                {   // Session is present on the server. For now, we don't care, do we ?
-
-                }
+#if MQTTUseReconnect == 1
+                // Remember if the session is present on the server, so we know if we need to subscribe again upon reconnection
+                sessionPresent = (packet.fixedVariableHeader.acknowledgeFlag & 1) != 0;
+#endif
                 if (packet.fixedVariableHeader.reasonCode != 0
 #if MQTTUseAuth == 1
                     && packet.fixedVariableHeader.reasonCode != Protocol::MQTT::V5::NotAuthorized
@@ -1031,49 +2909,24 @@ namespace Network { namespace Client {
                     return (MQTTv5::ReasonCodes)packet.fixedVariableHeader.reasonCode;
                 }
                 // Now, we are going to parse the other properties
+                Protocol::MQTT::V5::PropertiesIndex index(packet.props);
+                index.getValue(Protocol::MQTT::V5::PacketSizeMax, maxPacketSize);
+                index.getValue(Protocol::MQTT::V5::ServerKeepAlive, keepAlive);
+#if MQTTOutboundQueue > 0
+                // The queued packets are sent while honoring the broker's receive maximum
+                brokerReceiveMax = 65535;
+                index.getValue(Protocol::MQTT::V5::ReceiveMax, brokerReceiveMax);
+#endif
+                DynamicStringView assignedID;
+                if (index.getValue(Protocol::MQTT::V5::AssignedClientID, assignedID))
+                    clientID.from(assignedID.data, assignedID.length); // This allocates memory for holding the copy
 #if MQTTUseAuth == 1
                 DynamicStringView authMethod;
                 DynamicBinDataView authData;
+                index.getValue(Protocol::MQTT::V5::AuthenticationMethod, authMethod);
+                index.getValue(Protocol::MQTT::V5::AuthenticationData, authData);
 #endif
-                Protocol::MQTT::V5::VisitorVariant visitor;
-                while (packet.props.getProperty(visitor))
-                {
-                    switch (visitor.propertyType())
-                    {
-                    case Protocol::MQTT::V5::PacketSizeMax:
-                    {
-                        auto pod = visitor.as< Protocol::MQTT::V5::LittleEndianPODVisitor<uint32> >();
-                        maxPacketSize = pod->getValue();
-                        break;
-                    }
-                    case Protocol::MQTT::V5::AssignedClientID:
-                    {
-                        auto view = visitor.as< Protocol::MQTT::V5::DynamicStringView >();
-                        clientID.from(view->data, view->length); // This allocates memory for holding the copy
-                        break;
-                    }
-                    case Protocol::MQTT::V5::ServerKeepAlive:
-                    {
-                        auto pod = visitor.as< Protocol::MQTT::V5::LittleEndianPODVisitor<uint16> >();
-                        keepAlive = pod->getValue();
-                        break;
-                    }
-#if MQTTUseAuth == 1
-                    case Protocol::MQTT::V5::AuthenticationMethod:
-                    {
-                        auto view = visitor.as<DynamicStringView>();
-                        authMethod = *view;
-                    } break;
-                    case Protocol::MQTT::V5::AuthenticationData:
-                    {
-                        auto data = visitor.as<DynamicBinDataView>();
-                        authData = *data;
-                    } break;
-#endif
-                    // Actually, we don't care about other properties. Maybe we should ?
-                    default: break;
-                    }
-                }
+                // Actually, we don't care about other properties. Maybe we should ?
 #if MQTTUseAuth == 1
                 if (packet.fixedVariableHeader.reasonCode == Protocol::MQTT::V5::NotAuthorized
                  || packet.fixedVariableHeader.reasonCode == Protocol::MQTT::V5::BadAuthenticationMethod)
@@ -1086,53 +2939,89 @@ namespace Network { namespace Client {
                 state = State::Running;
 #if MQTTQoSSupportLevel == 1
                 // Check if we need to resend some unACK'ed packets
-                uint8 resend = buffers.countSentID();
-                if (resend)
+                // As per 4.9 flow control, we can't have more unacknowledged packets than the broker's receive maximum.
+                // The retransmissions are sent back to back within this window and the acknowledgements are processed
+                // as they arrive (either here while waiting for room in the window or later on in the event loop)
+                uint16 window = 65535;
+                index.getValue(Protocol::MQTT::V5::ReceiveMax, window);
+                uint16 inFlight = 0;
+  #if MQTTTLSCoalesceWrites > 0
+                Batch batch(*that());
+  #endif
+                for (uint8 i = 0; i < buffers.end(); i++)
                 {
-                    // Loop over the buffers and resend them
-                    uint8 i = 0;
-                    while (true)
+                    uint32 packetID = buffers.packetID(i);
+                    if (!buffers.isSending(packetID)) continue;
+  #if MQTTMessageExpiry == 1
+                    // Don't retransmit the expired publications
+                    MessageExpiry * expiry = buffers.isQoS2Step2(packetID) ? 0 : findExpiry((uint16)packetID);
+                    const uint32 elapsed = expiry ? (uint32)time(NULL) - expiry->savedAt : 0;
+                    if (expiry && elapsed >= expiry->interval)
+                    {
+                        dropExpired((uint16)packetID);
+                        continue;
+                    }
+  #endif
+
+                    // Wait for an acknowledgement if there's no room in the window
+                    while (inFlight >= window)
+                    {
+                        uint8 before = buffers.countSentID();
+                        if (ErrorType ret = receiveAndDealWithNoise()) return ret;
+                        inFlight -= min((uint16)(before - buffers.countSentID()), inFlight);
+                    }
+
+                    if (buffers.isQoS2Step2(packetID))
+                    {
+                        // We've already received the PUBREC packet so ownership is on the broker.
+                        // We need to resend the PUBREL packet here
+                        Protocol::MQTT::V5::PublishReplyPacket answer(Protocol::MQTT::V5::PUBREL);
+                        answer.fixedVariableHeader.packetID = (uint16)(packetID & 0xFFFF);
+                        if (ErrorType err = prepareSAR(answer, false))
+                            return err;
+                    } else
                     {
-                        uint32 packetID = buffers.packetID(i);
-                        if (buffers.isSending(packetID))
+                        // No PUBACK or no PUBREC received, we need to resend the packet
+                        uint16 id = packetID & 0xFFFF;
+                        const uint8 * packetH = 0, * packetT = 0, * payload = 0; uint32 sizeH = 0, sizeT = 0, sizeP = 0;
+                        if (!storage->loadPacketBuffer(id, packetH, sizeH, packetT, sizeT) || !sizeH)
+                            return ErrorType::StorageError;
+  #if MQTTZeroCopyPublish == 1
+                        // Only the header might be in the storage, send it along the payload in that case
+                        storage->loadPacketPayload(id, payload, sizeP);
+  #endif
+                        // The packet is sent with the DUP flag set, without modifying the storage
+                        uint8 header = packetH[0] | 0x08;
+                        struct iovec parts[7] = { { &header, 1 } };
+                        int count = 1;
+  #if MQTTMessageExpiry == 1
+                        // The remaining interval is sent instead of the saved one
+                        uint8 remaining[4];
+                        if (expiry && elapsed)
                         {
-                            if (buffers.isQoS2Step2(packetID))
-                            {
-                                // We've already received the PUBREC packet so ownership is on the broker.
-                                // We need to resend the PUBREL packet here
-                                Protocol::MQTT::V5::PublishReplyPacket answer(Protocol::MQTT::V5::PUBREL);
-                                answer.fixedVariableHeader.packetID = (uint16)(packetID & 0xFFFF);
-                                if (ErrorType err = prepareSAR(answer, true))
-                                    return err;
-                            } else
-                            {
-                                // No PUBACK or no PUBREC received, we need to resend the packet
-                                uint16 id = packetID & 0xFFFF;
-                                const uint8 * packetH = 0, * packetT = 0; uint32 sizeH = 0, sizeT = 0;
-                                if (!storage->loadPacketBuffer(id, packetH, sizeH, packetT, sizeT))
-                                    return ErrorType::StorageError;
-
-                                // Send the packet and run the event loop to purge the acknowledgement.
-                                ErrorType ret = ErrorType::Success;
-                                if ((ret = sendAndReceive(packetH, sizeH, sizeT == 0)))
-                                    return ret;
-
-                                if (sizeT && (ret = sendAndReceive(packetT, sizeT, true)))
-                                    return ret;
-                            }
-                            // As per 4.9 flow control, we can't send all other packet without processing the
-                            // QoS dance. At this step of communication, we can't receive any PUBLISH packet since
-                            // we haven't subscribed yet. We can only receive DISCONNECT & QoS packets here
-                            if (ErrorType ret = dealWithNoise())
-                                return ret;
-                        }
-                        if (i == buffers.end()) break;
-                        i++; // This works because the buffers is a ring buffer, so when an ID is released in the dealWithNoise() above, the
-                             // position of the next ID don't move. At this step, any new ID will be processed later on.
+                            writeBE32(remaining, expiry->interval - elapsed);
+                            count = appendRange(parts, count, packetH, sizeH, packetT, 1, expiry->offset);
+                            parts[count++] = { remaining, 4 };
+                            count = appendRange(parts, count, packetH, sizeH, packetT, expiry->offset + 4, sizeH + sizeT);
+                        } else
+  #endif
+                        count = appendRange(parts, count, packetH, sizeH, packetT, 1, sizeH + sizeT);
+                        if (sizeP)     parts[count++] = { const_cast<uint8*>(payload), sizeP };
+                        if (ErrorType ret = sendAndReceive(parts, count, false))
+                            return ret;
                     }
+                    inFlight++;
                 }
+  #if MQTTTLSCoalesceWrites > 0
+                if (batch.end() < 0) return ErrorType::NetworkError;
+  #endif
 #else
                 buffers.reset();
+#endif
+                if (ErrorType err = flushReplies())
+                    return err;
+#if MQTTUseReconnect == 1
+                shouldReconnect = reconnectPolicy != nullptr;
 #endif
                 resetState(); // Ok, from now on we can start publishing we aren't in an erroneous state anymore
                 return ErrorType::Success;
@@ -1179,9 +3068,9 @@ namespace Network { namespace Client {
         /** The default timeout in milliseconds */
         uint32                  timeoutMs;
 
-        Impl(const char * clientID, MessageReceived * callback, const DynamicBinDataView * brokerCert,
-             const DynamicBinDataView * clientCert, const DynamicBinDataView * clientKey, PacketStorage * storage)
-             : ImplBase(clientID, callback, brokerCert, clientCert, clientKey, storage), socket(0), timeoutMs(3000) {}
+        Impl(const char * clientID, MessageReceived * callback, PacketStorage * storage, const DynamicBinDataView * brokerCert,
+             const DynamicBinDataView * clientCert, const DynamicBinDataView * clientKey)
+             : ImplBase(clientID, callback, storage, brokerCert, clientCert, clientKey), socket(0), timeoutMs(3000) {}
         ~Impl() { delete0(socket); }
 
         Time::TimeOut getTimeout() const { return timeoutMs; }
@@ -1197,6 +3086,20 @@ namespace Network { namespace Client {
             ScopedLock scope(sendLock);
             return socket->sendReliably(buffer, (int)length, timeoutMs);
         }
+  #if MQTTVectoredSend == 1
+        int sendvImpl(const struct iovec * parts, const int count)
+        {
+            ScopedLock scope(sendLock);
+            int total = 0;
+            for (int i = 0; i < count; i++)
+            {
+                int ret = socket->sendReliably((const char*)parts[i].iov_base, (int)parts[i].iov_len, timeoutMs);
+                if (ret != (int)parts[i].iov_len) return ret < 0 ? ret : -1;
+                total += ret;
+            }
+            return total;
+        }
+  #endif
 
         int connectWith(const char * host, const uint16 port, const bool withTLS)
         {
@@ -1302,7 +3205,7 @@ namespace Network { namespace Client {
     }
 #endif
 
-#if MQTTUseTLS == 1
+#if MQTTUseTLS == 1 || MQTTUseIOUring >= 1
     // Small optimization to remove useless virtual table in the final binary if not used
     #define MQTTVirtual virtual
 #else
@@ -1373,8 +3276,14 @@ namespace Network { namespace Client {
 
         MQTTVirtual int recv(char * buffer, const uint32 minLength, const uint32 maxLength = 0)
         {
+#if MQTTSocketTuning == 1
+            if (profile == (uint8)MQTTv5::TuningProfile::BusyPoll) return spinRecv(buffer, minLength, maxLength);
+#endif
             int ret = ::recv(socket, buffer, minLength, MSG_WAITALL);
             if (ret <= 0) return ret;
+#if MQTTSocketTuning == 1
+            quickAck();
+#endif
             if (maxLength <= minLength) return ret;
 
             int nret = ::recv(socket, &buffer[ret], maxLength - ret, 0);
@@ -1388,10 +3297,27 @@ namespace Network { namespace Client {
 #endif
             return ::send(socket, buffer, (int)length, 0);
         }
+#if MQTTVectoredSend == 1
+        MQTTVirtual int sendv(const struct iovec * parts, const int count)
+        {
+            return ::writev(socket, parts, count);
+        }
+#endif
+#if MQTTTLSCoalesceWrites > 0
+        /** Hold (or release) the written data so it's packed in as few TLS records as possible. Plain sockets don't hold anything
+            @return A negative value if the pending data can't be sent upon release */
+        MQTTVirtual int cork(const bool) { return 0; }
+        /** Send the pending data now, @return A negative value upon error */
+        MQTTVirtual int flush() { return 0; }
+#endif
 
         // Useful socket helpers functions here
         MQTTVirtual int select(bool reading, bool writing, const uint32 timeoutMillis = (uint32)-1)
         {
+#if MQTTSocketTuning == 1
+            if (reading && !writing && profile == (uint8)MQTTv5::TuningProfile::BusyPoll)
+                return spinWait(timeoutMillis == (uint32)-1 ? timeoutInMs(timeoutMs) : timeoutMillis);
+#endif
             // Linux modifies the timeout when calling select
             struct timeval v = timeoutMillis == (uint32)-1 ? timeoutMs : timeoutFromMs(timeoutMillis);
 
@@ -1402,12 +3328,533 @@ namespace Network { namespace Client {
             return ::select(socket + 1, reading ? &set : NULL, writing ? &set : NULL, NULL, &v);
         }
 
+#if MQTTSocketTuning == 1
+        /** The tuning profile, @sa MQTTv5::TuningProfile */
+        uint8   profile;
+
+        /** Apply the tuning profile's options to the socket.
+            The kernel can refuse the busy polling duration (it requires privileges to go above the system's default), so it's not an error */
+        bool tune()
+        {
+            if (socket == -1) return true;
+            const bool lowLatency = profile != (uint8)MQTTv5::TuningProfile::Default;
+  #ifdef SO_BUSY_POLL
+            int busyPoll = lowLatency ? TuningBusyPollUs : 0;
+            ::setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &busyPoll, sizeof(busyPoll));
+  #endif
+  #ifdef TCP_NOTSENT_LOWAT
+            int lowAt = lowLatency ? TuningNotSentLowAt : 0; // 0 is the system's default
+            if (::setsockopt(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowAt, sizeof(lowAt)) < 0) return false;
+  #endif
+            quickAck();
+            return true;
+        }
+
+        /** Enter the quick acknowledgement mode again, since the kernel leaves it by itself */
+        inline void quickAck()
+        {
+  #ifdef TCP_QUICKACK
+            if (profile == (uint8)MQTTv5::TuningProfile::Default) return;
+            int flag = 1;
+            ::setsockopt(socket, IPPROTO_TCP, TCP_QUICKACK, &flag, sizeof(flag));
+  #endif
+        }
+
+        /** Spin until some data is available to read (or the socket is closed or in error)
+            @return 1 if the socket is readable, 0 upon timeout */
+        int spinWait(const uint32 timeoutMillis)
+        {
+            const uint32 start = getTimeMs();
+            uint32 spins = 0;
+            char c;
+            while (true)
+            {
+                int ret = ::recv(socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+                if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return 1;
+                // Only check the time once in a while, it's a system call on some platforms
+                if (!timeoutMillis || ((++spins & 0xFF) == 0 && getTimeMs() - start >= timeoutMillis)) return 0;
+            }
+        }
+
+        /** Receive with non blocking calls in a loop, until the minimum length is received or the timeout expires */
+        int spinRecv(char * buffer, const uint32 minLength, const uint32 maxLength)
+        {
+            const uint32 wanted = maxLength > minLength ? maxLength : minLength, timeout = timeoutInMs(timeoutMs);
+            const uint32 start = getTimeMs();
+            uint32 got = 0, spins = 0;
+            while (got < minLength)
+            {
+                int ret = ::recv(socket, &buffer[got], wanted - got, MSG_DONTWAIT);
+                if (ret > 0) { got += (uint32)ret; continue; }
+                if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return got ? (int)got : ret;
+                if ((++spins & 0xFF) == 0 && getTimeMs() - start >= timeout) { errno = EWOULDBLOCK; return got ? (int)got : -1; }
+            }
+            quickAck();
+            return (int)got;
+        }
+
+        BaseSocket(struct timeval & timeoutMs) : socket(-1), timeoutMs(timeoutMs), profile(0) {}
+#else
         BaseSocket(struct timeval & timeoutMs) : socket(-1), timeoutMs(timeoutMs) {}
+#endif
         MQTTVirtual ~BaseSocket() { ::closesocket(socket); socket = -1; }
     };
 
 
+#if MQTTUseIOUring >= 1
+    /** A minimal io_uring instance, only using the system calls (so liburing isn't required) */
+    struct URing
+    {
+        /** The ring's file descriptor */
+        int                     fd;
+        /** The submission queue ring's shared indexes */
+        unsigned *              sqHead, * sqTail, * sqMask, * sqFlags, * sqArray;
+        /** The completion queue ring's shared indexes */
+        unsigned *              cqHead, * cqTail, * cqMask;
+        /** The submission queue entries */
+        struct io_uring_sqe *   sqes;
+        /** The completion queue entries */
+        struct io_uring_cqe *   cqes;
+        /** The mapped memory */
+        void *                  sqRing, * cqRing;
+        size_t                  sqRingSize, cqRingSize, sqesSize;
+        /** The number of entries in the submission queue */
+        unsigned                entries;
+        /** The tail of the prepared entries (not yet published to the kernel) */
+        unsigned                prepared;
+        /** Whether a kernel thread polls the submission queue */
+        bool                    polled;
+
+        bool open(const unsigned count, const bool sqPoll)
+        {
+            struct io_uring_params params = {};
+            if (sqPoll) { params.flags |= IORING_SETUP_SQPOLL; params.sq_thread_idle = URingPollIdleMs; }
+            fd = (int)::syscall(__NR_io_uring_setup, count, &params);
+            if (fd < 0) return false;
+            // Timeouts when waiting for completions are required
+            if (!(params.features & IORING_FEAT_EXT_ARG)) return false;
+            polled = sqPoll;
+
+            sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+            const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single) sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+
+            sqRing = ::mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sqRing == MAP_FAILED) { sqRing = 0; return false; }
+            if (single) cqRing = sqRing;
+            else
+            {
+                cqRing = ::mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                if (cqRing == MAP_FAILED) { cqRing = 0; return false; }
+            }
+            sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+            void * map = ::mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (map == MAP_FAILED) return false;
+            sqes = (struct io_uring_sqe *)map;
+
+            uint8 * sq = (uint8*)sqRing, * cq = (uint8*)cqRing;
+            sqHead = (unsigned*)(sq + params.sq_off.head);
+            sqTail = (unsigned*)(sq + params.sq_off.tail);
+            sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+            sqFlags = (unsigned*)(sq + params.sq_off.flags);
+            sqArray = (unsigned*)(sq + params.sq_off.array);
+            cqHead = (unsigned*)(cq + params.cq_off.head);
+            cqTail = (unsigned*)(cq + params.cq_off.tail);
+            cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+            cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+            entries = params.sq_entries;
+            prepared = *sqTail;
+            return true;
+        }
+
+        void close()
+        {
+            if (sqes) ::munmap(sqes, sqesSize);
+            if (cqRing && cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+            if (sqRing) ::munmap(sqRing, sqRingSize);
+            if (fd >= 0) ::close(fd);
+            sqes = 0; sqRing = cqRing = 0; fd = -1;
+        }
+
+        /** Register resources with the ring */
+        bool registerWith(const unsigned opcode, const void * arg, const unsigned count)
+        {
+            return ::syscall(__NR_io_uring_register, fd, opcode, arg, count) == 0;
+        }
+
+        /** Get a cleared submission queue entry or 0 if the queue is full */
+        struct io_uring_sqe * getSQE()
+        {
+            if (prepared - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= entries) return 0;
+            const unsigned index = prepared & *sqMask;
+            sqArray[index] = index;
+            prepared++;
+            memset(&sqes[index], 0, sizeof(sqes[index]));
+            return &sqes[index];
+        }
+
+        /** Submit the prepared entries and wait for the given number of completions
+            @param waitFor          The number of completions to wait for (can be 0)
+            @param timeoutMillis    The maximum time to wait for, in milliseconds
+            @return The number of submitted entries or a negative errno value (-ETIME upon timeout) */
+        int submitAndWait(const unsigned waitFor, const uint32 timeoutMillis)
+        {
+            const unsigned toSubmit = prepared - *sqTail;
+            __atomic_store_n(sqTail, prepared, __ATOMIC_RELEASE);
+            unsigned flags = waitFor ? IORING_ENTER_GETEVENTS : 0;
+            if (polled)
+            {   // The polling thread picks the entries by itself, unless it's sleeping
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                if (__atomic_load_n(sqFlags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) flags |= IORING_ENTER_SQ_WAKEUP;
+                else if (!waitFor) return (int)toSubmit;
+            }
+            else if (!toSubmit && !waitFor) return 0;
+
+            struct __kernel_timespec ts = { (int64)(timeoutMillis / 1000), (long long)(timeoutMillis % 1000) * 1000000 };
+            struct io_uring_getevents_arg arg = {};
+            arg.ts = (uint64)(uintptr_t)&ts;
+            int ret = (int)::syscall(__NR_io_uring_enter, fd, toSubmit, waitFor, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+            return ret < 0 ? -errno : ret;
+        }
+
+        /** Get the next completion queue entry or 0 if none is available */
+        struct io_uring_cqe * peek()
+        {
+            const unsigned head = *cqHead;
+            if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return 0;
+            return &cqes[head & *cqMask];
+        }
+        /** Mark the entry returned by peek as consumed */
+        void seen() { __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE); }
+
+        URing() : fd(-1), sqHead(0), sqTail(0), sqMask(0), sqFlags(0), sqArray(0), cqHead(0), cqTail(0), cqMask(0), sqes(0), cqes(0),
+                  sqRing(0), cqRing(0), sqRingSize(0), cqRingSize(0), sqesSize(0), entries(0), prepared(0), polled(false) {}
+        ~URing() { close(); }
+    };
+
+    /** A plain socket whose data is sent and received with io_uring.
+        The receiving ring has a single multishot receive request armed, the kernel fills the provided buffers
+        as the data arrives and the recv method copies from them.
+        The sending ring sends from a registered buffer, or with linked requests for vectored packets.
+        Sending and receiving use different rings, since they happen from different threads */
+    class URingSocket : public BaseSocket
+    {
+        /** The receiving and sending rings */
+        URing                       recvRing, sendRing;
+        /** The mapped memory for the provided buffers' ring, followed by the receiving buffers and the registered sending buffer */
+        uint8 *                     area;
+        /** The provided buffers' ring */
+        struct io_uring_buf_ring *  bufRing;
+        /** The provided buffers' ring tail */
+        uint16                      bufTail;
+        /** The buffer being consumed (or -1), the current position in it and its length */
+        int                         current;
+        uint32                      offset, length;
+        /** Whether the multishot receive request is armed */
+        bool                        armed;
+        /** Whether the connection was closed by the broker */
+        bool                        closed;
+
+    private:
+        enum { RecvTag = 1, CancelTag = 0xFFFF };
+        static size_t ringSize() { return 4096; }
+        static size_t areaSize() { return ringSize() + (URingBufferCount + 1) * URingBufferSize; }
+        uint8 * sendBuffer() { return area + ringSize() + URingBufferCount * URingBufferSize; }
+
+        /** Give back a receiving buffer to the kernel */
+        void recycle(const uint16 id)
+        {
+            // The kernel header's flexible array isn't at the start of the structure when compiled as C++, so index the ring directly
+            struct io_uring_buf & buf = ((struct io_uring_buf *)bufRing)[bufTail & (URingBufferCount - 1)];
+            buf.addr = (uint64)(uintptr_t)(area + ringSize() + id * URingBufferSize);
+            buf.len = URingBufferSize;
+            buf.bid = id;
+            __atomic_store_n(&bufRing->tail, ++bufTail, __ATOMIC_RELEASE);
+        }
+
+        /** Arm the multishot receive request */
+        bool arm()
+        {
+            struct io_uring_sqe * sqe = recvRing.getSQE();
+            if (!sqe) return false;
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = socket;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = 0;
+            sqe->user_data = RecvTag;
+            armed = recvRing.submitAndWait(0, 0) >= 0;
+            return armed;
+        }
+
+        /** Wait for the next filled buffer
+            @return The number of bytes in the buffer, 0 if the connection was closed, -1 upon error or timeout (errno is EWOULDBLOCK then) */
+        int fill(const uint32 timeoutMillis)
+        {
+            while (!closed)
+            {
+                if (!armed && !arm()) return -1;
+                struct io_uring_cqe * cqe = recvRing.peek();
+                if (!cqe)
+                {
+                    int ret = recvRing.submitAndWait(1, timeoutMillis);
+                    if (ret == -ETIME || (ret >= 0 && !recvRing.peek())) { errno = EWOULDBLOCK; return -1; }
+                    if (ret < 0 && ret != -EINTR) { errno = -ret; return -1; }
+                    continue;
+                }
+                const int res = cqe->res;
+                const unsigned flags = cqe->flags;
+                recvRing.seen();
+                if (!(flags & IORING_CQE_F_MORE)) armed = false;
+                // All buffers were in use, so the request was stopped, arm it again (the data is still in the socket)
+                if (res == -ENOBUFS) continue;
+                if (res < 0) { errno = -res; return -1; }
+                if (res == 0) break;
+                current = (int)(flags >> IORING_CQE_BUFFER_SHIFT);
+                offset = 0; length = (uint32)res;
+                return res;
+            }
+            closed = true;
+            return 0;
+        }
+
+        /** Wait for the completion of the given number of sending requests
+            @return The number of bytes sent or -1 upon error */
+        int reap(const unsigned count)
+        {
+            int total = 0, error = 0;
+            unsigned done = 0, expected = count;
+            bool cancelled = false;
+            while (done < expected)
+            {
+                struct io_uring_cqe * cqe = sendRing.peek();
+                if (!cqe)
+                {
+                    int ret = sendRing.submitAndWait(expected - done, cancelled ? (uint32)-1 : timeoutInMs(timeoutMs));
+                    if (ret == -ETIME && !cancelled)
+                    {   // Cancel all pending requests and wait for their completion
+                        struct io_uring_sqe * sqe = sendRing.getSQE();
+                        if (!sqe) return -1;
+                        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+                        sqe->user_data = CancelTag;
+                        cancelled = true; error = EWOULDBLOCK;
+                        expected++;
+                    }
+                    else if (ret < 0 && ret != -EINTR && ret != -ETIME) { errno = -ret; return -1; }
+                    continue;
+                }
+                if (cqe->user_data != CancelTag)
+                {
+                    if (cqe->res > 0) total += cqe->res;
+                    else if (!error) error = cqe->res < 0 ? -cqe->res : EPIPE;
+                }
+                sendRing.seen();
+                done++;
+            }
+            if (error && !total) { errno = error; return -1; }
+            return total;
+        }
+
+        /** Prepare a sending request */
+        bool prepareSend(const void * buffer, const uint32 size, const bool linked, const bool registered)
+        {
+            struct io_uring_sqe * sqe = sendRing.getSQE();
+            if (!sqe) return false;
+            sqe->opcode = registered ? IORING_OP_WRITE_FIXED : IORING_OP_SEND;
+            sqe->fd = socket;
+            sqe->addr = (uint64)(uintptr_t)buffer;
+            sqe->len = size;
+            if (registered) { sqe->off = (uint64)-1; sqe->buf_index = 0; }
+            else sqe->msg_flags = MSG_WAITALL;
+            sqe->flags = linked ? IOSQE_IO_LINK : 0;
+            return true;
+        }
+
+        /** Use the plain socket's calls instead of io_uring (when the kernel doesn't support it or forbids it)
+            @return 0 since the connection is still usable */
+        int fallBack()
+        {
+            recvRing.close();
+            sendRing.close();
+            if (area) ::munmap(area, areaSize());
+            area = 0; bufRing = 0;
+            return 0;
+        }
+        /** Check if io_uring is used for this connection */
+        inline bool usesRings() const { return recvRing.fd >= 0; }
+
+    public:
+        int connect(const char * host, uint16 port, const MQTTv5::DynamicBinDataView * brokerCert, const MQTTv5::DynamicBinDataView * clientCert, const MQTTv5::DynamicBinDataView * clientKey)
+        {
+            int ret = BaseSocket::connect(host, port, brokerCert, clientCert, clientKey);
+            if (ret) return ret;
+
+            // Only the sending ring is polled by the kernel, the receiving ring has a long lived request
+            if (!recvRing.open(4, false) || !sendRing.open(URingSendEntries, MQTTUseIOUring == 2)) return fallBack();
+            void * map = ::mmap(0, areaSize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (map == MAP_FAILED) return fallBack();
+            area = (uint8*)map;
+            bufRing = (struct io_uring_buf_ring *)area;
+
+            // Register the provided buffers' ring and fill it
+            struct io_uring_buf_reg reg = {};
+            reg.ring_addr = (uint64)(uintptr_t)bufRing;
+            reg.ring_entries = URingBufferCount;
+            reg.bgid = 0;
+            if (!recvRing.registerWith(IORING_REGISTER_PBUF_RING, &reg, 1)) return fallBack();
+            for (uint16 i = 0; i < URingBufferCount; i++) recycle(i);
+
+            // Register the sending buffer
+            struct iovec iov = { sendBuffer(), URingBufferSize };
+            if (!sendRing.registerWith(IORING_REGISTER_BUFFERS, &iov, 1)) return fallBack();
+            return 0;
+        }
+
+        int recv(char * buffer, const uint32 minLength, const uint32 maxLength = 0)
+        {
+            if (!usesRings()) return BaseSocket::recv(buffer, minLength, maxLength);
+            const uint32 wanted = maxLength > minLength ? maxLength : minLength;
+            uint32 got = 0;
+            while (got < wanted)
+            {
+                if (current < 0)
+                {   // Once the minimum length is received, only take what's already available
+                    int ret = fill(got < minLength ? timeoutInMs(timeoutMs) : 0);
+                    if (ret <= 0)
+                    {
+                        if (got >= minLength) break;
+                        return got ? (int)got : ret;
+                    }
+                }
+                uint32 size = length - offset < wanted - got ? length - offset : wanted - got;
+                memcpy(&buffer[got], area + ringSize() + current * URingBufferSize + offset, size);
+                offset += size; got += size;
+                if (offset == length) { recycle((uint16)current); current = -1; }
+            }
+            return (int)got;
+        }
+
+        int send(const char * buffer, const uint32 length)
+        {
+            if (!usesRings()) return BaseSocket::send(buffer, length);
+#if MQTTDumpCommunication == 1
+            dumpBufferAsPacket("> Sending packet", (const uint8*)buffer, length);
+#endif
+            uint32 sent = 0;
+            if (length <= URingBufferSize)
+            {   // Small packets are copied in the registered buffer, so the kernel doesn't need to map the pages for each request
+                memcpy(sendBuffer(), buffer, length);
+                if (!prepareSend(sendBuffer(), length, false, true)) return -1;
+                int ret = reap(1);
+                if (ret < 0) return ret;
+                sent = (uint32)ret;
+            }
+            // Writing to a socket can be partial
+            while (sent < length)
+            {
+                if (!prepareSend(buffer + sent, length - sent, false, false)) return -1;
+                int ret = reap(1);
+                if (ret < 0) return sent ? (int)sent : ret;
+                sent += (uint32)ret;
+            }
+            return (int)sent;
+        }
+#if MQTTVectoredSend == 1
+        int sendv(const struct iovec * parts, const int count)
+        {
+            if (!usesRings() || count > URingSendEntries) return BaseSocket::sendv(parts, count);
+            // Send all parts with a single system call. They are linked so they are sent in order and a failure cancels the next ones
+            for (int i = 0; i < count; i++)
+                if (!prepareSend(parts[i].iov_base, (uint32)parts[i].iov_len, i + 1 < count, false)) return -1;
+            return reap((unsigned)count);
+        }
+#endif
+
+        int select(bool reading, bool writing, const uint32 timeoutMillis = (uint32)-1)
+        {
+            if (!reading || !usesRings()) return BaseSocket::select(reading, writing, timeoutMillis);
+            // The data is received by the kernel in the buffers, so the socket itself is never readable
+            if (current >= 0 || closed) return 1;
+            int ret = fill(timeoutMillis == (uint32)-1 ? timeoutInMs(timeoutMs) : timeoutMillis);
+            if (ret < 0) return errno == EWOULDBLOCK ? 0 : -1;
+            return 1;
+        }
+
+        URingSocket(struct timeval & timeoutMs) : BaseSocket(timeoutMs), area(0), bufRing(0), bufTail(0), current(-1), offset(0), length(0), armed(false), closed(false) {}
+        ~URingSocket()
+        {
+            // Stop the requests before the socket is closed
+            recvRing.close();
+            sendRing.close();
+            if (area) ::munmap(area, areaSize());
+            area = 0;
+        }
+    };
+#endif
+
 #if MQTTUseTLS == 1
+  #if MQTTTLSSessionCache > 0
+    /** The process wide cache of the TLS sessions negotiated with the brokers, @sa MQTTTLSSessionCache.
+        The sessions are copied in and out of the cache (mbedtls deep copies them), so a connection never shares its session */
+    struct TLSSessions : public TLSSessionCache<mbedtls_ssl_session, MQTTTLSSessionCache>
+    {
+        Lock   lock;
+
+        /** Hash the connection's certificates (FNV-1a) */
+        static uint32 hashOf(const MQTTv5::DynamicBinDataView * brokerCert, const MQTTv5::DynamicBinDataView * clientCert)
+        {
+            uint32 hash = 2166136261U;
+            const MQTTv5::DynamicBinDataView * certs[2] = { brokerCert, clientCert };
+            for (uint8 i = 0; i < 2; i++)
+            {
+                if (!certs[i]) { hash = (hash ^ 0xFF) * 16777619U; continue; }
+                for (uint32 j = 0; j < certs[i]->length; j++) hash = (hash ^ certs[i]->data[j]) * 16777619U;
+            }
+            return hash;
+        }
+
+        /** Set the cached session (if any) on the given context before the handshake */
+        bool load(mbedtls_ssl_context & ssl, const char * host, const uint16 port, const uint32 certHash)
+        {
+            ScopedLock scope(lock);
+            Entry * entry = use(host, port, certHash);
+            return entry && ::mbedtls_ssl_set_session(&ssl, &entry->session) == 0;
+        }
+        /** Save the session of the given context after the handshake (or upon receiving a new ticket) */
+        void save(mbedtls_ssl_context & ssl, const char * host, const uint16 port, const uint32 certHash)
+        {
+            ScopedLock scope(lock);
+            Entry & entry = assign(host, port, certHash);
+            forget(entry);
+            entry.valid = ::mbedtls_ssl_get_session(&ssl, &entry.session) == 0;
+        }
+
+        /** Free the given entry's session */
+        static void forget(Entry & entry)
+        {
+            if (entry.valid) ::mbedtls_ssl_session_free(&entry.session);
+            ::mbedtls_ssl_session_init(&entry.session);
+            entry.valid = false;
+        }
+        void forgetAll()
+        {
+            ScopedLock scope(lock);
+            for (uint32 i = 0; i < MQTTTLSSessionCache; i++) forget(entries[i]);
+        }
+
+        TLSSessions()
+        {
+            for (uint32 i = 0; i < MQTTTLSSessionCache; i++) ::mbedtls_ssl_session_init(&entries[i].session);
+        }
+        ~TLSSessions() { forgetAll(); }
+
+        /** The process wide instance */
+        static TLSSessions & instance() { static TLSSessions cache; return cache; }
+    };
+  #endif
+
     class MBTLSSocket : public BaseSocket
     {
         mbedtls_entropy_context entropy;
@@ -1418,8 +3865,181 @@ namespace Network { namespace Client {
         mbedtls_x509_crt owncert;
         mbedtls_pk_context pkey;
         mbedtls_net_context net;
+  #if MQTTTLSSessionCache > 0
+        /** The broker's host (copied from the connection's parameters) and port and the certificates' hash for the session cache */
+        char    host[64];
+        uint16  port;
+        uint32  certHash;
+  #endif
+  #if MQTTTLSCoalesceWrites > 0
+        /** The data written while corked, sent in as few TLS records as possible */
+        uint8   pending[MQTTTLSCoalesceWrites];
+        uint32  pendingSize;
+        /** The cork's nesting level */
+        uint32  corked;
+  #endif
+  #if MQTTUseKTLS == 1
+        /** The TLS 1.2 key block (client and server write keys, then client and server IVs, there's no MAC key with AEAD ciphers) */
+        uint8   keyBlock[2 * 32 + 2 * 12];
+    #if MBEDTLS_VERSION_MAJOR >= 3
+        /** The master secret, the randoms (server's then client's) and the PRF, to compute the key block after the handshake */
+        uint8   masterSecret[48];
+        uint8   randoms[64];
+        mbedtls_tls_prf_types prf;
+    #endif
+        /** Were the keys exported by mbedtls ? */
+        bool    keysExported;
+        /** Are the records encrypted (TX) and decrypted (RX) by the kernel ? */
+        bool    txOffloaded, rxOffloaded;
+  #endif
+
+    private:
+  #if MQTTUseKTLS == 1
+    #if MBEDTLS_VERSION_MAJOR >= 3
+        static void exportKeys(void * token, mbedtls_ssl_key_export_type type, const unsigned char * secret, size_t length,
+                               const unsigned char clientRandom[32], const unsigned char serverRandom[32], mbedtls_tls_prf_types prf)
+        {
+            MBTLSSocket & s = *(MBTLSSocket*)token;
+            if (type != MBEDTLS_SSL_KEY_EXPORT_TLS12_MASTER_SECRET || length != sizeof(s.masterSecret)) return;
+            memcpy(s.masterSecret, secret, length);
+            memcpy(s.randoms, serverRandom, 32);
+            memcpy(s.randoms + 32, clientRandom, 32);
+            s.prf = prf;
+            s.keysExported = true;
+        }
+    #else
+        static int exportKeys(void * token, const unsigned char *, const unsigned char * keyBlock, size_t macLength, size_t keyLength,
+                              size_t ivLength, const unsigned char *, const unsigned char *, mbedtls_tls_prf_types)
+        {
+            MBTLSSocket & s = *(MBTLSSocket*)token;
+            // Only AEAD ciphers (without MAC key) can be offloaded
+            if (macLength || keyLength > 32 || ivLength > 12) return 0;
+            memcpy(s.keyBlock, keyBlock, 2 * (keyLength + ivLength));
+            s.keysExported = true;
+            return 0;
+        }
+    #endif
+
+        /** Give the record layer to the kernel once the handshake is done.
+            Only TLS 1.2 with AES-GCM or ChaCha20-Poly1305 can be offloaded. If the kernel refuses the receiving side, nothing is
+            changed. If it refuses the sending side only, mbedtls still encrypts the records (both sides are independent) */
+        void offload()
+        {
+            if (!keysExported || strcmp(::mbedtls_ssl_get_version(&ssl), "TLSv1.2")) return;
+            // The data mbedtls would have already read from the socket would be lost
+            if (::mbedtls_ssl_get_bytes_avail(&ssl) || ::mbedtls_ssl_check_pending(&ssl)) return;
+
+            const char * suite = ::mbedtls_ssl_get_ciphersuite(&ssl);
+            uint16 cipher = 0; uint32 keyLength = 0, ivLength = 4;
+            if (strstr(suite, "AES-128-GCM"))               { cipher = TLS_CIPHER_AES_GCM_128; keyLength = 16; }
+            else if (strstr(suite, "AES-256-GCM"))          { cipher = TLS_CIPHER_AES_GCM_256; keyLength = 32; }
+    #ifdef TLS_CIPHER_CHACHA20_POLY1305
+            else if (strstr(suite, "CHACHA20-POLY1305"))    { cipher = TLS_CIPHER_CHACHA20_POLY1305; keyLength = 32; ivLength = 12; }
+    #endif
+            if (!cipher) return;
+    #if MBEDTLS_VERSION_MAJOR >= 3
+            if (::mbedtls_ssl_tls_prf(prf, masterSecret, sizeof(masterSecret), "key expansion", randoms, sizeof(randoms), keyBlock, 2 * (keyLength + ivLength)))
+                return;
+    #endif
+            // Both sides have sent their Finished message (the first record with these keys), so the next record is the second one
+            const uint8 sequence[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+            union CryptoInfo
+            {
+                struct tls12_crypto_info_aes_gcm_128 gcm128;
+                struct tls12_crypto_info_aes_gcm_256 gcm256;
+    #ifdef TLS_CIPHER_CHACHA20_POLY1305
+                struct tls12_crypto_info_chacha20_poly1305 chacha;
+    #endif
+            } infos[2];
+            socklen_t infoSize = 0;
+            for (uint8 i = 0; i < 2; i++)
+            {   // The client's keys for sending, the server's keys for receiving
+                CryptoInfo & info = infos[i];
+                const uint8 * key = keyBlock + i * keyLength, * iv = keyBlock + 2 * keyLength + i * ivLength;
+                memset(&info, 0, sizeof(info));
+                info.gcm128.info.version = TLS_1_2_VERSION;
+                info.gcm128.info.cipher_type = cipher;
+                switch (cipher)
+                {
+                case TLS_CIPHER_AES_GCM_128:
+                    memcpy(info.gcm128.key, key, keyLength); memcpy(info.gcm128.salt, iv, ivLength);
+                    // The explicit nonce starts with the sequence number (like mbedtls does)
+                    memcpy(info.gcm128.iv, sequence, 8); memcpy(info.gcm128.rec_seq, sequence, 8);
+                    infoSize = sizeof(info.gcm128);
+                    break;
+                case TLS_CIPHER_AES_GCM_256:
+                    memcpy(info.gcm256.key, key, keyLength); memcpy(info.gcm256.salt, iv, ivLength);
+                    memcpy(info.gcm256.iv, sequence, 8); memcpy(info.gcm256.rec_seq, sequence, 8);
+                    infoSize = sizeof(info.gcm256);
+                    break;
+    #ifdef TLS_CIPHER_CHACHA20_POLY1305
+                default:
+                    memcpy(info.chacha.key, key, keyLength); memcpy(info.chacha.iv, iv, ivLength);
+                    memcpy(info.chacha.rec_seq, sequence, 8);
+                    infoSize = sizeof(info.chacha);
+                    break;
+    #endif
+                }
+            }
+            if (::setsockopt(socket, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) return;
+            rxOffloaded = ::setsockopt(socket, SOL_TLS, TLS_RX, &infos[1], infoSize) == 0;
+            if (!rxOffloaded) return;
+            txOffloaded = ::setsockopt(socket, SOL_TLS, TLS_TX, &infos[0], infoSize) == 0;
+            // The plain receiving path relies on the socket's timeouts that were removed for mbedtls
+            ::setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeoutMs, sizeof(timeoutMs));
+            ::setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeoutMs, sizeof(timeoutMs));
+            // Don't leave the keys in memory longer than needed
+            memset(keyBlock, 0, sizeof(keyBlock));
+    #if MBEDTLS_VERSION_MAJOR >= 3
+            memset(masterSecret, 0, sizeof(masterSecret));
+    #endif
+        }
+
+        /** Send a close notify alert through the kernel */
+        void closeNotify()
+        {
+            const uint8 alert[2] = { 1, 0 }; // Warning, close notify
+            char control[CMSG_SPACE(sizeof(uint8))] = {};
+            struct iovec part = { const_cast<uint8*>(alert), sizeof(alert) };
+            struct msghdr msg = {};
+            msg.msg_iov = &part; msg.msg_iovlen = 1;
+            msg.msg_control = control; msg.msg_controllen = sizeof(control);
+            struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_TLS; cmsg->cmsg_type = TLS_SET_RECORD_TYPE; cmsg->cmsg_len = CMSG_LEN(sizeof(uint8));
+            *CMSG_DATA(cmsg) = 21; // Alert
+            ::sendmsg(socket, &msg, 0);
+        }
+  #endif
+
+        /** Write the whole buffer (mbedtls writes at most a record per call) */
+        int writeAll(const uint8 * buffer, const uint32 length)
+        {
+            uint32 written = 0;
+            while (written < length)
+            {
+  #if MQTTUseKTLS == 1
+                int ret = txOffloaded ? (int)::send(socket, buffer + written, length - written, 0) : ::mbedtls_ssl_write(&ssl, buffer + written, length - written);
+  #else
+                int ret = ::mbedtls_ssl_write(&ssl, buffer + written, length - written);
+  #endif
+                if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) continue;
+                if (ret <= 0) return written ? (int)written : ret;
+                written += (uint32)ret;
+            }
+            return (int)written;
+        }
+  #if MQTTTLSCoalesceWrites > 0
+        /** Append the given data to the pending buffer, sending the pending data first if it doesn't fit
+            @return false if the data doesn't fit in an empty buffer or the pending data can't be sent */
+        bool append(const uint8 * buffer, const uint32 length)
+        {
+            if (pendingSize + length > sizeof(pending) && (length > sizeof(pending) || flush() < 0)) return false;
+            memcpy(&pending[pendingSize], buffer, length);
+            pendingSize += length;
+            return true;
+        }
+  #endif
 
-    private:
         bool buildConf(const MQTTv5::DynamicBinDataView * brokerCert,
                        const MQTTv5::DynamicBinDataView * clientCert = nullptr,
                        const MQTTv5::DynamicBinDataView * clientKey = nullptr)
@@ -1458,15 +4078,33 @@ namespace Network { namespace Client {
                     return false;
             }
 
+  #if MQTTUseKTLS == 1 && MBEDTLS_VERSION_MAJOR < 3
+            ::mbedtls_ssl_conf_export_keys_ext_cb(&conf, exportKeys, this);
+  #endif
             if (::mbedtls_ssl_setup(&ssl, &conf))
                 return false;
+  #if MQTTUseKTLS == 1 && MBEDTLS_VERSION_MAJOR >= 3
+            ::mbedtls_ssl_set_export_keys_cb(&ssl, exportKeys, this);
+  #endif
 
             return true;
         }
 
     public:
         MBTLSSocket(struct timeval & timeoutMs) : BaseSocket(timeoutMs)
+  #if MQTTTLSSessionCache > 0
+            , port(0), certHash(0)
+  #endif
+  #if MQTTTLSCoalesceWrites > 0
+            , pendingSize(0), corked(0)
+  #endif
+  #if MQTTUseKTLS == 1
+            , keysExported(false), txOffloaded(false), rxOffloaded(false)
+  #endif
         {
+  #if MQTTTLSSessionCache > 0
+            host[0] = 0;
+  #endif
             mbedtls_ssl_init(&ssl);
             mbedtls_ssl_config_init(&conf);
             mbedtls_x509_crt_init(&cacert);
@@ -1491,6 +4129,15 @@ namespace Network { namespace Client {
 
             if (!buildConf(brokerCert, clientCert, clientKey))                      return -8;
             if (::mbedtls_ssl_set_hostname(&ssl, host))                             return -9;
+  #if MQTTTLSSessionCache > 0
+            // Resume the previous session with this broker if there's one (the host names that are too long aren't cached)
+            if (strlen(host) < sizeof(this->host))
+            {
+                strcpy(this->host, host); this->port = port;
+                certHash = TLSSessions::hashOf(brokerCert, clientCert);
+                TLSSessions::instance().load(ssl, this->host, port, certHash);
+            }
+  #endif
 
             // Set the method the SSL engine is using to fetch/send data to the other side
             ::mbedtls_ssl_set_bio(&ssl, &net, ::mbedtls_net_send, NULL, ::mbedtls_net_recv_timeout);
@@ -1513,6 +4160,12 @@ namespace Network { namespace Client {
                     return -11;
                 }
             }
+  #if MQTTTLSSessionCache > 0
+            if (ret == 0 && this->host[0]) TLSSessions::instance().save(ssl, this->host, port, certHash);
+  #endif
+  #if MQTTUseKTLS == 1
+            if (ret == 0) offload();
+  #endif
             return 0;
         }
 
@@ -1521,11 +4174,67 @@ namespace Network { namespace Client {
 #if MQTTDumpCommunication == 1
             dumpBufferAsPacket("> Sending packet", (const uint8*)buffer, length);
 #endif
-            return ::mbedtls_ssl_write(&ssl, (const uint8*)buffer, length);
+  #if MQTTTLSCoalesceWrites > 0
+            if (corked && append((const uint8*)buffer, length)) return (int)length;
+            if (flush() < 0) return -1;
+  #endif
+            return writeAll((const uint8*)buffer, length);
+        }
+  #if MQTTVectoredSend == 1
+        int sendv(const struct iovec * parts, const int count)
+        {
+    #if MQTTUseKTLS == 1 && MQTTTLSCoalesceWrites > 0
+            // The kernel packs the parts in records by itself, without copying them
+            if (txOffloaded && !corked && !pendingSize) return BaseSocket::sendv(parts, count);
+    #elif MQTTUseKTLS == 1
+            if (txOffloaded) return BaseSocket::sendv(parts, count);
+    #endif
+            int total = 0;
+    #if MQTTTLSCoalesceWrites > 0
+            // Pack the parts in the pending buffer so they are sent in a single record (this only copies them earlier than mbedtls does)
+            uint32 size = 0;
+            for (int i = 0; i < count; i++) size += (uint32)parts[i].iov_len;
+            if (size <= sizeof(pending))
+            {
+                if (pendingSize + size > sizeof(pending) && flush() < 0) return -1;
+                for (int i = 0; i < count; i++) append((const uint8*)parts[i].iov_base, (uint32)parts[i].iov_len);
+                if (!corked && flush() < 0) return -1;
+                return (int)size;
+            }
+            if (flush() < 0) return -1;
+    #endif
+            // The TLS layer is copying the data in its own records anyway
+            for (int i = 0; i < count; i++)
+            {
+                int ret = writeAll((const uint8*)parts[i].iov_base, (uint32)parts[i].iov_len);
+                if (ret != (int)parts[i].iov_len) return ret < 0 ? ret : -1;
+                total += ret;
+            }
+            return total;
+        }
+  #endif
+  #if MQTTTLSCoalesceWrites > 0
+        int cork(const bool enable)
+        {
+            if (enable) { corked++; return 0; }
+            if (corked && --corked) return 0;
+            return flush();
+        }
+        int flush()
+        {
+            if (!pendingSize) return 0;
+            const uint32 size = pendingSize;
+            pendingSize = 0;
+            return writeAll(pending, size) == (int)size ? 0 : -1;
         }
+  #endif
 
         int recv(char * buffer, const uint32 minLength, const uint32 maxLength = 0)
         {
+  #if MQTTUseKTLS == 1
+            // The kernel fails with EIO if it receives a record that's not application data (like an alert), so the connection is closed
+            if (rxOffloaded) return BaseSocket::recv(buffer, minLength, maxLength);
+  #endif
             uint32 ret = 0;
             while (ret < minLength)
             {
@@ -1535,6 +4244,14 @@ namespace Network { namespace Client {
                     // Those means that we need to call again the read method
                     if (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE)
                         continue;
+  #if MQTTTLSSessionCache > 0 && defined(MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+                    // With TLS 1.3, the tickets are sent by the broker after the handshake
+                    if (r == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+                    {
+                        if (host[0]) TLSSessions::instance().save(ssl, host, port, certHash);
+                        continue;
+                    }
+  #endif
                     if (r == MBEDTLS_ERR_SSL_TIMEOUT) {
                         errno = EWOULDBLOCK; // Remember it's a timeout
                         return -1;
@@ -1553,6 +4270,10 @@ namespace Network { namespace Client {
 
         ~MBTLSSocket()
         {
+  #if MQTTUseKTLS == 1
+            if (txOffloaded) closeNotify();
+            else
+  #endif
             mbedtls_ssl_close_notify(&ssl);
             mbedtls_x509_crt_free(&cacert);
             mbedtls_x509_crt_free(&owncert);
@@ -1573,10 +4294,18 @@ namespace Network { namespace Client {
         BaseSocket *                socket;
         /** The default timeout in milliseconds */
         struct timeval              timeoutMs;
+#if MQTTSocketTuning == 1
+        /** The socket tuning profile */
+        uint8                       tuning;
+#endif
 
         Impl(const char * clientID, MessageReceived * callback,  PacketStorage * storage, const DynamicBinDataView * brokerCert,
              const DynamicBinDataView * clientCert, const DynamicBinDataView * clientKey)
-             : ImplBase(clientID, callback, storage, brokerCert, clientCert, clientKey), socket(0), timeoutMs({3, 0}) {}
+             : ImplBase(clientID, callback, storage, brokerCert, clientCert, clientKey), socket(0), timeoutMs({3, 0})
+#if MQTTSocketTuning == 1
+             , tuning(0)
+#endif
+             {}
         ~Impl() { delete0(socket); }
 
         uint32 getTimeout() const { return timeoutInMs(timeoutMs); }
@@ -1597,9 +4326,19 @@ namespace Network { namespace Client {
 #if MQTTUseTLS == 1
                 withTLS ? new MBTLSSocket(timeoutMs) :
 #endif
+#if MQTTUseIOUring >= 1
+                new URingSocket(timeoutMs);
+#else
                 new BaseSocket(timeoutMs);
+#endif
             if (!socket) return -1;
+#if MQTTSocketTuning == 1
+            socket->profile = tuning;
             int ret = socket->connect(host, port, brokerCert, clientCert, clientKey);
+            if (ret == 0 && !socket->tune()) return -4;
+#else
+            int ret = socket->connect(host, port, brokerCert, clientCert, clientKey);
+#endif
             return ret;
         }
 
@@ -1608,6 +4347,25 @@ namespace Network { namespace Client {
             ScopedLock scope(sendLock);
             return socket ? socket->send(buffer, size) : -1;
         }
+#if MQTTVectoredSend == 1
+        int sendvImpl(const struct iovec * parts, const int count)
+        {
+            ScopedLock scope(sendLock);
+            return socket ? socket->sendv(parts, count) : -1;
+        }
+#endif
+#if MQTTTLSCoalesceWrites > 0
+        int cork(const bool enable)
+        {
+            ScopedLock scope(sendLock);
+            return socket ? socket->cork(enable) : 0;
+        }
+        int flushPending()
+        {
+            ScopedLock scope(sendLock);
+            return socket ? socket->flush() : 0;
+        }
+#endif
     };
 #endif
 
@@ -1629,10 +4387,33 @@ namespace Network { namespace Client {
         // Please do not move the line below as it must outlive the packet
         Protocol::MQTT::V5::Property<uint32> maxProp(Protocol::MQTT::V5::PacketSizeMax, impl->buffers.size);
         Protocol::MQTT::V5::Property<uint16> maxRecv(Protocol::MQTT::V5::ReceiveMax, impl->buffers.packetsCount());
+#if MQTTUseReconnect == 1
+        Protocol::MQTT::V5::Property<uint32> sessionExpiry(Protocol::MQTT::V5::SessionExpiryInterval, impl->reconnectPolicy ? impl->reconnectPolicy->sessionExpiryInterval : 0);
+#endif
         Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::CONNECT> packet;
 
         if (impl->isOpen()) return ErrorType::AlreadyConnected;
 
+#if MQTTUseReconnect == 1
+        if (impl->reconnectPolicy && !impl->reconnecting)
+        {   // Remember the parameters for reconnecting later on
+            ConnectParams & params = impl->connectParams;
+            params.host.from(serverHost);
+            params.port = port;
+            params.useTLS = useTLS;
+            params.keepAlive = keepAliveTimeInSec;
+            params.hasUserName = userName != nullptr;
+            if (userName) params.userName.from(userName);
+            params.hasPassword = password != nullptr;
+            if (password) params.password = DynamicBinaryData(password->length, password->data);
+            params.willMessage = willMessage;
+            params.willQoS = willQoS;
+            params.willRetain = willRetain;
+            delete0(params.properties);
+            if (properties) params.properties = properties->clone();
+        }
+#endif
+
         // Capture properties (to avoid copying them)
         packet.props.capture(properties);
 
@@ -1641,6 +4422,11 @@ namespace Network { namespace Client {
             packet.props.append(&maxProp); // It'll fail silently if it already exists
         if (impl->buffers.packetsCount())
             packet.props.append(&maxRecv); // It'll fail silently if it already exists
+#if MQTTUseReconnect == 1
+        // Ask the broker to keep the session while we are disconnected
+        if (impl->reconnectPolicy && impl->reconnectPolicy->sessionExpiryInterval)
+            packet.props.append(&sessionExpiry); // It'll fail silently if it already exists
+#endif
 
 
 #if MQTTAvoidValidation != 1
@@ -1795,116 +4581,120 @@ namespace Network { namespace Client {
 
     MQTTv5::ErrorType MQTTv5::subscribe(SubscribeTopic & topics, Properties * properties)
     {
-        if (!impl->isOpen()) return ErrorType::NotConnected;
-        // If we are interrupting while receiving a packet, let's stop before make any more damage
-        if (impl->state != State::Running)
-            return ErrorType::TranscientPacket;
-
         Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::SUBSCRIBE> packet;
-        // Capture properties (to avoid copying them)
-        packet.props.capture(properties);
-
-#if MQTTAvoidValidation != 1
-        if (!packet.props.checkPropertiesFor(Protocol::MQTT::V5::SUBSCRIBE))
-            return ErrorType::BadProperties;
-#endif
+        packet.payload.topics = &topics;
+        return impl->subscribe(packet, topics.count(), properties);
+    }
 
+    MQTTv5::ErrorType MQTTv5::subscribe(const SubscribeTopicArray & topics, Properties * properties)
+    {
+        Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::SUBSCRIBE> packet;
+        packet.payload.topicArray = &topics;
+        return impl->subscribe(packet, topics.count(), properties);
+    }
 
-        packet.fixedVariableHeader.packetID = impl->allocatePacketID();
+#if MQTTAsyncSubscribe > 0
+    MQTTv5::ErrorType MQTTv5::subscribeAsync(SubscribeTopic & topics, const uint32 requestID, Properties * properties)
+    {
+        // Own the topics like the synchronous version
+        Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::SUBSCRIBE> packet;
         packet.payload.topics = &topics;
-        impl->setConnectionState(State::Subscribing);
 
-        // Then send the packet
-        if (ErrorType ret = impl->requestOneLoop(packet))
-            return impl->saveError(ret);
+        // Serialize the topics only once, they are split in packets afterwards
+        uint32 size = topics.getSize();
+        DeclareStackHeapBuffer(buffer, size, StackSizeAllocationLimit);
+        if (topics.copyInto(buffer) != size)
+            return ErrorType::UnknownError;
 
-        // Then extract the packet type
-        Protocol::MQTT::V5::ControlPacketType type = impl->getLastPacketType();
-        if (type == Protocol::MQTT::V5::SUBACK)
-        {
-            Protocol::MQTT::V5::ROSubACKPacket rpacket;
-            int ret = impl->extractControlPacket(type, rpacket);
-            if (ret <= 0) return impl->saveError(ErrorType::NetworkError);
+        return impl->scribeAsync(false, buffer, size, properties, requestID);
+    }
+
+    MQTTv5::ErrorType MQTTv5::subscribeAsync(const SubscribeTopicArray & topics, const uint32 requestID, Properties * properties)
+    {
+        // Already serialized, so no copy here
+        return impl->scribeAsync(false, topics.getBuffer(), topics.getSize(), properties, requestID);
+    }
 
-            if (rpacket.fixedVariableHeader.packetID != packet.fixedVariableHeader.packetID)
-                return impl->saveError(ErrorType::NetworkError);
+  #if MQTTUseUnsubscribe == 1
+    MQTTv5::ErrorType MQTTv5::unsubscribeAsync(UnsubscribeTopic & topics, const uint32 requestID, Properties * properties)
+    {
+        // Own the topics like the synchronous version
+        Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::UNSUBSCRIBE> packet;
+        packet.payload.topics = &topics;
 
-            // Then check reason codes
-            SubscribeTopic * topic = packet.payload.topics;
-            uint32 count = topic->count();
-            if (!rpacket.payload.data || rpacket.payload.size < count)
-                return ReasonCodes::ProtocolError;
-            for (uint32 i = 0; i < count; i++)
-                if (rpacket.payload.data[i] >= ReasonCodes::UnspecifiedError)
-                    return (ReasonCodes)rpacket.payload.data[i];
+        // Serialize the topics only once, they are split in packets afterwards
+        uint32 size = topics.getSize();
+        DeclareStackHeapBuffer(buffer, size, StackSizeAllocationLimit);
+        if (topics.copyInto(buffer) != size)
+            return ErrorType::UnknownError;
 
-            return ErrorType::Success;
-        }
+        return impl->scribeAsync(true, buffer, size, properties, requestID);
+    }
 
-        return impl->saveError(ErrorType::NetworkError);
+    MQTTv5::ErrorType MQTTv5::unsubscribeAsync(const UnsubscribeTopicArray & topics, const uint32 requestID, Properties * properties)
+    {
+        return impl->scribeAsync(true, topics.getBuffer(), topics.getSize(), properties, requestID);
     }
+  #endif
+#endif
 
 #if MQTTUseUnsubscribe == 1
     MQTTv5::ErrorType MQTTv5::unsubscribe(UnsubscribeTopic & topics, Properties * properties)
     {
-        if (!impl->isOpen()) return ErrorType::NotConnected;
-        // If we are interrupting while receiving a packet, let's stop before make any more damage
-        if (impl->state != State::Running)
-            return ErrorType::TranscientPacket;
-
-        // If we are currently unsubscribing and still waiting for ACK, don't accept any other unsubscription
-        if (impl->unsubscribeId)
-            return ErrorType::TranscientPacket;
-
         Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::UNSUBSCRIBE> packet;
-        // Capture properties (to avoid copying them)
-        packet.props.capture(properties);
-
-#if MQTTAvoidValidation != 1
-        if (!packet.props.checkPropertiesFor(Protocol::MQTT::V5::UNSUBSCRIBE))
-            return ErrorType::BadProperties;
-#endif
-
-        packet.fixedVariableHeader.packetID = impl->allocatePacketID();
         packet.payload.topics = &topics;
+        return impl->unsubscribe(packet, properties);
+    }
 
-        impl->setConnectionState(State::Unsubscribing);
+    MQTTv5::ErrorType MQTTv5::unsubscribe(const UnsubscribeTopicArray & topics, Properties * properties)
+    {
+        Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::UNSUBSCRIBE> packet;
+        packet.payload.topicArray = &topics;
+        return impl->unsubscribe(packet, properties);
+    }
+#endif
 
-        // Then send the packet
-        if (ErrorType ret = impl->requestOneLoop(packet))
-            return impl->saveError(ret);
+    // Publish to a topic.
+    MQTTv5::ErrorType MQTTv5::publish(const char * topic, const uint8 * payload, const uint32 payloadLength, const bool retain, const QoSDelivery QoS, const uint16 packetIdentifier, Properties * properties)
+    {
+#if MQTTPriorityScheduler > 0
+        return impl->publish(topic, payload, payloadLength, retain, QoS, properties, packetIdentifier, (uint8)Priority::Normal);
+#else
+        return impl->publish(topic, payload, payloadLength, retain, QoS, properties, packetIdentifier);
+#endif
+    }
 
-        // Then extract the packet type
-        Protocol::MQTT::V5::ControlPacketType type = impl->getLastPacketType();
-        if (type == Protocol::MQTT::V5::UNSUBACK)
+#if MQTTPriorityScheduler > 0
+    // Publish to a topic with the given priority class.
+    MQTTv5::ErrorType MQTTv5::publish(const Priority priority, const char * topic, const uint8 * payload, const uint32 payloadLength, const bool retain, const QoSDelivery QoS,
+                                      Properties * properties, const bool split)
+    {
+        if (priority == Priority::Control || priority > Priority::Bulk) return ErrorType::BadParameter;
+        if (!split || priority != Priority::Bulk || payloadLength <= MQTTPriorityScheduler)
+            return impl->publish(topic, payload, payloadLength, retain, QoS, properties, 0, (uint8)priority);
+
+        // Only the last slice would be retained
+        if (retain) return ErrorType::BadParameter;
+        // Send the payload in slices, so the other classes' packets can be sent in between
+        for (uint32 offset = 0; offset < payloadLength; offset += MQTTPriorityScheduler)
         {
-            Protocol::MQTT::V5::ROUnsubACKPacket rpacket;
-            int ret = impl->extractControlPacket(type, rpacket);
-            if (ret <= 0) return impl->saveError(ErrorType::NetworkError);
-
-            if (rpacket.fixedVariableHeader.packetID != packet.fixedVariableHeader.packetID)
-                return impl->saveError(ErrorType::NetworkError);
-
-            // Then check reason codes
-            uint32 count = rpacket.payload.size;
-            if (!rpacket.payload.data)
-                return ReasonCodes::ProtocolError;
-            for (uint32 i = 0; i < count; i++)
-                if (rpacket.payload.data[i] >= ReasonCodes::UnspecifiedError)
-                    return (ErrorType::Type)rpacket.payload.data[i];
-
-            return ErrorType::Success;
+            if (ErrorType err = impl->publish(topic, payload + offset, min(payloadLength - offset, (uint32)MQTTPriorityScheduler), false, QoS, properties, 0, (uint8)priority))
+                return err;
         }
-
-        return impl->saveError(ErrorType::NetworkError);
+        return ErrorType::Success;
     }
 #endif
 
-    // Publish to a topic.
-    MQTTv5::ErrorType MQTTv5::publish(const char * topic, const uint8 * payload, const uint32 payloadLength, const bool retain, const QoSDelivery QoS, const uint16 packetIdentifier, Properties * properties)
+#if MQTTZeroCopyPublish == 1
+    // Publish to a topic without copying the payload.
+    MQTTv5::ErrorType MQTTv5::publish(const char * topic, const PayloadRef & payload, const bool retain, const QoSDelivery QoS, const uint16 packetIdentifier, Properties * properties)
     {
+        PayloadRef ref(payload);
         if (topic == nullptr)
+        {
+            ref.release();
             return ErrorType::BadParameter;
+        }
 
         Protocol::MQTT::V5::PublishPacket packet;
         // Capture properties (to avoid copying them)
@@ -1912,7 +4702,10 @@ namespace Network { namespace Client {
 
 #if MQTTAvoidValidation != 1
         if (!packet.props.checkPropertiesFor(Protocol::MQTT::V5::PUBLISH))
+        {
+            ref.release();
             return ErrorType::BadProperties;
+        }
 #endif
 
         // Create header now
@@ -1926,26 +4719,92 @@ namespace Network { namespace Client {
 #endif
         packet.header.setDup(false); // At first, it's not a duplicate message
         packet.fixedVariableHeader.topicName = topic;
-        packet.payload.setExpectedPacketSize(payloadLength);
-        packet.payload.readFrom(payload, payloadLength);
 
         // Ok, shared code below
+        auto imp = impl->acquire();
+        if (!imp) { ref.release(); return ErrorType::NetworkError; }
+        if (!imp->isOpen()) { ref.release(); return impl->release(ErrorType::NotConnected); }
+        if (imp->state != State::Running) { ref.release(); return impl->release(ErrorType::TranscientPacket); }
+
+#if MQTTOutboundQueue > 0
+        {   // The payload isn't copied, so it can't be queued. It's only sent if the rate limits allow it and nothing is queued
+            uint32 waitMs = 0;
+            const uint32 packetSize = packet.computePacketSize() + ref.size;
+            imp->lockOutbound();
+            bool canSend = !imp->outUsed && (!withAnswer || imp->canSendQoS()) && packetSize <= imp->maxPacketSize
+                        && imp->takeTokens(imp->matchLimits(topic), packetSize, waitMs);
+            imp->unlockOutbound();
+            if (!canSend) { ref.release(); return impl->release(ErrorType::Throttled); }
+        }
+#endif
+        packet.fixedVariableHeader.packetID = withAnswer ? (packetIdentifier ? packetIdentifier : imp->allocatePacketID()) : 0; // Only if QoS is not 0
+
+        // The payload is released (or owned by the storage) from now on
+#if MQTTPriorityScheduler > 0
+        ErrorType err = imp->prepareZeroCopyPublish(packet, ref, (uint8)Priority::Normal);
+#else
+        ErrorType err = imp->prepareZeroCopyPublish(packet, ref);
+#endif
+        return impl->release(err, err != ErrorType::Success); // Mark as error here
+    }
+#endif
+
+#if MQTTForwardPublish == 1
+    // Republish a received message without rebuilding it.
+    MQTTv5::ErrorType MQTTv5::forward(const DynamicStringView & topic, const DynamicBinDataView & payload, const PropertiesView & properties, const bool retain,
+                                      const QoSDelivery QoS, const char * newTopic, Properties * editedProperties, const uint16 packetIdentifier)
+    {
+        DynamicStringView target = newTopic ? DynamicStringView(newTopic) : topic;
+  #if MQTTPriorityScheduler > 0
+        return impl->forward(target, payload, properties, editedProperties, retain, QoS, packetIdentifier, (uint8)Priority::Normal);
+  #else
+        return impl->forward(target, payload, properties, editedProperties, retain, QoS, packetIdentifier);
+  #endif
+    }
+#endif
+
+#if MQTTManualACK == 1 && MQTTQoSSupportLevel != -1
+    // Acknowledge a received message
+    MQTTv5::ErrorType MQTTv5::acknowledge(const uint16 packetIdentifier, const ReasonCodes reasonCode)
+    {
+        if (!packetIdentifier) return ErrorType::Success; // QoS 0 packets don't need any acknowledgement
+        if (reasonCode != ReasonCodes::Success && reasonCode != ReasonCodes::NoMatchingSubscribers && reasonCode < ReasonCodes::UnspecifiedError)
+            return ErrorType::BadParameter;
+
         auto imp = impl->acquire();
         if (!imp) return ErrorType::NetworkError;
         if (!imp->isOpen()) return impl->release(ErrorType::NotConnected);
-        if (imp->state != State::Running) return impl->release(ErrorType::TranscientPacket);
 
-        packet.fixedVariableHeader.packetID = withAnswer ? imp->allocatePacketID() : 0; // Only if QoS is not 0
-
-        // The publish cycle isn't run until the next event loop. This allow true asynchronous publishing
-        ErrorType err = imp->prepareSAR(packet, false, true);
-        return impl->release(err, err != ErrorType::Success); // Mark as error here
+        ErrorType err = imp->acknowledge(packetIdentifier, reasonCode);
+        return impl->release(err, err == ErrorType::NetworkError || err == ErrorType::UnknownError);
     }
+#endif
 
     // The client event loop you must call regularly.
     MQTTv5::ErrorType MQTTv5::eventLoop()
     {
+#if MQTTUseReconnect == 1
+        if (!impl->isOpen()) return impl->tryReconnect(*this);
+#else
         if (!impl->isOpen()) return ErrorType::NotConnected;
+#endif
+#if MQTTTLSCoalesceWrites > 0 && (MQTTLatencyProbe == 1 || MQTTOutboundQueue > 0)
+        // Pack the probe and the queued packets in as few TLS records as possible
+        Impl::Batch batch(*impl);
+#endif
+#if MQTTLatencyProbe == 1
+        if (ErrorType ret = impl->sendProbe(*this))
+            return impl->closeIfError(ret);
+#endif
+#if MQTTOutboundQueue > 0
+        // Send the queued packets that can be sent now
+        uint32 waitMs = 0;
+        if (ErrorType ret = impl->flushOutbound(waitMs))
+            return impl->closeIfError(ret);
+#endif
+#if MQTTTLSCoalesceWrites > 0 && (MQTTLatencyProbe == 1 || MQTTOutboundQueue > 0)
+        if (batch.end() < 0) return impl->closeIfError(ErrorType::NetworkError);
+#endif
 
         // Check if we have a packet ready for reading now
         Protocol::MQTT::Common::ControlPacketType type = impl->getLastPacketType();
@@ -1958,7 +4817,18 @@ namespace Network { namespace Client {
                 impl->setConnectionState(State::Pinging);
                 Protocol::MQTT::V5::PingReqPacket packet;
                 if (ErrorType ret = impl->requestOneLoop(packet))
+                {
+#if MQTTRecvBufferPool > 1
+                    // The answer can't be read while a message is waiting for a retained buffer to be released.
+                    // The ping was sent anyway (so the broker keeps the connection), its answer is dropped later on
+                    if (ret == ErrorType::TimedOut && impl->isPublishParked())
+                    {
+                        impl->setConnectionState(State::Running);
+                        return ErrorType::Success;
+                    }
+#endif
                     return impl->closeIfError(ret);
+                }
 
                 type = impl->getLastPacketType();
                 if (type == Protocol::MQTT::V5::PINGRESP)
@@ -1970,9 +4840,14 @@ namespace Network { namespace Client {
                 // Ok, done for now
                 return ErrorType::Success;
             }
+#if MQTTOutboundQueue > 0
+            // Don't wait for the default timeout if a queued packet can be sent before
+            if (waitMs && impl->socket->select(true, false, waitMs) <= 0) return ErrorType::Success;
+#endif
             // Check the server for any packet...
             int ret = impl->receiveControlPacket(true);
             if (ret == 0) return impl->closeIfError(ErrorType::NotConnected);
+            if (ret == -5) return impl->closeIfError(ReasonCodes::ProtocolError);
 
             // No answer in time, it's not an error here
             if (ret == -2) return ErrorType::Success;
@@ -1982,6 +4857,21 @@ namespace Network { namespace Client {
         }
 
         ErrorType ret = impl->dealWithNoise();
+#if MQTTCoalesceACK > 0 && MQTTQoSSupportLevel != -1
+        // Process the packets that are already available on the socket so their replies are sent all at once
+        for (uint32 i = 0; ret == ErrorType::TranscientPacket && impl->hasPendingReplies() && i < MQTTCoalesceACK; i++)
+        {
+            if (impl->socket->select(true, false, 0) <= 0) break;
+            int r = impl->receiveControlPacket();
+            if (r == 0) return impl->closeIfError(ErrorType::NotConnected);
+            if (r == -5) return impl->closeIfError(ReasonCodes::ProtocolError);
+            if (r == -2) break;
+            if (r < 0)  return impl->closeIfError(ErrorType::NetworkError);
+            ret = impl->dealWithNoise();
+        }
+        if (ErrorType err = impl->flushReplies())
+            return impl->closeIfError(err);
+#endif
         if (ret == ErrorType::TranscientPacket)
             return ErrorType::Success;
 
@@ -1995,6 +4885,11 @@ namespace Network { namespace Client {
             return ErrorType::BadParameter;
 
 
+#if MQTTUseReconnect == 1
+        // A voluntary disconnection must not trigger a reconnection
+        impl->shouldReconnect = false;
+        impl->recovering = false;
+#endif
         if (!impl->isOpen()) return ErrorType::Success;
 
         Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::DISCONNECT> packet;
@@ -2008,6 +4903,8 @@ namespace Network { namespace Client {
 #endif
 
         impl->setConnectionState(State::Disconnecting);
+        if (ErrorType ret = impl->flushReplies())
+            return impl->saveError(ret);
         if (ErrorType ret = impl->prepareSAR(packet, false))
             return impl->saveError(ret);
 
@@ -2021,6 +4918,190 @@ namespace Network { namespace Client {
         impl->setTimeout(timeoutMs);
     }
 
+#if MQTTSocketTuning == 1
+    MQTTv5::ErrorType MQTTv5::setTuningProfile(const TuningProfile profile, const int cpu)
+    {
+        impl->tuning = (uint8)profile;
+        if (cpu >= 0)
+        {
+  #ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            if (::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set)) return ErrorType::BadParameter;
+  #else
+            return ErrorType::BadParameter;
+  #endif
+        }
+        // Apply it to the current connection
+        if (!impl->socket) return ErrorType::Success;
+        impl->socket->profile = impl->tuning;
+        return impl->socket->tune() ? ErrorType::Success : ErrorType::NetworkError;
+    }
+#endif
+
+#if MQTTMessageExpiry == 1
+    uint32 MQTTv5::getExpiredMessagesCount() const { return impl->expiredMessages; }
+#endif
+
+#if MQTTLatencyProbe == 1
+    MQTTv5::ErrorType MQTTv5::startLatencyProbe(const char * topic, const uint32 periodMs)
+    {
+        if (!topic || !*topic || !periodMs) return ErrorType::BadParameter;
+        if (!impl->isOpen()) return ErrorType::NotConnected;
+        if (ErrorType ret = subscribe(topic, RetainHandling::NoRetainedMessage, true, QoSDelivery::AtMostOne, false))
+            return ret;
+
+        Impl::LatencyProbe & probe = impl->probe;
+        probe.topic.from(topic);
+        probe.periodMs = periodMs;
+        probe.nextMs = getTimeMs();
+        // A new generation so the probes of a previous session are ignored
+        probe.generation = getTimeUs() ^ (uint32)(size_t)this ^ (probe.generation << 7);
+        probe.sequence = 0;
+        probe.highest = (uint32)-1;
+        probe.window = 1;
+        probe.stats = ProbeStatistics();
+        probe.active = true;
+        probe.subscribed = true;
+        return ErrorType::Success;
+    }
+    MQTTv5::ErrorType MQTTv5::stopLatencyProbe()
+    {
+        Impl::LatencyProbe & probe = impl->probe;
+        if (!probe.active) return ErrorType::Success;
+        probe.active = false;
+  #if MQTTUseUnsubscribe == 1
+        if (!impl->isOpen()) return ErrorType::Success;
+        UnsubscribeTopicArray topics(probe.topic.length + 2);
+        topics.append(probe.topic.data);
+        ErrorType ret = unsubscribe(topics);
+        // The broker doesn't send anything on the topic after acknowledging the unsubscription
+        if (ret == ErrorType::Success) probe.subscribed = false;
+        return ret;
+  #else
+        return ErrorType::Success;
+  #endif
+    }
+    void MQTTv5::getLatencyProbe(ProbeStatistics & stats, const bool reset)
+    {
+        Impl::LatencyProbe & probe = impl->probe;
+        stats = probe.stats;
+        if (reset) probe.stats = ProbeStatistics();
+    }
+#endif
+
+#if MQTTStatistics == 1
+    void MQTTv5::getStatistics(Statistics & stats) const
+    {
+        const Impl::Counters & c = impl->stats;
+        for (uint8 i = 0; i < 16; i++)
+        {
+            stats.packetsSent[i] = c.packetsSent[i].load(std::memory_order_relaxed);
+            stats.packetsReceived[i] = c.packetsReceived[i].load(std::memory_order_relaxed);
+        }
+        stats.bytesSent = c.bytesSent.load(std::memory_order_relaxed);
+        stats.bytesReceived = c.bytesReceived.load(std::memory_order_relaxed);
+        stats.sendCalls = c.sendCalls.load(std::memory_order_relaxed);
+        stats.recvCalls = c.recvCalls.load(std::memory_order_relaxed);
+        stats.partialReads = c.partialReads.load(std::memory_order_relaxed);
+        stats.timeouts = c.timeouts.load(std::memory_order_relaxed);
+        stats.networkErrors = c.networkErrors.load(std::memory_order_relaxed);
+        stats.connectionsLost = c.connectionsLost.load(std::memory_order_relaxed);
+        stats.reconnections = c.reconnections.load(std::memory_order_relaxed);
+
+        // The occupancy is read without locking, it's exact only from the event loop thread
+        stats.inFlightSent = stats.inFlightReceived = 0;
+        stats.inFlightCapacity = impl->buffers.end();
+        for (uint8 i = 0; i < impl->buffers.end(); i++)
+        {
+            uint32 ID = impl->buffers.packetID(i);
+            if (!ID) continue;
+            if (Buffers::isSending(ID)) stats.inFlightSent++;
+            else stats.inFlightReceived++;
+        }
+  #if MQTTOutboundQueue > 0
+        stats.outboundQueued = impl->outUsed;
+  #else
+        stats.outboundQueued = 0;
+  #endif
+  #if MQTTCoalesceACK > 0 && MQTTQoSSupportLevel != -1
+        stats.pendingReplies = impl->pendingRepliesCount;
+  #else
+        stats.pendingReplies = 0;
+  #endif
+    }
+#endif
+
+#if MQTTTLSSessionCache > 0
+    void MQTTv5::forgetTLSSessions()
+    {
+        TLSSessions::instance().forgetAll();
+    }
+#endif
+
+#if MQTTTLSCoalesceWrites > 0
+    void MQTTv5::beginBatch()
+    {
+        impl->cork(true);
+    }
+
+    MQTTv5::ErrorType MQTTv5::endBatch()
+    {
+        return impl->cork(false) < 0 ? ErrorType::NetworkError : ErrorType::Success;
+    }
+#endif
+
+#if MQTTPacketCapture > 0
+    MQTTv5::ErrorType MQTTv5::startCapture(const uint32 snapLength)
+    {
+        return impl->capture.start(snapLength) ? ErrorType::Success : ErrorType::BadParameter;
+    }
+
+    void MQTTv5::stopCapture()
+    {
+        impl->capture.active.store(false, std::memory_order_relaxed);
+    }
+
+    MQTTv5::ErrorType MQTTv5::saveCapture(const char * path) const
+    {
+        if (!path) return ErrorType::BadParameter;
+        return impl->capture.save(path) ? ErrorType::Success : ErrorType::StorageError;
+    }
+#endif
+
+#if MQTTUseReconnect == 1
+    void MQTTv5::setReconnectPolicy(ReconnectPolicy * policy)
+    {
+        impl->reconnectPolicy = policy;
+        if (!policy) impl->shouldReconnect = false;
+    }
+#endif
+
+#if MQTTOutboundQueue > 0
+    MQTTv5::ErrorType MQTTv5::addRateLimit(RateLimit * limit)
+    {
+        if (!limit || impl->rateLimitsCount >= 32) return ErrorType::BadParameter;
+        impl->lockOutbound();
+        RateLimit ** last = &impl->rateLimits;
+        while (*last) last = &(*last)->next;
+        limit->next = nullptr;
+        limit->lastRefill = 0;
+        *last = limit;
+        impl->rateLimitsCount++;
+        impl->unlockOutbound();
+        return ErrorType::Success;
+    }
+
+    void MQTTv5::setOutboundWatermarks(const uint32 lowBytes, const uint32 highBytes)
+    {
+        impl->lockOutbound();
+        impl->outHigh = min(highBytes, (uint32)MQTTOutboundQueue);
+        impl->outLow = min(lowBytes, impl->outHigh);
+        impl->unlockOutbound();
+    }
+#endif
+
     void MQTTv5::setClientID(const char * clientID)
     {
         impl->clientID = clientID;
@@ -0,0 +1,247 @@
+// We need our declaration
+#include <Network/Clients/MQTTSharded.hpp>
+
+#if MQTTShardedClient == 1
+// We need threads and atomics
+#include <thread>
+#include <atomic>
+#include <chrono>
+// We need snprintf
+#include <stdio.h>
+#include <string.h>
+// We need StackHeapBuffer to avoid stressing the heap allocator when it's not required
+#include <Platform/StackHeapBuffer.hpp>
+
+// This is the maximum allocation that'll be performed on the stack before it's being replaced by heap allocation
+#define StackSizeAllocationLimit    512
+
+namespace Network { namespace Client {
+
+    struct ShardedClient::Impl
+    {
+        /** The reconnection policy for a shard.
+            It delays the attempts depending on the shard's index and subscribes again to the shared subscriptions if needed */
+        struct ShardPolicy : public ReconnectPolicy
+        {
+            /** The sharded client */
+            Impl *  parent;
+            /** This shard's index */
+            uint32  index;
+
+            uint32 nextDelay(const uint32 attempt, const uint32 random) const
+            {
+                // Spread the shards over the minimum delay so they don't reconnect at the same time
+                return ReconnectPolicy::nextDelay(attempt, random) + (uint32)(((uint64)minDelayMs * index) / parent->count);
+            }
+            ErrorType resubscribe(MQTTv5 & client) { return parent->resubscribe(client); }
+
+            ShardPolicy() : parent(0), index(0) {}
+        };
+
+        /** A connection and its event loop thread */
+        struct Shard
+        {
+            /** The reconnection policy */
+            ShardPolicy             policy;
+            /** The client */
+            MQTTv5 *                client;
+            /** The event loop thread */
+            std::thread             thread;
+            /** Whether the client is connected */
+            std::atomic<bool>       connected;
+            /** The publication statistics */
+            std::atomic<uint64>     published;
+            std::atomic<uint64>     publishErrors;
+            /** A copy of the reconnection policy statistics (since they are updated in the event loop thread) */
+            std::atomic<uint32>     reconnections;
+            std::atomic<uint32>     failedAttempts;
+            std::atomic<uint32>     sessionsLost;
+            std::atomic<uint32>     maxRecoveryTimeMs;
+
+            /** Copy the reconnection statistics so they can be read from any thread */
+            void saveStatistics()
+            {
+                reconnections.store(policy.reconnections, std::memory_order_relaxed);
+                failedAttempts.store(policy.failedAttempts, std::memory_order_relaxed);
+                sessionsLost.store(policy.sessionsLost, std::memory_order_relaxed);
+                maxRecoveryTimeMs.store(policy.maxRecoveryTimeMs, std::memory_order_relaxed);
+            }
+
+            Shard() : client(0), connected(false), published(0), publishErrors(0), reconnections(0), failedAttempts(0), sessionsLost(0), maxRecoveryTimeMs(0) {}
+            ~Shard() { delete client; client = 0; }
+        };
+
+        /** The shards */
+        Shard *                                     shards;
+        /** The number of shards */
+        uint32                                      count;
+        /** Whether the event loop threads should run */
+        std::atomic<bool>                           running;
+        /** The shared subscriptions made so far */
+        Protocol::MQTT::V5::SubscribeTopicArray     subscriptions;
+
+        /** Subscribe again to all shared subscriptions */
+        ErrorType resubscribe(MQTTv5 & client)
+        {
+            if (!subscriptions.count()) return ErrorType::Success;
+            return client.subscribe(subscriptions);
+        }
+
+        /** The event loop thread for a shard */
+        void run(Shard & shard)
+        {
+            while (running.load(std::memory_order_relaxed))
+            {
+                ErrorType ret = shard.client->eventLoop();
+                shard.connected.store(ret != ErrorType::NotConnected, std::memory_order_relaxed);
+                shard.saveStatistics();
+                // Not connected (and not the time to retry yet), so don't spin
+                if (ret == ErrorType::NotConnected)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        /** Compute the hash of a topic (FNV-1a) */
+        static uint32 hash(const char * topic)
+        {
+            uint32 h = 2166136261U;
+            while (*topic) { h ^= (uint8)*topic++; h *= 16777619U; }
+            return h;
+        }
+
+        Impl(const char * clientIDPrefix, const uint32 shardCount, MessageReceived * callback, const ReconnectPolicy & policy,
+             const DynamicBinDataView * brokerCert, const DynamicBinDataView * clientCert, const DynamicBinDataView * clientKey)
+            : shards(new Shard[shardCount ? shardCount : 1]), count(shardCount ? shardCount : 1), running(false)
+        {
+            char clientID[128];
+            for (uint32 i = 0; i < count; i++)
+            {
+                Shard & shard = shards[i];
+                shard.policy.minDelayMs = policy.minDelayMs;
+                shard.policy.maxDelayMs = policy.maxDelayMs;
+                shard.policy.sessionExpiryInterval = policy.sessionExpiryInterval;
+                shard.policy.parent = this;
+                shard.policy.index = i;
+
+                snprintf(clientID, sizeof(clientID), "%s-%u", clientIDPrefix ? clientIDPrefix : "", i);
+                shard.client = new MQTTv5(clientID, callback, 0, brokerCert, clientCert, clientKey);
+                shard.client->setReconnectPolicy(&shard.policy);
+            }
+        }
+        ~Impl() { delete[] shards; shards = 0; count = 0; }
+    };
+
+    ShardedClient::ErrorType ShardedClient::connectTo(const char * serverHost, const uint16 port, bool useTLS, const uint16 keepAliveTimeInSec,
+                                                      const bool cleanStart, const char * userName, const DynamicBinDataView * password)
+    {
+        for (uint32 i = 0; i < impl->count; i++)
+        {
+            Impl::Shard & shard = impl->shards[i];
+            ErrorType ret = shard.client->connectTo(serverHost, port, useTLS, keepAliveTimeInSec, cleanStart, userName, password);
+            if (ret != ErrorType::Success) return ret;
+            shard.connected.store(true, std::memory_order_relaxed);
+        }
+        return ErrorType::Success;
+    }
+
+    ShardedClient::ErrorType ShardedClient::subscribe(const char * group, const char * topic, const QoSDelivery maxAcceptedQoS, const RetainHandling retainHandling)
+    {
+        if (!group || !*group || !topic || !*topic || strpbrk(group, "/+#")) return ErrorType::BadParameter;
+        // Subscribing isn't possible while the event loops are running
+        if (impl->running.load()) return ErrorType::BadParameter;
+
+        // Build the shared subscription's topic filter
+        const uint32 groupLen = (uint32)strlen(group), topicLen = (uint32)strlen(topic), filterLen = 8 + groupLen + topicLen;
+        DeclareStackHeapBuffer(filter, filterLen, StackSizeAllocationLimit);
+        memcpy((char*)filter, "$share/", 7);
+        memcpy((char*)filter + 7, group, groupLen);
+        ((char*)filter)[7 + groupLen] = '/';
+        memcpy((char*)filter + 8 + groupLen, topic, topicLen);
+
+        // The non local flag must not be set for a shared subscription
+        Protocol::MQTT::V5::SubscribeTopicArray single(10 + groupLen + topicLen + 1);
+        const uint8 option = Protocol::MQTT::V5::SubscribeTopicArray::makeOption(retainHandling, false, false, maxAcceptedQoS);
+        if (!single.append((const char*)filter, 8 + groupLen + topicLen, option)) return ErrorType::BadParameter;
+
+        for (uint32 i = 0; i < impl->count; i++)
+        {
+            ErrorType ret = impl->shards[i].client->subscribe(single);
+            if (ret != ErrorType::Success) return ret;
+        }
+        // Remember it for resubscribing
+        if (!impl->subscriptions.append((const char*)filter, 8 + groupLen + topicLen, option)) return ErrorType::StorageError;
+        return ErrorType::Success;
+    }
+
+    ShardedClient::ErrorType ShardedClient::start()
+    {
+        if (impl->running.exchange(true)) return ErrorType::Success;
+        for (uint32 i = 0; i < impl->count; i++)
+            impl->shards[i].thread = std::thread(&Impl::run, impl, std::ref(impl->shards[i]));
+        return ErrorType::Success;
+    }
+
+    void ShardedClient::stop()
+    {
+        impl->running.store(false);
+        for (uint32 i = 0; i < impl->count; i++)
+            if (impl->shards[i].thread.joinable()) impl->shards[i].thread.join();
+    }
+
+    ShardedClient::ErrorType ShardedClient::publish(const char * topic, const uint8 * payload, const uint32 payloadLength, const bool retain,
+                                                    const QoSDelivery QoS, Properties * properties)
+    {
+        if (!topic) return ErrorType::BadParameter;
+        Impl::Shard & shard = impl->shards[Impl::hash(topic) % impl->count];
+        ErrorType ret = shard.client->publish(topic, payload, payloadLength, retain, QoS, 0, properties);
+        (ret == ErrorType::Success ? shard.published : shard.publishErrors).fetch_add(1, std::memory_order_relaxed);
+        return ret;
+    }
+
+    ShardedClient::ErrorType ShardedClient::disconnect(const ReasonCodes code)
+    {
+        stop();
+        ErrorType result = ErrorType::Success;
+        for (uint32 i = 0; i < impl->count; i++)
+        {
+            ErrorType ret = impl->shards[i].client->disconnect(code);
+            impl->shards[i].connected.store(false, std::memory_order_relaxed);
+            if (ret != ErrorType::Success && result == ErrorType::Success) result = ret;
+        }
+        return result;
+    }
+
+    uint32 ShardedClient::getShardCount() const { return impl->count; }
+    uint32 ShardedClient::getShardFor(const char * topic) const { return topic ? Impl::hash(topic) % impl->count : 0; }
+    MQTTv5 & ShardedClient::getShard(const uint32 index) { return *impl->shards[index < impl->count ? index : 0].client; }
+
+    void ShardedClient::getStatistics(Statistics & stats) const
+    {
+        memset(&stats, 0, sizeof(stats));
+        stats.shards = impl->count;
+        for (uint32 i = 0; i < impl->count; i++)
+        {
+            const Impl::Shard & shard = impl->shards[i];
+            stats.connected         += shard.connected.load(std::memory_order_relaxed) ? 1 : 0;
+            stats.published         += shard.published.load(std::memory_order_relaxed);
+            stats.publishErrors     += shard.publishErrors.load(std::memory_order_relaxed);
+            stats.reconnections     += shard.reconnections.load(std::memory_order_relaxed);
+            stats.failedAttempts    += shard.failedAttempts.load(std::memory_order_relaxed);
+            stats.sessionsLost      += shard.sessionsLost.load(std::memory_order_relaxed);
+            uint32 recovery = shard.maxRecoveryTimeMs.load(std::memory_order_relaxed);
+            if (recovery > stats.maxRecoveryTimeMs) stats.maxRecoveryTimeMs = recovery;
+        }
+    }
+
+    ShardedClient::ShardedClient(const char * clientIDPrefix, const uint32 shards, MessageReceived * callback, const ReconnectPolicy & policy,
+                                 const DynamicBinDataView * brokerCert, const DynamicBinDataView * clientCert, const DynamicBinDataView * clientKey)
+        : impl(new Impl(clientIDPrefix, shards, callback, policy, brokerCert, clientCert, clientKey)) {}
+
+    ShardedClient::~ShardedClient()
+    {
+        stop();
+        delete impl;
+        impl = 0;
+    }
+}}
+#endif
@@ -0,0 +1,198 @@
+// Usual programs
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// We need a clock for benchmarking
+#include <time.h>
+// We need sorting for the percentiles
+#include <algorithm>
+#include <vector>
+// We need BSD sockets and fork for the loopback broker
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// We need MQTT client
+#include "Network/Clients/MQTT.hpp"
+
+/* Loopback benchmark for the client's transport and socket tuning.
+   A minimal single threaded broker is forked on the loopback interface. It echoes every PUBLISH (downgraded to QoS 0)
+   and answers CONNECT, SUBSCRIBE and PINGREQ, so the measure only depends on the client and the kernel.
+
+   Usage: MQTTBench [count] [profile] [cpu]
+     count      The number of publications for each test (default: 20000)
+     profile    The socket tuning profile if built with MQTTSocketTuning (0: Default, 1: LowLatency, 2: BusyPoll)
+     cpu        The CPU core to pin the client to if built with MQTTSocketTuning (default: none)
+
+   Build it with the flags to compare (for example, cmake's ENABLE_IO_URING option) and run it on an idle machine.
+   The round trip test sends a publication and waits for its echo (64 and 1024 bytes payload), the burst test sends
+   100 publications of 64 bytes before waiting for their echo. */
+
+using namespace Network::Client;
+
+static double now() { struct timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return t.tv_sec + t.tv_nsec / 1e9; }
+
+static bool readAll(int c, uint8 * buffer, int size)
+{
+    for (int got = 0; got < size;)
+    {
+        int r = ::recv(c, buffer + got, size - got, 0);
+        if (r <= 0) return false;
+        got += r;
+    }
+    return true;
+}
+
+/** The loopback broker, it serves a single connection and returns when the client disconnects */
+static void runBroker(int s)
+{
+    int one = 1;
+    int c = ::accept(s, 0, 0);
+    if (c < 0) return;
+    ::setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    static uint8 packet[70010], out[70010];
+    while (true)
+    {
+        // Fixed header, then the remaining length
+        uint8 header[5];
+        if (!readAll(c, header, 1)) break;
+        uint32 length = 0, shift = 0; int h = 1;
+        do
+        {
+            if (h == 5 || !readAll(c, &header[h], 1)) return;
+            length |= (uint32)(header[h] & 0x7F) << shift; shift += 7;
+        } while (header[h++] & 0x80);
+        if (length > sizeof(packet) || !readAll(c, packet, (int)length)) break;
+
+        switch (header[0] >> 4)
+        {
+        case 1: { const uint8 ack[] = { 0x20, 3, 0, 0, 0 }; ::send(c, ack, sizeof(ack), 0); break; } // CONNACK
+        case 12: { const uint8 ack[] = { 0xD0, 0 }; ::send(c, ack, sizeof(ack), 0); break; } // PINGRESP
+        case 14: ::close(c); return; // DISCONNECT
+        case 8: // SUBACK with a success code per topic
+        {
+            uint32 p = 2, propLength = 0; shift = 0;
+            do { propLength |= (uint32)(packet[p] & 0x7F) << shift; shift += 7; } while (packet[p++] & 0x80);
+            p += propLength;
+            uint8 ack[260] = { 0x90, 3, packet[0], packet[1], 0 };
+            int topics = 0;
+            while (p < length && topics < 250) { p += 3 + ((packet[p] << 8) | packet[p+1]); topics++; }
+            ack[1] = (uint8)(3 + topics);
+            ::send(c, ack, 5 + topics, 0);
+            break;
+        }
+        case 3: // PUBLISH, echo it as QoS 0
+        {
+            const uint8 QoS = (header[0] >> 1) & 3;
+            if (!QoS) { memcpy(out, header, h); memcpy(out + h, packet, length); ::send(c, out, h + length, 0); break; }
+            const uint32 topicLength = (packet[0] << 8) | packet[1];
+            const uint8 ack[] = { 0x40, 3, packet[2 + topicLength], packet[3 + topicLength], 0 };
+            ::send(c, ack, sizeof(ack), 0);
+            // Drop the packet identifier
+            uint32 n = 0, remaining = length - 2;
+            out[n++] = 0x30;
+            do { out[n] = remaining & 0x7F; remaining >>= 7; if (remaining) out[n] |= 0x80; n++; } while (remaining);
+            memcpy(out + n, packet, 2 + topicLength); n += 2 + topicLength;
+            memcpy(out + n, packet + 4 + topicLength, length - 4 - topicLength); n += length - 4 - topicLength;
+            ::send(c, out, n, 0);
+            break;
+        }
+        default: break;
+        }
+    }
+    ::close(c);
+}
+
+struct Counter : public MessageReceived
+{
+    int got;
+    void messageReceived(const MQTTv5::DynamicStringView &, const MQTTv5::DynamicBinDataView &, const uint16, const MQTTv5::PropertiesView &) { got++; }
+    Counter() : got(0) {}
+};
+
+int main(int argc, char ** argv)
+{
+    const int count = argc > 1 ? atoi(argv[1]) : 20000;
+    const int profile = argc > 2 ? atoi(argv[2]) : 0, cpu = argc > 3 ? atoi(argv[3]) : -1;
+    if (count < 100) return fprintf(stderr, "At least 100 publications are required\n"), 1;
+
+    // Let the kernel pick the broker's port
+    int s = ::socket(AF_INET, SOCK_STREAM, 0), one = 1;
+    ::setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(address);
+    if (::bind(s, (struct sockaddr*)&address, sizeof(address)) || ::listen(s, 1) || ::getsockname(s, (struct sockaddr*)&address, &len))
+        return fprintf(stderr, "Can't start the loopback broker\n"), 1;
+
+    pid_t broker = fork();
+    if (broker < 0) return fprintf(stderr, "Can't fork the loopback broker\n"), 1;
+    if (!broker) { runBroker(s); _exit(0); }
+    ::close(s);
+
+    Counter counter;
+    MQTTv5 client("bench", &counter);
+    int ret = 1;
+    bool ready = true;
+#if MQTTSocketTuning == 1
+    if (client.setTuningProfile((MQTTv5::TuningProfile)profile, cpu) != MQTTv5::ErrorType::Success)
+    {
+        fprintf(stderr, "Can't set the tuning profile\n");
+        ready = false;
+    }
+#else
+    if (profile || cpu >= 0) fprintf(stderr, "Socket tuning isn't enabled (MQTTSocketTuning), the profile is ignored\n");
+#endif
+    if (ready && (client.connectTo("127.0.0.1", ntohs(address.sin_port), false, 300) != MQTTv5::ErrorType::Success
+                  || client.subscribe("bench/t") != MQTTv5::ErrorType::Success))
+    {
+        fprintf(stderr, "Can't connect to the loopback broker\n");
+        ready = false;
+    }
+    if (ready)
+    {
+        uint8 payload[1024] = { 1 };
+        std::vector<double> times(count);
+        bool failed = false;
+        // Round trip test
+        double start = now();
+        for (int i = 0; i < count && !failed; i++)
+        {
+            const double sent = now();
+            failed = client.publish("bench/t", payload, i % 3 ? 64 : 1024, false) != MQTTv5::ErrorType::Success;
+            while (!failed && counter.got <= i) failed = client.eventLoop() != MQTTv5::ErrorType::Success;
+            times[i] = (now() - sent) * 1e6;
+        }
+        const double roundTrip = now() - start;
+
+        // Burst test
+        counter.got = 0;
+        start = now();
+        for (int b = 0; b < count / 100 && !failed; b++)
+        {
+            for (int i = 0; i < 100 && !failed; i++)
+                failed = client.publish("bench/t", payload, 64, false) != MQTTv5::ErrorType::Success;
+            while (!failed && counter.got < (b + 1) * 100) failed = client.eventLoop() != MQTTv5::ErrorType::Success;
+        }
+        const double burst = now() - start;
+
+        if (failed) fprintf(stderr, "Communication with the loopback broker failed\n");
+        else
+        {
+            std::sort(times.begin(), times.end());
+            printf("Round trip: %d in %.3fs, mean %.1f us, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n", count, roundTrip, roundTrip * 1e6 / count,
+                   times[count / 2], times[count * 99 / 100], times[count * 999 / 1000], times[count - 1]);
+            printf("Bursts of 100: %d in %.3fs, %.0f msg/s\n", count / 100 * 100, burst, count / 100 * 100 / burst);
+            ret = 0;
+        }
+        client.disconnect(MQTTv5::ReasonCodes::NormalDisconnection);
+    }
+
+    kill(broker, SIGTERM);
+    waitpid(broker, 0, 0);
+    return ret;
+}
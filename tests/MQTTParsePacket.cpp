@@ -1,6 +1,9 @@
 // Usual programs
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+// We need a monotonic clock for the batch mode
+#include <chrono>
 
 // We need Logger
 #include "Logger/Logger.hpp"
@@ -45,7 +48,7 @@ void hexDump(const uint8 * inBuffer, size_t inSize)
     }
 }
 
-bool readFile(const char * path, uint8 *& buffer, size_t & size)
+bool readFile(const char * path, uint8 *& buffer, size_t & size, const size_t maxSize = 2048*1024)
 {
     ScopeFile f(path);
     if (!f) return false;
@@ -53,7 +56,7 @@ bool readFile(const char * path, uint8 *& buffer, size_t & size)
     size = (size_t)ftell(f);
     if (fseek(f, 0, SEEK_SET)) return false;
 
-    if (!size || size > 2048*1024) return false;
+    if (!size || size > maxSize) return false;
     buffer = new uint8[size+1];
     if (!buffer) return false;
 
@@ -61,13 +64,338 @@ bool readFile(const char * path, uint8 *& buffer, size_t & size)
     return r == size;
 }
 
+Protocol::MQTT::V5::ControlPacketSerializable * createPacket(const uint8 type)
+{
+    switch (type)
+    {
+    case Protocol::MQTT::V5::CONNECT:     return new Protocol::MQTT::V5::ConnectPacket;
+    case Protocol::MQTT::V5::CONNACK:     return new Protocol::MQTT::V5::ROConnACKPacket;
+    case Protocol::MQTT::V5::PUBLISH:     return new Protocol::MQTT::V5::ROPublishPacket;
+    case Protocol::MQTT::V5::PUBACK:      return new Protocol::MQTT::V5::ROPubACKPacket;
+    case Protocol::MQTT::V5::PUBREC:      return new Protocol::MQTT::V5::ROPubRecPacket;
+    case Protocol::MQTT::V5::PUBREL:      return new Protocol::MQTT::V5::ROPubRelPacket;
+    case Protocol::MQTT::V5::PUBCOMP:     return new Protocol::MQTT::V5::ROPubCompPacket;
+    case Protocol::MQTT::V5::SUBSCRIBE:   return new Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::Common::SUBSCRIBE>;
+    case Protocol::MQTT::V5::SUBACK:      return new Protocol::MQTT::V5::ROSubACKPacket;
+    case Protocol::MQTT::V5::UNSUBSCRIBE: return new Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::Common::UNSUBSCRIBE>;
+    case Protocol::MQTT::V5::UNSUBACK:    return new Protocol::MQTT::V5::ROUnsubACKPacket;
+    case Protocol::MQTT::V5::PINGREQ:     return new Protocol::MQTT::V5::PingReqPacket;
+    case Protocol::MQTT::V5::PINGRESP:    return new Protocol::MQTT::V5::PingRespPacket;
+    case Protocol::MQTT::V5::DISCONNECT:  return new Protocol::MQTT::V5::RODisconnectPacket;
+    case Protocol::MQTT::V5::AUTH:        return new Protocol::MQTT::V5::ROAuthPacket;
+    default: return 0;
+    }
+}
+
+/** Decode a packet like the client does: with a packet instance on the stack for its type.
+    @return the number of bytes read or an error */
+uint32 decodePacket(const uint8 type, const uint8 * buffer, const uint32 size)
+{
+    switch (type)
+    {
+    case Protocol::MQTT::V5::CONNECT:     { Protocol::MQTT::V5::ConnectPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::CONNACK:     { Protocol::MQTT::V5::ROConnACKPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::PUBLISH:     { Protocol::MQTT::V5::PublishPacketView p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::PUBACK:      { Protocol::MQTT::V5::ROPubACKPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::PUBREC:      { Protocol::MQTT::V5::ROPubRecPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::PUBREL:      { Protocol::MQTT::V5::ROPubRelPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::PUBCOMP:     { Protocol::MQTT::V5::ROPubCompPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::SUBSCRIBE:   { Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::Common::SUBSCRIBE> p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::SUBACK:      { Protocol::MQTT::V5::ROSubACKPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::UNSUBSCRIBE: { Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::Common::UNSUBSCRIBE> p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::UNSUBACK:    { Protocol::MQTT::V5::ROUnsubACKPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::PINGREQ:     { Protocol::MQTT::V5::PingReqPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::PINGRESP:    { Protocol::MQTT::V5::PingRespPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::DISCONNECT:  { Protocol::MQTT::V5::RODisconnectPacket p; return p.readFrom(buffer, size); }
+    case Protocol::MQTT::V5::AUTH:        { Protocol::MQTT::V5::ROAuthPacket p; return p.readFrom(buffer, size); }
+    default: return Protocol::MQTT::Common::BadData;
+    }
+}
+
+/** A stream of concatenated MQTT packets (a file or a TCP connection's payload in one direction) */
+struct Stream
+{
+    uint8 * data;
+    size_t  size, allocated;
+    // For TCP streams, the connection (addresses and ports), the next expected sequence number and whether a segment was truncated
+    uint8   key[36];
+    uint32  nextSeq;
+    bool    broken;
+    // Whether the stream starts after a gap (or without the connection's start) so it can start in the middle of a packet
+    bool    resync;
+
+    void append(const uint8 * buffer, const size_t length)
+    {
+        if (size + length > allocated)
+        {
+            allocated = (size + length) * 2;
+            data = (uint8*)realloc(data, allocated);
+        }
+        memcpy(data + size, buffer, length);
+        size += length;
+    }
+    Stream() : data(0), size(0), allocated(0), nextSeq(0), broken(false), resync(false) { memset(key, 0, sizeof(key)); }
+    ~Stream() { free(data); }
+};
+
+/** The batch mode's results */
+struct BatchStats
+{
+    /** The valid packets per type */
+    uint64 counts[16];
+    uint64 packets, bytes, malformed, truncated;
+    /** The bytes skipped to find the first packet after a gap in a capture, and the number of such gaps */
+    uint64 skipped, gaps;
+    enum { MaxReported = 32 };
+
+    BatchStats() : packets(0), bytes(0), malformed(0), truncated(0), skipped(0), gaps(0) { memset(counts, 0, sizeof(counts)); }
+};
+
+/** The result of checking a packet in a stream */
+enum PacketStatus { ValidPacket, MalformedPacket, InvalidLength, TruncatedPacket };
+
+/** Check the packet at the given position in the stream.
+    @param size     On output, the packet's size (or the remaining bytes if it's truncated)
+    @param error    On output, the decoding error for a malformed packet
+    @return the packet's status */
+PacketStatus checkPacketAt(const Stream & stream, const size_t pos, uint32 & size, uint32 & error)
+{
+    const uint8 * buffer = stream.data + pos;
+    uint32 available = (uint32)min(stream.size - pos, (size_t)0xFFFFFFFF);
+    Protocol::MQTT::Common::VBInt len;
+    uint32 r = available < 2 ? (uint32)Protocol::MQTT::Common::NotEnoughData : len.readFrom(&buffer[1], available - 1);
+    size = (uint32)len + 1 + len.getSize();
+    if (r == Protocol::MQTT::Common::NotEnoughData || (!Protocol::MQTT::Common::isError(r) && size > available))
+    {   // The stream ends in the middle of a packet (the capture started or stopped there)
+        size = available;
+        return TruncatedPacket;
+    }
+    if (Protocol::MQTT::Common::isError(r)) return InvalidLength;
+    error = decodePacket(buffer[0] >> 4, buffer, size);
+    return Protocol::MQTT::Common::isError(error) ? MalformedPacket : ValidPacket;
+}
+
+/** Find the first position in the stream where a few valid packets follow each other (or up to the stream's end).
+    After a gap in a capture, the stream likely starts in the middle of a packet */
+size_t findFirstPacket(const Stream & stream)
+{
+    enum { RequiredPackets = 3 };
+    for (size_t pos = 0; pos < stream.size; pos++)
+    {
+        size_t next = pos;
+        int found = 0;
+        PacketStatus status = ValidPacket;
+        while (found < RequiredPackets && next < stream.size)
+        {
+            uint32 size, error;
+            status = checkPacketAt(stream, next, size, error);
+            if (status != ValidPacket) break;
+            next += size;
+            found++;
+        }
+        if (found == RequiredPackets || (found && (next == stream.size || status == TruncatedPacket))) return pos;
+    }
+    return stream.size;
+}
+
+/** Decode all the packets in the given stream.
+    Only the valid packets are counted per type. The bytes skipped after a gap aren't reported as malformed packets.
+    @param report   If not null, the malformed packets are reported with this name */
+void decodeStream(const Stream & stream, BatchStats & stats, const char * report)
+{
+    size_t pos = 0;
+    if (stream.resync)
+    {   // Skip the end of the packet that was cut by the gap
+        pos = findFirstPacket(stream);
+        stats.gaps++;
+        stats.skipped += pos;
+        if (report && pos) printf("%s: skipped %zu bytes after a gap in the capture\n", report, pos);
+    }
+    while (pos < stream.size)
+    {
+        uint32 packetSize = 0, error = 0;
+        const uint8 type = stream.data[pos] >> 4;
+        switch (checkPacketAt(stream, pos, packetSize, error))
+        {
+        case TruncatedPacket:
+            stats.truncated++;
+            if (report) printf("%s: truncated packet at offset %zu\n", report, pos);
+            return;
+        case InvalidLength:
+            // Can't find the next packet with an invalid length, so give up on this stream
+            stats.malformed++;
+            if (report && stats.malformed <= BatchStats::MaxReported) printf("%s: invalid packet length at offset %zu, skipping the remaining %zu bytes\n", report, pos, stream.size - pos);
+            return;
+        case MalformedPacket:
+            stats.malformed++;
+            if (report && stats.malformed <= BatchStats::MaxReported)
+                printf("%s: malformed %s packet at offset %zu (error %08X)\n", report, Protocol::MQTT::V5::Helper::getControlPacketName((Protocol::MQTT::Common::ControlPacketType)type), pos, error);
+            break;
+        case ValidPacket:
+            stats.counts[type]++;
+            stats.packets++;
+            stats.bytes += packetSize;
+            break;
+        }
+        pos += packetSize;
+    }
+}
+
+inline uint16 readBE16(const uint8 * p) { return (uint16)((p[0] << 8) | p[1]); }
+inline uint32 readBE32(const uint8 * p) { return ((uint32)readBE16(p) << 16) | readBE16(p + 2); }
+
+/** Extract the TCP payload of each connection (in each direction) from a pcap capture.
+    Only the classic pcap format is supported, with Ethernet, raw IP or Linux cooked link types. The segments are appended
+    in the capture order, retransmissions are skipped and a gap (missing or truncated segment) ends the stream's decodable
+    part: the remaining data is kept in a new stream (starting at the next segment). Such a stream (or one whose SYN isn't
+    in the capture) can start in the middle of a packet, so its decoding starts at the first valid packets.
+    @return the number of streams or -1 if the capture is invalid */
+int extractStreams(const uint8 * buffer, const size_t size, Stream * streams, const int maxStreams)
+{
+    if (size < 24) return -1;
+    uint32 magic; memcpy(&magic, buffer, 4);
+    bool swapped = magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1;
+    if (!swapped && magic != 0xA1B2C3D4 && magic != 0xA1B23C4D) return -1;
+    #define PcapU32(X) (swapped ? (uint32)(((X) >> 24) | (((X) >> 8) & 0xFF00) | (((X) << 8) & 0xFF0000) | ((X) << 24)) : (X))
+    uint32 link; memcpy(&link, buffer + 20, 4); link = PcapU32(link);
+    int count = 0;
+    size_t pos = 24;
+    while (pos + 16 <= size)
+    {
+        uint32 rec[4]; memcpy(rec, buffer + pos, 16);
+        uint32 captured = PcapU32(rec[2]), length = PcapU32(rec[3]);
+        pos += 16;
+        if (pos + captured > size) break;
+        const uint8 * frame = buffer + pos, * end = frame + captured;
+        pos += captured;
+
+        // Find the IP header
+        uint16 etherType = 0;
+        switch (link)
+        {
+        case 1:   if (captured < 14) continue; etherType = readBE16(frame + 12); frame += 14;
+                  if (etherType == 0x8100 && frame + 4 <= end) { etherType = readBE16(frame + 2); frame += 4; } break;
+        case 113: if (captured < 16) continue; etherType = readBE16(frame + 14); frame += 16; break;
+        case 101: case 228: case 229: if (!captured) continue; etherType = (frame[0] >> 4) == 6 ? 0x86DD : 0x0800; break;
+        default: return -1;
+        }
+        // Then the TCP header, and remember the connection's addresses
+        uint8 key[36] = {};
+        const uint8 * tcp = 0;
+        if (etherType == 0x0800 && frame + 20 <= end && frame[9] == 6)
+        {
+            memcpy(key, frame + 12, 8);
+            tcp = frame + (frame[0] & 0xF) * 4;
+        }
+        else if (etherType == 0x86DD && frame + 40 <= end && frame[6] == 6)
+        {
+            memcpy(key, frame + 8, 32);
+            tcp = frame + 40;
+        }
+        if (!tcp || tcp + 20 > end) continue;
+        memcpy(key + 32, tcp, 4);
+        const uint8 * payload = tcp + (tcp[12] >> 4) * 4;
+        uint32 seq = readBE32(tcp + 4);
+
+        // Find the last stream for this connection
+        int i = count - 1;
+        while (i >= 0 && memcmp(streams[i].key, key, sizeof(key))) i--;
+        if (tcp[13] & 0x02)
+        {   // SYN, so the connection starts here, aligned on a packet (unless it's a retransmitted SYN)
+            if (count == maxStreams || (i >= 0 && !streams[i].size && streams[i].nextSeq == seq + 1)) continue;
+            i = count++;
+            memcpy(streams[i].key, key, sizeof(key));
+            streams[i].nextSeq = seq + 1;
+            continue;
+        }
+        if (payload >= end) continue;
+        size_t payloadSize = (size_t)(end - payload);
+        // Was the segment truncated by the capture ?
+        bool truncated = captured < length;
+
+        if (i >= 0 && !streams[i].broken && (int32)(seq - streams[i].nextSeq) < 0) continue; // Retransmission
+        if (i < 0 || streams[i].broken || streams[i].nextSeq != seq)
+        {   // Gap or connection started before the capture, so start a new stream that must find the first packet
+            if (count == maxStreams) continue;
+            i = count++;
+            memcpy(streams[i].key, key, sizeof(key));
+            streams[i].resync = true;
+        }
+        streams[i].append(payload, payloadSize);
+        streams[i].nextSeq = seq + (uint32)payloadSize;
+        // Start a new stream for the next segment if this one is truncated
+        streams[i].broken = truncated;
+    }
+    #undef PcapU32
+    return count;
+}
+
+/** Parse a file made of concatenated packets or a pcap capture, and report the packets found and the decoding throughput */
+int batchParse(const char * path, const int repeat)
+{
+    uint8 * inBuffer = 0;
+    size_t inSize = 0;
+    if (!readFile(path, inBuffer, inSize, (size_t)1024*1024*1024))
+        return fprintf(stderr, "Can't read the given file: %s\n", path);
+
+    enum { MaxStreams = 256 };
+    Stream * streams = new Stream[MaxStreams];
+    int count = extractStreams(inBuffer, inSize, streams, MaxStreams);
+    if (count < 0)
+    {   // Not a capture, so the file is made of concatenated packets
+        count = 1;
+        streams[0].append(inBuffer, inSize);
+    }
+    else printf("Found %d TCP stream(s) in the capture\n", count);
+    delete[] inBuffer;
+
+    Protocol::MQTT::V5::registerAllProperties();
+    // First pass to report the packets and the malformed ones
+    BatchStats stats;
+    for (int i = 0; i < count; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "Stream %d", i);
+        decodeStream(streams[i], stats, name);
+    }
+    if (stats.malformed > BatchStats::MaxReported) printf("... and %llu other malformed packets\n", (unsigned long long)(stats.malformed - BatchStats::MaxReported));
+
+    printf("\n%llu packets (%llu bytes), %llu malformed, %llu truncated\n", (unsigned long long)stats.packets, (unsigned long long)stats.bytes,
+           (unsigned long long)stats.malformed, (unsigned long long)stats.truncated);
+    if (stats.gaps) printf("%llu bytes skipped after %llu gap(s) in the capture\n", (unsigned long long)stats.skipped, (unsigned long long)stats.gaps);
+    for (uint8 i = 1; i < 16; i++)
+        if (stats.counts[i]) printf("%12s: %llu\n", Protocol::MQTT::V5::Helper::getControlPacketName((Protocol::MQTT::Common::ControlPacketType)i), (unsigned long long)stats.counts[i]);
+
+    // Then measure the decoding throughput without reporting
+    if (stats.packets)
+    {
+        BatchStats timed;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeat; r++)
+            for (int i = 0; i < count; i++) decodeStream(streams[i], timed, 0);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed <= 0) elapsed = 1e-9;
+        printf("\nDecoded %llu packets in %.3f ms: %.0f packets/s, %.2f MB/s\n", (unsigned long long)timed.packets, elapsed * 1000,
+               timed.packets / elapsed, timed.bytes / elapsed / (1024 * 1024));
+    }
+    delete[] streams;
+    // The gaps are the capture's fault, only the malformed packets are an error
+    return stats.malformed ? 1 : 0;
+}
+
 int main(int argc, char ** argv)
 {
+    if (argc >= 3 && String("-b") == argv[1])
+    {
+        InitLogger initLogger(false);
+        return batchParse(argv[2], argc > 3 ? max(atoi(argv[3]), 1) : 10);
+    }
     InitLogger initLogger(true);
     // First convert the input from what it is to something we can parse
     if (argc == 1 || (argc == 2 && String("--help") == argv[1]))
     {
         printf("MQTTv5 Packet Parser\nUsage is: %s 0x34 0xC3  or %s 12 23 45 AB CE or %s \"12ACBEC345353\" or %s -f fileToParse\n", argv[0], argv[0], argv[0], argv[0]);
+        printf("Batch mode: %s -b fileToParse [repeat]\n  Decode all the packets in the file (concatenated packets or a pcap capture), report the packets found and the decoding throughput (measured on repeat passes, 10 by default)\n", argv[0]);
         return 0;
     }
 
@@ -110,26 +438,8 @@ int main(int argc, char ** argv)
 
     // Then dump it now
     Protocol::MQTT::V5::registerAllProperties();
-    Protocol::MQTT::V5::ControlPacketSerializable * packet;
-    switch ((uint8)header.type)
-    {
-    case Protocol::MQTT::V5::RESERVED: return fprintf(stderr, "Can not parse further...\n");
-    case Protocol::MQTT::V5::CONNECT:     packet = new Protocol::MQTT::V5::ConnectPacket; break;
-    case Protocol::MQTT::V5::CONNACK:     packet = new Protocol::MQTT::V5::ROConnACKPacket; break;
-    case Protocol::MQTT::V5::PUBLISH:     packet = new Protocol::MQTT::V5::ROPublishPacket; break;
-    case Protocol::MQTT::V5::PUBACK:      packet = new Protocol::MQTT::V5::ROPubACKPacket; break;
-    case Protocol::MQTT::V5::PUBREC:      packet = new Protocol::MQTT::V5::ROPubRecPacket; break;
-    case Protocol::MQTT::V5::PUBREL:      packet = new Protocol::MQTT::V5::ROPubRelPacket; break;
-    case Protocol::MQTT::V5::PUBCOMP:     packet = new Protocol::MQTT::V5::ROPubCompPacket; break;
-    case Protocol::MQTT::V5::SUBSCRIBE:   packet = new Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::Common::SUBSCRIBE>; break;
-    case Protocol::MQTT::V5::SUBACK:      packet = new Protocol::MQTT::V5::ROSubACKPacket; break;
-    case Protocol::MQTT::V5::UNSUBSCRIBE: packet = new Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::Common::UNSUBSCRIBE>; break;
-    case Protocol::MQTT::V5::UNSUBACK:    packet = new Protocol::MQTT::V5::ROUnsubACKPacket; break;
-    case Protocol::MQTT::V5::PINGREQ:     packet = new Protocol::MQTT::V5::PingReqPacket; break;
-    case Protocol::MQTT::V5::PINGRESP:    packet = new Protocol::MQTT::V5::PingRespPacket; break;
-    case Protocol::MQTT::V5::DISCONNECT:  packet = new Protocol::MQTT::V5::RODisconnectPacket; break;
-    case Protocol::MQTT::V5::AUTH:        packet = new Protocol::MQTT::V5::ROAuthPacket; break;
-    }
+    if ((uint8)header.type == Protocol::MQTT::V5::RESERVED) return fprintf(stderr, "Can not parse further...\n");
+    Protocol::MQTT::V5::ControlPacketSerializable * packet = createPacket((uint8)header.type);
     r = packet->readFrom(inBuffer, inSize);
     if (Protocol::MQTT::Common::isError(r))
         return fprintf(stderr, "Could not parse packet with error: %u\n", r);
@@ -1,6 +1,8 @@
 // Usual programs
 #include <stdio.h>
 #include <stdlib.h>
+// We need a clock for benchmarking
+#include <chrono>
 
 // We need FastString
 #include "Strings/Strings.hpp"
@@ -16,6 +18,10 @@
 #undef MQTTStringGetLength
 #define MQTTStringGetLength(X)  X.getLength()
 #include "Protocol/MQTT/MQTT.hpp"
+// We need the latency histogram (it's header only, so it doesn't depend on the library's flags)
+#include "Network/Clients/LatencyHistogram.hpp"
+// We need the TLS session cache's bookkeeping (it doesn't depend on the TLS library)
+#include "Network/Clients/TLSSessionCache.hpp"
 
 typedef Strings::FastString String;
 
@@ -162,7 +168,6 @@ int main(int argc, char ** argv)
             delete[] buffer;
             return 1;
         }
-        delete[] buffer;
 
         // Check it's the same as input
         if (packet.fixedVariableHeader.keepAlive != toPacket.fixedVariableHeader.keepAlive) return err("Failed to match header keepAlive");
@@ -189,9 +194,296 @@ int main(int argc, char ** argv)
                 if (v->value != "value") return err("Invalid UserProperty value");
             }
         }
+        // Same check with the index this time (on a view of the serialized properties, like a received packet)
+        uint8 * propsBuffer = new uint8[toPacket.props.getSize()];
+        toPacket.props.copyInto(propsBuffer);
+        Protocol::MQTT::V5::PropertiesView view;
+        if (view.readFrom(propsBuffer, toPacket.props.getSize()) != toPacket.props.getSize()) return err("Can't view serialized properties");
+        Protocol::MQTT::V5::PropertiesIndex index(view);
+        uint32 maxSize = 0;
+        uint16 receiveMax = 0;
+        Protocol::MQTT::V5::DynamicStringPairView userPair;
+        if (!index.getValue(Protocol::MQTT::V5::PacketSizeMax, maxSize) || maxSize != 2048) return err("Invalid indexed PacketSizeMax property");
+        if (!index.getValue(Protocol::MQTT::V5::UserProperty, userPair)) return err("Can't find indexed UserProperty");
+        if (userPair.key != "key" || userPair.value != "value") return err("Invalid indexed UserProperty");
+        if (index.getValue(Protocol::MQTT::V5::ReceiveMax, receiveMax)) return err("Unexpected indexed ReceiveMax property");
+        if (index.getValue(Protocol::MQTT::V5::PacketSizeMax, receiveMax)) return err("Indexed property type mismatch not detected");
+        delete[] propsBuffer;
+        delete[] buffer;
         // All good
     }
 
+    // Testing the PUBLISH fast path parsing against the generic parsing
+    {
+        Protocol::MQTT::V5::Property<Protocol::MQTT::Common::DynamicString> contentType(Protocol::MQTT::V5::ContentType, "text/plain");
+        Protocol::MQTT::V5::PublishPacket packet;
+        packet.props.append(&contentType);
+        packet.header.setQoS(1);
+        packet.fixedVariableHeader.topicName = "a/topic";
+        packet.fixedVariableHeader.packetID = 0x1234;
+        const uint8 payload[] = "Some payload for testing";
+        packet.payload.setExpectedPacketSize(sizeof(payload));
+        packet.payload.readFrom(payload, sizeof(payload));
+
+        uint32 packetSize = packet.computePacketSize(true);
+        uint8 * buffer = new uint8[packetSize];
+        if (packet.copyInto(buffer) != packetSize) return err("Can't serialize PUBLISH packet");
+
+        Protocol::MQTT::V5::ROPublishPacket generic;
+        Protocol::MQTT::V5::PublishPacketView fast;
+        if (generic.readFrom(buffer, packetSize) != packetSize) return err("Can't deserialize PUBLISH packet");
+        if (fast.readFrom(buffer, packetSize) != packetSize) return err("Can't deserialize PUBLISH packet with fast path");
+        if (fast.header.getQoS() != generic.header.getQoS()) return err("Failed to match PUBLISH QoS");
+        if (fast.topicName != generic.fixedVariableHeader.topicName) return err("Failed to match PUBLISH topic");
+        if (fast.packetID != generic.fixedVariableHeader.packetID) return err("Failed to match PUBLISH packet ID");
+        if (fast.props.getSize() != generic.props.getSize() || fast.props.buffer != generic.props.buffer) return err("Failed to match PUBLISH properties");
+        if (fast.payload.length != generic.payload.size || fast.payload.data != generic.payload.data) return err("Failed to match PUBLISH payload");
+        if (fast.readFrom(buffer, packetSize - 1) != Protocol::MQTT::Common::NotEnoughData) return err("Failed to detect truncated PUBLISH packet");
+
+        if (argc > 1 && MQTTString(argv[1]) == "bench")
+        {
+            const uint32 loops = 10000000;
+            uint32 sum = 0;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (uint32 i = 0; i < loops; i++)
+            {
+                Protocol::MQTT::V5::ROPublishPacket p;
+                sum += p.readFrom(buffer, packetSize);
+            }
+            double genericNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / loops;
+            start = std::chrono::steady_clock::now();
+            for (uint32 i = 0; i < loops; i++)
+            {
+                Protocol::MQTT::V5::PublishPacketView p;
+                sum += p.readFrom(buffer, packetSize);
+            }
+            double fastNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / loops;
+            printf("PUBLISH parsing (%u bytes): generic %.1fns/msg, fast path %.1fns/msg (%u)\n", packetSize, genericNs, fastNs, sum);
+        }
+        delete[] buffer;
+    }
+
+    // Testing the forwarded PUBLISH packet against a rebuilt one
+    {
+        namespace V5 = Protocol::MQTT::V5;
+        typedef Protocol::MQTT::Common::DynamicStringPair Pair;
+        const uint8 payload[] = "Some payload to forward";
+        // The received packet's properties are Payload Format, Subscription Identifier, Content Type, Topic Alias, User Property
+        // and Message Expiry (a property list is serialized from the last appended property)
+        V5::Property<uint32> expiry(V5::MessageExpiryInterval, 60);
+        V5::Property<Pair> user(V5::UserProperty, Pair("k", "v"));
+        V5::Property<uint16> alias(V5::TopicAlias, 3);
+        V5::Property<V5::DynamicString> type(V5::ContentType, "text");
+        V5::Property<V5::VBInt> subID(V5::SubscriptionID, V5::VBInt(5));
+        V5::Property<uint8> format(V5::PayloadFormat, 1);
+        V5::PublishPacket received;
+        received.props.append(&expiry); received.props.append(&user); received.props.append(&alias);
+        received.props.append(&type); received.props.append(&subID); received.props.append(&format);
+        received.fixedVariableHeader.topicName = "in/t";
+        received.payload.setExpectedPacketSize(sizeof(payload));
+        received.payload.readFrom(payload, sizeof(payload));
+        uint32 receivedSize = received.computePacketSize(true);
+        uint8 * receivedBuffer = new uint8[receivedSize];
+        if (received.copyInto(receivedBuffer) != receivedSize) return err("Can't serialize PUBLISH packet");
+        V5::PublishPacketView view;
+        if (view.readFrom(receivedBuffer, receivedSize) != receivedSize) return err("Can't deserialize PUBLISH packet with fast path");
+
+        // The edited properties replace the Content Type and add a User Property
+        V5::Property<Pair> hop(V5::UserProperty, Pair("hop", "1"));
+        V5::Property<V5::DynamicString> json(V5::ContentType, "json");
+        V5::Properties edited;
+        edited.append(&hop); edited.append(&json);
+
+        V5::ForwardedPublish forwarded;
+        if (!forwarded.prepare(V5::DynamicStringView("out/t"), view.payload, view.props, &edited, 1, false) || !forwarded.fits())
+            return err("Can't prepare forwarded PUBLISH packet");
+        uint8 * middle = new uint8[forwarded.middleSize()];
+        if (forwarded.compactSize()) return err("Failed to refer to the forwarded properties");
+        int count = forwarded.build(7, middle, 0);
+        // Header, topic, middle, Payload Format, User Property with Message Expiry, and payload
+        if (count != 6 || forwarded.parts[3].data != view.props.buffer) return err("Failed to split forwarded PUBLISH packet");
+        uint8 * forwardedBuffer = new uint8[forwarded.packetSize];
+        uint32 o = 0;
+        for (int i = 0; i < count; o += forwarded.parts[i].size, i++)
+            memcpy(forwardedBuffer + o, forwarded.parts[i].data, forwarded.parts[i].size);
+        if (o != forwarded.packetSize) return err("Failed to match forwarded PUBLISH packet size");
+
+        // The same packet rebuilt: the edited properties come first, then the kept ones
+        V5::Property<uint32> expiry2(V5::MessageExpiryInterval, 60);
+        V5::Property<Pair> user2(V5::UserProperty, Pair("k", "v"));
+        V5::Property<uint8> format2(V5::PayloadFormat, 1);
+        V5::Property<Pair> hop2(V5::UserProperty, Pair("hop", "1"));
+        V5::Property<V5::DynamicString> json2(V5::ContentType, "json");
+        V5::PublishPacket expected;
+        expected.props.append(&expiry2); expected.props.append(&user2); expected.props.append(&format2);
+        expected.props.append(&hop2); expected.props.append(&json2);
+        expected.header.setQoS(1);
+        expected.fixedVariableHeader.topicName = "out/t";
+        expected.fixedVariableHeader.packetID = 7;
+        expected.payload.setExpectedPacketSize(sizeof(payload));
+        expected.payload.readFrom(payload, sizeof(payload));
+        uint32 expectedSize = expected.computePacketSize(true);
+        uint8 * expectedBuffer = new uint8[expectedSize];
+        if (expected.copyInto(expectedBuffer) != expectedSize) return err("Can't serialize PUBLISH packet");
+        if (expectedSize != forwarded.packetSize || memcmp(expectedBuffer, forwardedBuffer, expectedSize)) return err("Failed to match forwarded PUBLISH packet content");
+        delete[] receivedBuffer;
+        delete[] forwardedBuffer;
+        delete[] expectedBuffer;
+        delete[] middle;
+
+        // Too many runs: alternate Subscription Identifier and User Property, so the kept properties are copied
+        uint8 props[90], expectedHeader[] = { 0x30, 3 + 1 + 70, 0, 1, 'x', 70 };
+        uint32 p = 0;
+        for (int i = 0; i < 10; i++)
+        {
+            const uint8 prop[] = { 0x0B, (uint8)(i + 1), 0x26, 0, 1, 'a', 0, 1, 'b' };
+            memcpy(props + p, prop, sizeof(prop)); p += sizeof(prop);
+        }
+        V5::PropertiesView scattered;
+        scattered.length = p;
+        scattered.buffer = props;
+        V5::ForwardedPublish compacted;
+        if (!compacted.prepare(V5::DynamicStringView("x"), V5::DynamicBinDataView(), scattered, 0, 0, false) || compacted.compactSize() != 70)
+            return err("Can't prepare forwarded PUBLISH packet with scattered properties");
+        uint8 smallMiddle[6], compact[70];
+        count = compacted.build(0, smallMiddle, compact);
+        if (count != 4 || compacted.packetSize != sizeof(expectedHeader) + 70) return err("Failed to compact forwarded properties");
+        if (memcmp(compacted.parts[0].data, expectedHeader, 4) || memcmp(compacted.parts[1].data, "x", 1) || compacted.parts[2].size != 1 || compacted.parts[2].data[0] != 70)
+            return err("Failed to match forwarded PUBLISH header");
+        for (int i = 0; i < 10; i++)
+            if (memcmp(compacted.parts[3].data + i * 7, props + i * 9 + 2, 7)) return err("Failed to match compacted forwarded properties");
+
+        props[2] = 0x7F; // Not a property type anymore
+        if (compacted.prepare(V5::DynamicStringView("x"), V5::DynamicBinDataView(), scattered, 0, 0, false)) return err("Failed to detect malformed forwarded properties");
+    }
+
+    // Testing the contiguous subscribe topics against the chained list
+    {
+        const char * topics[] = { "a/b", "c/+/d", "e/#" };
+        const uint8 option = Protocol::MQTT::V5::SubscribeTopicArray::makeOption(1, true, false, 2);
+        Protocol::MQTT::V5::SubscribeTopic * list = 0;
+        Protocol::MQTT::V5::SubscribeTopicArray array;
+        for (size_t i = 0; i < sizeof(topics) / sizeof(*topics); i++)
+        {
+            Protocol::MQTT::V5::SubscribeTopic * topic = new Protocol::MQTT::V5::SubscribeTopic(topics[i], 1, true, false, 2);
+            if (!list) list = topic; else list->append(topic);
+            if (!array.append(topics[i], 0, option)) return err("Can't append to topic array");
+        }
+        if (array.count() != list->count()) return err("Failed to match topic count");
+        if (array.append("")) return err("Empty topic accepted in topic array");
+
+        Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::SUBSCRIBE> listPacket, arrayPacket;
+        listPacket.fixedVariableHeader.packetID = arrayPacket.fixedVariableHeader.packetID = 0x1234;
+        listPacket.payload.topics = list;
+        arrayPacket.payload.topicArray = &array;
+        uint32 listSize = listPacket.computePacketSize(true), arraySize = arrayPacket.computePacketSize(true);
+        if (listSize != arraySize) return err("Failed to match SUBSCRIBE packet size");
+        uint8 * listBuffer = new uint8[listSize], * arrayBuffer = new uint8[arraySize];
+        if (listPacket.copyInto(listBuffer) != listSize || arrayPacket.copyInto(arrayBuffer) != arraySize) return err("Can't serialize SUBSCRIBE packet");
+        if (memcmp(listBuffer, arrayBuffer, listSize)) return err("Failed to match SUBSCRIBE packet content");
+        delete[] listBuffer;
+        delete[] arrayBuffer;
+
+        if (argc > 1 && MQTTString(argv[1]) == "bench")
+        {
+            const uint32 count = 10000;
+            char topic[32];
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            {
+                Protocol::MQTT::V5::ControlPacket<Protocol::MQTT::V5::SUBSCRIBE> packet;
+                for (uint32 i = 0; i < count; i++)
+                {
+                    snprintf(topic, sizeof(topic), "some/topic/%u", i);
+                    Protocol::MQTT::V5::SubscribeTopic * t = new Protocol::MQTT::V5::SubscribeTopic(topic, 1, true, false, 2);
+                    if (!packet.payload.topics) packet.payload.topics = t; else packet.payload.topics->append(t);
+                }
+                uint8 * out = new uint8[packet.payload.getSize()];
+                packet.payload.copyInto(out);
+                delete[] out;
+            }
+            double listMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            start = std::chrono::steady_clock::now();
+            {
+                Protocol::MQTT::V5::SubscribeTopicArray topics;
+                for (uint32 i = 0; i < count; i++)
+                {
+                    int len = snprintf(topic, sizeof(topic), "some/topic/%u", i);
+                    topics.append(topic, (uint32)len, option);
+                }
+                uint8 * out = new uint8[topics.getSize()];
+                topics.copyInto(out);
+                delete[] out;
+            }
+            double arrayMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            printf("Building and encoding %u subscribe topics: list %.2fms, contiguous %.2fms\n", count, listMs, arrayMs);
+        }
+    }
+
+    {
+        printf("Testing latency histogram\n");
+        typedef Network::Client::LatencyHistogram Histogram;
+        // Exact below 16, then 16 sub-buckets per power of two
+        for (uint32 i = 0; i < 16; i++)
+            if (Histogram::bucketOf(i) != i || Histogram::highestValueOf(i) != i) return err("Failed to count small latencies exactly");
+        if (Histogram::bucketOf(16) != 16 || Histogram::bucketOf(31) != 31 || Histogram::bucketOf(32) != 32 || Histogram::bucketOf(33) != 32 || Histogram::bucketOf(34) != 33)
+            return err("Failed to match latency buckets");
+        if (Histogram::bucketOf(0xFFFFFFFF) != Histogram::BucketsCount - 1 || Histogram::highestValueOf(Histogram::BucketsCount - 1) != 0xFFFFFFFF)
+            return err("Failed to match the highest latency bucket");
+        // Each value is in a bucket whose highest value is at most 6.25% above it, and the buckets are contiguous
+        for (uint64 v = 1; v <= 0xFFFFFFFF; v = v * 9 / 8 + 1)
+        {
+            const uint32 value = (uint32)v, bucket = Histogram::bucketOf(value), highest = Histogram::highestValueOf(bucket);
+            if (highest < value || (uint64)(highest - value) * 16 > value) return err("Failed to bound latency bucket's precision");
+            if (bucket && Histogram::highestValueOf(bucket - 1) >= value) return err("Failed to match contiguous latency buckets");
+        }
+
+        Histogram histogram;
+        if (histogram.valueAtPercentile(50) || histogram.mean()) return err("Failed to report an empty latency histogram");
+        for (uint32 i = 1; i <= 1000; i++) histogram.record(i);
+        if (histogram.count != 1000 || histogram.minValue != 1 || histogram.maxValue != 1000 || histogram.mean() != 500)
+            return err("Failed to record latencies");
+        uint32 p50 = histogram.valueAtPercentile(50), p99 = histogram.valueAtPercentile(99);
+        if (p50 < 500 || p50 > 500 + 500 / 16 || p99 < 990 || p99 > 1000 || histogram.valueAtPercentile(100) != 1000 || histogram.valueAtPercentile(0) != 1)
+            return err("Failed to match latency percentiles");
+        histogram.reset();
+        histogram.record(7);
+        if (histogram.count != 1 || histogram.valueAtPercentile(99.9) != 7) return err("Failed to reset latency histogram");
+    }
+
+    {
+        printf("Testing TLS session cache\n");
+        typedef Network::Client::TLSSessionCache<int, 3> Cache;
+        Cache cache;
+        if (cache.use("broker", 8883, 1)) return err("Failed to report a missing TLS session");
+        // Fill the cache, the free entries are used first
+        const char * hosts[] = { "a", "b", "c" };
+        for (int i = 0; i < 3; i++)
+        {
+            Cache::Entry & entry = cache.assign(hosts[i], 8883, 1);
+            if (entry.valid) return err("Failed to use a free TLS session entry");
+            entry.session = i; entry.valid = true;
+        }
+        // The key is the host, the port and the certificates' hash
+        Cache::Entry * entry = cache.use("b", 8883, 1);
+        if (!entry || entry->session != 1) return err("Failed to find a TLS session");
+        if (cache.use("b", 1883, 1) || cache.use("b", 8883, 2) || cache.use("d", 8883, 1)) return err("Failed to match a TLS session's key");
+        // Saving again for the same broker reuses its entry
+        if (&cache.assign("c", 8883, 1) != cache.find("c", 8883, 1)) return err("Failed to reuse a TLS session entry");
+        // The least recently used entry is replaced ("a", since "b" and "c" were used after it)
+        entry = &cache.assign("d", 8883, 1);
+        if (!entry->valid || entry->session != 0 || strcmp(entry->host, "d")) return err("Failed to replace the least recently used TLS session");
+        entry->session = 3;
+        if (cache.find("a", 8883, 1) || !cache.find("b", 8883, 1) || !cache.find("c", 8883, 1)) return err("Failed to keep the recently used TLS sessions");
+        // Now "b" is the least recently used, unless it's used again
+        cache.use("b", 8883, 1);
+        entry = &cache.assign("e", 8883, 1);
+        if (entry->session != 2 || cache.find("c", 8883, 1) || !cache.find("b", 8883, 1) || !cache.find("d", 8883, 1)) return err("Failed to update the TLS session's last use");
+        // A forgotten session is never found but its entry is reused first
+        cache.find("d", 8883, 1)->valid = false;
+        entry = &cache.assign("f", 8883, 1);
+        if (entry->valid || entry->session != 3 || cache.find("d", 8883, 1)) return err("Failed to reuse a forgotten TLS session entry");
+    }
+
     printf("Success\n");
     return 0;
 }